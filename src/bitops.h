@@ -0,0 +1,28 @@
+#pragma once
+#include <stdint.h>
+
+#if defined(_MSC_VER)
+
+#include <intrin.h>
+#define popcount_64(x) ((unsigned)__popcnt64(x))
+static inline unsigned ctz_64(uint64_t x) {
+  unsigned long index;
+  _BitScanForward64(&index, x);
+  return index;
+}
+static inline unsigned clz_64(uint64_t x) {
+  unsigned long index;
+  _BitScanReverse64(&index, x);
+  return 63 - index;
+}
+
+#else
+
+#define popcount_64(x) ((unsigned)__builtin_popcountll(x))
+#define ctz_64(x) ((unsigned)__builtin_ctzll(x))
+#define clz_64(x) ((unsigned)__builtin_clzll(x))
+
+#endif
+
+// Number of trailing ones, plus one
+#define ffs_not_64(x) (ctz_64(~(uint64_t)(x)) + 1)
@@ -0,0 +1,89 @@
+#pragma once
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+// A growable, position-independent memory area.
+// Everything stored inside references other parts of the Blob by offset from
+// its start, so the Blob can be reallocated (or mapped) freely.
+// Offset 0 is reserved, so it can be used to mean "no table".
+
+typedef uint32_t BlobOffset;
+
+// An area a Blob outgrew, kept while it's still being read.
+typedef struct BlobArea {
+  struct BlobArea *next;
+  uint8_t *data;
+} BlobArea;
+
+typedef struct {
+  uint8_t *data;
+  size_t len;
+  size_t allocated;
+  // Copy the data to grow instead of moving it, keeping the old areas until
+  // the Blob is freed, so that they can still be read while it grows.
+  bool keep_old;
+  BlobArea *old;
+} Blob;
+
+#define BLOB_ALIGNMENT 8
+
+#define blob_at(base, offset, type) ((type *)((uint8_t *)(base) + (offset)))
+
+// Returns a zeroed area of `size` bytes, aligned to BLOB_ALIGNMENT.
+// Pointers obtained from the Blob are invalidated by this call, unless it
+// keeps the old areas.
+static inline bool Blob_alloc(Blob *blob, size_t size, BlobOffset *offset) {
+  size_t start = (blob->len + BLOB_ALIGNMENT - 1) & ~(size_t)(BLOB_ALIGNMENT - 1);
+  if (start == 0) start = BLOB_ALIGNMENT; // Keep offset 0 unused
+  if (start + size > UINT32_MAX) return false;
+  if (start + size > blob->allocated) {
+    size_t new_size = blob->allocated ? blob->allocated : 4096;
+    while (new_size < start + size) new_size *= 2;
+    uint8_t *data;
+    if (blob->keep_old && blob->data != NULL) {
+      BlobArea *old = malloc(sizeof(BlobArea));
+      data = malloc(new_size);
+      if (old == NULL || data == NULL) {
+        free(old);
+        free(data);
+        return false;
+      }
+      memcpy(data, blob->data, blob->allocated);
+      *old = (BlobArea){ .next = blob->old, .data = blob->data };
+      blob->old = old;
+    } else {
+      data = realloc(blob->data, new_size);
+      if (data == NULL) return false;
+    }
+    memset(data + blob->allocated, 0, new_size - blob->allocated);
+    blob->data = data;
+    blob->allocated = new_size;
+  }
+  blob->len = start + size;
+  *offset = (BlobOffset)start;
+  return true;
+}
+
+// Release the memory not used by the Blob.
+static inline void Blob_trim(Blob *blob) {
+  if (blob->data == NULL || blob->len == blob->allocated || blob->keep_old) return;
+  uint8_t *data = realloc(blob->data, blob->len);
+  if (data == NULL) return;
+  blob->data = data;
+  blob->allocated = blob->len;
+}
+
+static inline void Blob_free(Blob *blob) {
+  while (blob->old != NULL) {
+    BlobArea *next = blob->old->next;
+    free(blob->old->data);
+    free(blob->old);
+    blob->old = next;
+  }
+  free(blob->data);
+  blob->data = NULL;
+  blob->len = 0;
+  blob->allocated = 0;
+}
@@ -0,0 +1,196 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "cache.h"
+
+#define CACHE_SHARDS 16
+// Runs bigger than this fraction of a shard aren't cached
+#define CACHE_MAX_ENTRY_FRACTION 8
+
+typedef struct CacheEntry {
+  struct CacheEntry *next_in_bucket;
+  // Least recently used list, newest first
+  struct CacheEntry *newer, *older;
+  uint64_t hash;
+  uint32_t input_len;
+  uint32_t output_len;
+  bool modified;
+  uint16_t glyphs[]; // Input, followed by output
+} CacheEntry;
+
+typedef struct {
+  pthread_mutex_t lock;
+  CacheEntry **buckets;
+  size_t bucket_count; // Power of two
+  size_t entry_count;
+  CacheEntry *newest, *oldest;
+  size_t bytes;
+  size_t max_bytes;
+} CacheShard;
+
+typedef struct ResultCache {
+  CacheShard shards[CACHE_SHARDS];
+} ResultCache;
+
+#define entry_size(input_len, output_len) (sizeof(CacheEntry) + ((size_t)(input_len) + (output_len)) * sizeof(uint16_t))
+#define shard_of(cache, hash) (&(cache)->shards[(hash) >> 60])
+#define bucket_of(shard, hash) (&(shard)->buckets[(hash) & ((shard)->bucket_count - 1)])
+
+ResultCache *ResultCache_new(size_t max_bytes) {
+  ResultCache *cache = calloc(1, sizeof(ResultCache));
+  if (cache == NULL) return NULL;
+  for (size_t i = 0; i < CACHE_SHARDS; i++) {
+    CacheShard *shard = &cache->shards[i];
+    pthread_mutex_init(&shard->lock, NULL);
+    shard->max_bytes = max_bytes / CACHE_SHARDS;
+  }
+  return cache;
+}
+
+void ResultCache_free(ResultCache *cache) {
+  if (cache == NULL) return;
+  for (size_t i = 0; i < CACHE_SHARDS; i++) {
+    CacheShard *shard = &cache->shards[i];
+    CacheEntry *entry = shard->newest;
+    while (entry != NULL) {
+      CacheEntry *older = entry->older;
+      free(entry);
+      entry = older;
+    }
+    free(shard->buckets);
+    pthread_mutex_destroy(&shard->lock);
+  }
+  free(cache);
+}
+
+// Multiply-xorshift over four glyphs at a time, with the murmur3 finalizer.
+uint64_t hash_glyphs(const uint16_t *glyphs, size_t len) {
+  uint64_t hash = 0x9E3779B97F4A7C15u ^ (len * 0xC2B2AE3D27D4EB4Fu);
+  size_t i = 0;
+  for (; i + 4 <= len; i += 4) {
+    uint64_t word;
+    memcpy(&word, glyphs + i, sizeof(word));
+    hash = (hash ^ word) * 0xFF51AFD7ED558CCDu;
+    hash ^= hash >> 32;
+  }
+  for (; i < len; i++) {
+    hash = (hash ^ glyphs[i]) * 0xC4CEB9FE1A85EC53u;
+  }
+  hash ^= hash >> 33;
+  hash *= 0xFF51AFD7ED558CCDu;
+  hash ^= hash >> 33;
+  hash *= 0xC4CEB9FE1A85EC53u;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+bool ResultCache_fits(const ResultCache *cache, size_t len) {
+  return entry_size(len, len) <= cache->shards[0].max_bytes / CACHE_MAX_ENTRY_FRACTION;
+}
+
+static void unlink_entry(CacheShard *shard, CacheEntry *entry) {
+  if (entry->newer != NULL) entry->newer->older = entry->older;
+  else shard->newest = entry->older;
+  if (entry->older != NULL) entry->older->newer = entry->newer;
+  else shard->oldest = entry->newer;
+}
+
+static void push_entry(CacheShard *shard, CacheEntry *entry) {
+  entry->newer = NULL;
+  entry->older = shard->newest;
+  if (shard->newest != NULL) shard->newest->newer = entry;
+  shard->newest = entry;
+  if (shard->oldest == NULL) shard->oldest = entry;
+}
+
+static void evict_entry(CacheShard *shard, CacheEntry *entry) {
+  CacheEntry **link = bucket_of(shard, entry->hash);
+  while (*link != entry) link = &(*link)->next_in_bucket;
+  *link = entry->next_in_bucket;
+  unlink_entry(shard, entry);
+  shard->bytes -= entry_size(entry->input_len, entry->output_len);
+  shard->entry_count--;
+  free(entry);
+}
+
+static CacheEntry *find_entry(CacheShard *shard, uint64_t hash, const uint16_t *input, size_t input_len) {
+  if (shard->bucket_count == 0) return NULL;
+  for (CacheEntry *entry = *bucket_of(shard, hash); entry != NULL; entry = entry->next_in_bucket) {
+    if (entry->hash == hash && entry->input_len == input_len &&
+        memcmp(entry->glyphs, input, input_len * sizeof(uint16_t)) == 0) {
+      return entry;
+    }
+  }
+  return NULL;
+}
+
+static bool grow_buckets(CacheShard *shard) {
+  size_t bucket_count = shard->bucket_count == 0 ? 64 : shard->bucket_count * 2;
+  CacheEntry **buckets = calloc(bucket_count, sizeof(CacheEntry *));
+  if (buckets == NULL) return false;
+  for (size_t i = 0; i < shard->bucket_count; i++) {
+    CacheEntry *entry = shard->buckets[i];
+    while (entry != NULL) {
+      CacheEntry *next = entry->next_in_bucket;
+      CacheEntry **bucket = &buckets[entry->hash & (bucket_count - 1)];
+      entry->next_in_bucket = *bucket;
+      *bucket = entry;
+      entry = next;
+    }
+  }
+  free(shard->buckets);
+  shard->buckets = buckets;
+  shard->bucket_count = bucket_count;
+  return true;
+}
+
+bool ResultCache_get(ResultCache *cache, uint64_t hash, GlyphArray *glyph_array) {
+  CacheShard *shard = shard_of(cache, hash);
+  bool found = false;
+  pthread_mutex_lock(&shard->lock);
+  CacheEntry *entry = find_entry(shard, hash, glyph_array->array, glyph_array->len);
+  if (entry != NULL) {
+    unlink_entry(shard, entry);
+    push_entry(shard, entry);
+    // Copied while locked, as the entry could be evicted right after
+    found = !entry->modified ||
+            GlyphArray_splice(glyph_array, 0, glyph_array->len, entry->glyphs + entry->input_len, entry->output_len);
+  }
+  pthread_mutex_unlock(&shard->lock);
+  return found;
+}
+
+void ResultCache_put(ResultCache *cache, uint64_t hash, const uint16_t *input, size_t input_len, const GlyphArray *result) {
+  size_t size = entry_size(input_len, result->len);
+  CacheShard *shard = shard_of(cache, hash);
+  if (size > shard->max_bytes / CACHE_MAX_ENTRY_FRACTION) return;
+
+  CacheEntry *entry = malloc(size);
+  if (entry == NULL) return;
+  entry->hash = hash;
+  entry->input_len = input_len;
+  entry->output_len = result->len;
+  entry->modified = result->modified;
+  memcpy(entry->glyphs, input, input_len * sizeof(uint16_t));
+  memcpy(entry->glyphs + input_len, result->array, result->len * sizeof(uint16_t));
+
+  pthread_mutex_lock(&shard->lock);
+  // Another thread might have added it meanwhile
+  if (find_entry(shard, hash, input, input_len) != NULL ||
+      (shard->entry_count >= shard->bucket_count && !grow_buckets(shard))) {
+    pthread_mutex_unlock(&shard->lock);
+    free(entry);
+    return;
+  }
+  while (shard->oldest != NULL && shard->bytes + size > shard->max_bytes) {
+    evict_entry(shard, shard->oldest);
+  }
+  CacheEntry **bucket = bucket_of(shard, hash);
+  entry->next_in_bucket = *bucket;
+  *bucket = entry;
+  push_entry(shard, entry);
+  shard->bytes += size;
+  shard->entry_count++;
+  pthread_mutex_unlock(&shard->lock);
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "glypharray.h"
+
+// Results of applying a chain, by input run.
+// Entries are split between shards by hash, each with its own lock and
+// least-recently-used list, so that threads rarely wait for each other.
+typedef struct ResultCache ResultCache;
+
+ResultCache *ResultCache_new(size_t max_bytes);
+void ResultCache_free(ResultCache *cache);
+uint64_t hash_glyphs(const uint16_t *glyphs, size_t len);
+// Whether a run of len glyphs can be cached at all.
+bool ResultCache_fits(const ResultCache *cache, size_t len);
+// Replaces the glyphs in glyph_array with the cached result, if there's one.
+bool ResultCache_get(ResultCache *cache, uint64_t hash, GlyphArray *glyph_array);
+void ResultCache_put(ResultCache *cache, uint64_t hash, const uint16_t *input, size_t input_len, const GlyphArray *result);
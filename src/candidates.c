@@ -0,0 +1,94 @@
+#include "candidates.h"
+#include "cpu.h"
+
+static uint64_t candidates_scalar(Bloom bloom, const CompiledGlyphSet *set, const uint16_t *glyphs, size_t start, size_t len) {
+  uint64_t mask = 0;
+  for (size_t i = start; i < len; i++) {
+    bool candidate = set != NULL ? CompiledGlyphSet_has(set, glyphs[i]) : glyphID_compare_bloom(glyphs[i], bloom);
+    mask |= (uint64_t)candidate << i;
+  }
+  return mask;
+}
+
+#if defined(SIMD_X86)
+
+// Bit (id >> shift) % 64 of part, for 8 glyph IDs in 32-bit lanes.
+// The lanes pick the half of part they need, then shift within it.
+TARGET_AVX2 static inline __m256i bloom_bits_avx2(bloom_part part, __m256i ids, int shift) {
+  const __m256i halves = _mm256_setr_epi32((int)(uint32_t)part, (int)(uint32_t)(part >> 32), 0, 0, 0, 0, 0, 0);
+  __m256i bit = _mm256_and_si256(_mm256_srli_epi32(ids, shift), _mm256_set1_epi32(mask_bits - 1));
+  __m256i words = _mm256_permutevar8x32_epi32(halves, _mm256_srli_epi32(bit, 5));
+  return _mm256_srlv_epi32(words, _mm256_and_si256(bit, _mm256_set1_epi32(31)));
+}
+
+TARGET_AVX2 static uint64_t candidates_bloom_avx2(Bloom bloom, const uint16_t *glyphs, size_t len) {
+  const __m256i ones = _mm256_set1_epi32(1);
+  uint64_t mask = 0;
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    __m256i ids = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)&glyphs[i]));
+    __m256i bits = _mm256_and_si256(bloom_bits_avx2(bloom.a, ids, bloom_shift_a),
+                                    bloom_bits_avx2(bloom.b, ids, bloom_shift_b));
+    bits = _mm256_and_si256(bits, bloom_bits_avx2(bloom.c, ids, bloom_shift_c));
+    bits = _mm256_cmpeq_epi32(_mm256_and_si256(bits, ones), ones);
+    mask |= (uint64_t)(unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(bits)) << i;
+  }
+  return mask | candidates_scalar(bloom, NULL, glyphs, i, len);
+}
+
+// Gathers the 32-bit word of the set each glyph falls into, for the ones in
+// its range.
+TARGET_AVX2 static uint64_t candidates_set_avx2(const CompiledGlyphSet *set, const uint16_t *glyphs, size_t len) {
+  const int *words = (const int *)set->bits;
+  const __m256i first = _mm256_set1_epi32((int)set->first);
+  const __m256i limit = _mm256_set1_epi32((int)(set->count * 64));
+  const __m256i ones = _mm256_set1_epi32(1);
+  uint64_t mask = 0;
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    __m256i ids = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)&glyphs[i]));
+    __m256i offsets = _mm256_sub_epi32(ids, first);
+    __m256i in_range = _mm256_andnot_si256(_mm256_cmpgt_epi32(_mm256_setzero_si256(), offsets),
+                                           _mm256_cmpgt_epi32(limit, offsets));
+    if (_mm256_testz_si256(in_range, in_range)) continue;
+    __m256i gathered = _mm256_mask_i32gather_epi32(_mm256_setzero_si256(), words, _mm256_srli_epi32(offsets, 5), in_range, 4);
+    __m256i bits = _mm256_srlv_epi32(gathered, _mm256_and_si256(offsets, _mm256_set1_epi32(31)));
+    bits = _mm256_cmpeq_epi32(_mm256_and_si256(bits, ones), ones);
+    mask |= (uint64_t)(unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(bits)) << i;
+  }
+  return mask | candidates_scalar(null_bloom, set, glyphs, i, len);
+}
+
+// Without variable shifts or gathers, only skip 8 glyphs at a time while
+// they're all outside the range of the set.
+static uint64_t candidates_set_sse2(const CompiledGlyphSet *set, const uint16_t *glyphs, size_t len) {
+  if (set->count == 0) return 0;
+  uint32_t last = set->first + set->count * 64 - 1;
+  if (last > UINT16_MAX) last = UINT16_MAX;
+  const __m128i first = _mm_set1_epi16((short)set->first);
+  const __m128i range = _mm_set1_epi16((short)(last - set->first));
+  const __m128i zero = _mm_setzero_si128();
+  uint64_t mask = 0;
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    __m128i ids = _mm_loadu_si128((const __m128i *)&glyphs[i]);
+    // Saturates to 0 only for glyphs in the range
+    __m128i above = _mm_subs_epu16(_mm_sub_epi16(ids, first), range);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi16(above, zero)) == 0) continue;
+    mask |= candidates_scalar(null_bloom, set, glyphs, i, i + 8);
+  }
+  return mask | candidates_scalar(null_bloom, set, glyphs, i, len);
+}
+
+#endif
+
+uint64_t get_candidates(Bloom bloom, const CompiledGlyphSet *set, const uint16_t *glyphs, size_t len) {
+  if (len > CANDIDATES_BLOCK) len = CANDIDATES_BLOCK;
+#if defined(SIMD_X86)
+  if (cpu_has_avx2()) {
+    return set != NULL ? candidates_set_avx2(set, glyphs, len) : candidates_bloom_avx2(bloom, glyphs, len);
+  }
+  if (set != NULL) return candidates_set_sse2(set, glyphs, len);
+#endif
+  return candidates_scalar(bloom, set, glyphs, 0, len);
+}
@@ -0,0 +1,14 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#include "bloom.h"
+#include "compile.h"
+
+// Glyphs checked by each call
+#define CANDIDATES_BLOCK 64
+
+// Returns a mask with bit i set if glyphs[i] may "start" a Lookup, for the
+// first CANDIDATES_BLOCK glyphs at most: if it's in set, or if set is NULL,
+// if it matches bloom.
+uint64_t get_candidates(Bloom bloom, const CompiledGlyphSet *set, const uint16_t *glyphs, size_t len);
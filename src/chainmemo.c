@@ -0,0 +1,324 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "chainmemo.h"
+
+typedef struct ChainMemoEntry {
+  struct ChainMemoEntry *next;
+  ChainMemo *memo;
+  uint64_t hash;
+  Chain *chain; // NULL until it's generated, and if that failed
+  bool generated;
+  bool linked; // Still in the memo, so it can be found
+  size_t refs;
+  // Key
+  bool has_script, has_lang;
+  unsigned char script[4], lang[4];
+  size_t n_features;
+  unsigned char features[][4]; // Sorted, without duplicates
+} ChainMemoEntry;
+
+struct ChainMemo {
+  pthread_mutex_t lock;
+  pthread_cond_t generated;
+  const uint8_t *GSUB_table;
+  // Shared by all the chains, which compile the Lookups they need into it.
+  // Replaced if compiling fails, the chains keep the one they read alive.
+  // Held while generating a chain.
+  pthread_mutex_t compile_lock;
+  CompiledGSUB *compiled_GSUB;
+  // The last chain serialized by a call too small to hold it, kept for the
+  // call that writes it. Held under compile_lock.
+  uint8_t *serialized_key;
+  size_t serialized_key_len;
+  uint8_t *serialized;
+  size_t serialized_size;
+  ChainMemoEntry *entries;
+  size_t refs; // One for the owner, and one for each entry
+};
+
+ChainMemo *ChainMemo_new(const uint8_t *GSUB_table) {
+  ChainMemo *memo = calloc(1, sizeof(ChainMemo));
+  if (memo == NULL) return NULL;
+  pthread_mutex_init(&memo->lock, NULL);
+  pthread_cond_init(&memo->generated, NULL);
+  pthread_mutex_init(&memo->compile_lock, NULL);
+  memo->GSUB_table = GSUB_table;
+  memo->refs = 1;
+  return memo;
+}
+
+static void ChainMemo_destroy(ChainMemo *memo) {
+  pthread_mutex_destroy(&memo->lock);
+  pthread_cond_destroy(&memo->generated);
+  pthread_mutex_destroy(&memo->compile_lock);
+  free_compiled_GSUB(memo->compiled_GSUB);
+  free(memo->serialized_key);
+  free(memo->serialized);
+  free(memo);
+}
+
+void ChainMemo_free(ChainMemo *memo) {
+  if (memo == NULL) return;
+  pthread_mutex_lock(&memo->lock);
+  bool last = --memo->refs == 0;
+  memo->GSUB_table = NULL;
+  pthread_mutex_unlock(&memo->lock);
+  if (last) ChainMemo_destroy(memo);
+}
+
+#define FNV_OFFSET 0xcbf29ce484222325
+#define FNV_PRIME 0x100000001b3
+
+// FNV-1a, keys are a few bytes long.
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t len) {
+  const unsigned char *bytes = data;
+  for (size_t i = 0; i < len; i++) {
+    hash = (hash ^ bytes[i]) * FNV_PRIME;
+  }
+  return hash;
+}
+
+static int compare_features(const void *a, const void *b) {
+  return memcmp(a, b, 4);
+}
+
+// Features are applied in Lookup order, so only which ones are enabled matters.
+static ChainMemoEntry *new_key(const unsigned char (*script)[4], const unsigned char (*lang)[4], const unsigned char (*features)[4], size_t n_features) {
+  if (features == NULL) n_features = 0;
+  ChainMemoEntry *entry = calloc(1, sizeof(ChainMemoEntry) + n_features * 4);
+  if (entry == NULL) return NULL;
+  entry->has_script = script != NULL;
+  if (script != NULL) memcpy(entry->script, *script, 4);
+  entry->has_lang = lang != NULL;
+  if (lang != NULL) memcpy(entry->lang, *lang, 4);
+  if (n_features > 0) memcpy(entry->features, features, n_features * 4);
+  qsort(entry->features, n_features, 4, compare_features);
+  size_t n_unique = 0;
+  for (size_t i = 0; i < n_features; i++) {
+    if (n_unique > 0 && memcmp(entry->features[n_unique - 1], entry->features[i], 4) == 0) continue;
+    if (n_unique != i) memcpy(entry->features[n_unique], entry->features[i], 4);
+    n_unique++;
+  }
+  entry->n_features = n_unique;
+
+  uint64_t hash = hash_bytes(FNV_OFFSET, &entry->has_script, sizeof(bool));
+  hash = hash_bytes(hash, entry->script, 4);
+  hash = hash_bytes(hash, &entry->has_lang, sizeof(bool));
+  hash = hash_bytes(hash, entry->lang, 4);
+  hash = hash_bytes(hash, entry->features, n_unique * 4);
+  entry->hash = hash;
+  return entry;
+}
+
+static bool same_key(const ChainMemoEntry *a, const ChainMemoEntry *b) {
+  return a->hash == b->hash &&
+         a->has_script == b->has_script && (!a->has_script || memcmp(a->script, b->script, 4) == 0) &&
+         a->has_lang == b->has_lang && (!a->has_lang || memcmp(a->lang, b->lang, 4) == 0) &&
+         a->n_features == b->n_features && memcmp(a->features, b->features, a->n_features * 4) == 0;
+}
+
+uint8_t *new_chain_key(const unsigned char (*script)[4], const unsigned char (*lang)[4], const unsigned char (*features)[4], size_t n_features, size_t *key_len) {
+  ChainMemoEntry *entry = new_key(script, lang, features, n_features);
+  if (entry == NULL) return NULL;
+  *key_len = 10 + entry->n_features * 4;
+  uint8_t *key = malloc(*key_len);
+  if (key != NULL) {
+    key[0] = entry->has_script;
+    memcpy(key + 1, entry->script, 4);
+    key[5] = entry->has_lang;
+    memcpy(key + 6, entry->lang, 4);
+    if (entry->n_features > 0) memcpy(key + 10, entry->features, entry->n_features * 4);
+  }
+  free(entry);
+  return key;
+}
+
+// Removes entry from the memo, with the lock held, so that it's not found anymore.
+static void unlink_entry(ChainMemo *memo, ChainMemoEntry *entry) {
+  if (!entry->linked) return;
+  ChainMemoEntry **link = &memo->entries;
+  while (*link != entry) link = &(*link)->next;
+  *link = entry->next;
+  entry->linked = false;
+}
+
+// Drops a reference to entry, with the lock held.
+// Returns whether it was the last one, in which case the entry must be freed
+// once the lock is released.
+static bool unref_entry(ChainMemoEntry *entry) {
+  if (--entry->refs > 0) return false;
+  unlink_entry(entry->memo, entry);
+  entry->memo->refs--;
+  return true;
+}
+
+// Frees an entry unref_entry returned true for, and the memo if it was the
+// last thing keeping it.
+static void free_entry(ChainMemoEntry *entry, bool free_memo) {
+  if (entry->chain != NULL) {
+    set_chain_memo_entry(entry->chain, NULL);
+    destroy_chain(entry->chain);
+  }
+  if (free_memo) ChainMemo_destroy(entry->memo);
+  free(entry);
+}
+
+// Generates the chain with compile_lock held, but not the memo lock, so that
+// chains already generated can be found in the meantime.
+static Chain *generate_shared_chain(ChainMemo *memo, const uint8_t *GSUB_table, const unsigned char (*script)[4], const unsigned char (*lang)[4], const unsigned char (*features)[4], size_t n_features) {
+  if (GSUB_table == NULL) return generate_chain(NULL, NULL, script, lang, features, n_features);
+  pthread_mutex_lock(&memo->compile_lock);
+  // If it fails, the next call tries again
+  if (memo->compiled_GSUB == NULL) {
+    memo->compiled_GSUB = compile_GSUB(GSUB_table);
+  }
+  Chain *chain = generate_chain(GSUB_table, memo->compiled_GSUB, script, lang, features, n_features);
+  // It can't compile anything anymore, so the next call starts over
+  if (chain == NULL && memo->compiled_GSUB != NULL && compiled_GSUB_failed(memo->compiled_GSUB)) {
+    free_compiled_GSUB(memo->compiled_GSUB);
+    memo->compiled_GSUB = NULL;
+  }
+  pthread_mutex_unlock(&memo->compile_lock);
+  return chain;
+}
+
+Chain *ChainMemo_get(ChainMemo *memo, const unsigned char (*script)[4], const unsigned char (*lang)[4], const unsigned char (*features)[4], size_t n_features) {
+  ChainMemoEntry *key = new_key(script, lang, features, n_features);
+  if (key == NULL) return NULL;
+
+  pthread_mutex_lock(&memo->lock);
+  ChainMemoEntry *entry = memo->entries;
+  while (entry != NULL && !same_key(entry, key)) entry = entry->next;
+
+  if (entry != NULL) {
+    free(key);
+    entry->refs++;
+    // Someone else is generating it
+    while (!entry->generated) pthread_cond_wait(&memo->generated, &memo->lock);
+    Chain *chain = entry->chain;
+    bool last = false, free_memo = false;
+    if (chain == NULL) {
+      last = unref_entry(entry);
+      free_memo = memo->refs == 0;
+    }
+    pthread_mutex_unlock(&memo->lock);
+    if (last) free_entry(entry, free_memo);
+    return chain;
+  }
+
+  entry = key;
+  entry->memo = memo;
+  entry->refs = 1;
+  entry->linked = true;
+  entry->next = memo->entries;
+  memo->entries = entry;
+  memo->refs++;
+  const uint8_t *GSUB_table = memo->GSUB_table;
+  pthread_mutex_unlock(&memo->lock);
+
+  // Other threads can look for other chains in the meantime
+  Chain *chain = generate_shared_chain(memo, GSUB_table, script, lang, features, n_features);
+  if (chain != NULL) set_chain_memo_entry(chain, entry);
+
+  pthread_mutex_lock(&memo->lock);
+  entry->chain = chain;
+  entry->generated = true;
+  bool last = false, free_memo = false;
+  if (chain == NULL) {
+    // Let the next caller try again
+    unlink_entry(memo, entry);
+    last = unref_entry(entry);
+    free_memo = memo->refs == 0;
+  }
+  pthread_cond_broadcast(&memo->generated);
+  pthread_mutex_unlock(&memo->lock);
+  if (last) free_entry(entry, free_memo);
+  return chain;
+}
+
+void ChainMemo_release(Chain *chain) {
+  if (chain == NULL) return;
+  ChainMemoEntry *entry = get_chain_memo_entry(chain);
+  if (entry == NULL) {
+    destroy_chain(chain);
+    return;
+  }
+  ChainMemo *memo = entry->memo;
+  pthread_mutex_lock(&memo->lock);
+  bool last = unref_entry(entry);
+  bool free_memo = memo->refs == 0;
+  pthread_mutex_unlock(&memo->lock);
+  if (last) free_entry(entry, free_memo);
+}
+
+static void drop_serialized(ChainMemo *memo) {
+  free(memo->serialized_key);
+  free(memo->serialized);
+  memo->serialized_key = NULL;
+  memo->serialized_key_len = 0;
+  memo->serialized = NULL;
+  memo->serialized_size = 0;
+}
+
+// Serializes the chain with a CompiledGSUB of its own, so that only its Lookups
+// are written, in a new array. Called with compile_lock held.
+static uint8_t *new_serialized_chain(const uint8_t *GSUB_table, const unsigned char (*script)[4], const unsigned char (*lang)[4], const unsigned char (*features)[4], size_t n_features, const uint8_t *key, size_t key_len, size_t *size) {
+  uint8_t *serialized = NULL;
+  *size = 0;
+  CompiledGSUB *compiled_GSUB = compile_GSUB(GSUB_table);
+  Chain *chain = NULL;
+  if (GSUB_table == NULL || compiled_GSUB != NULL) {
+    chain = generate_chain(GSUB_table, compiled_GSUB, script, lang, features, n_features);
+  }
+  if (chain == NULL) goto end;
+
+  size_t needed = serialize_chain(chain, key, key_len, NULL, 0);
+  if (needed == 0) goto end;
+  serialized = malloc(needed);
+  if (serialized == NULL) goto end;
+  *size = serialize_chain(chain, key, key_len, serialized, needed);
+
+end:
+  destroy_chain(chain);
+  free_compiled_GSUB(compiled_GSUB);
+  return serialized;
+}
+
+size_t ChainMemo_serialize(ChainMemo *memo, const unsigned char (*script)[4], const unsigned char (*lang)[4], const unsigned char (*features)[4], size_t n_features, const uint8_t *key, size_t key_len, uint8_t *buffer, size_t size) {
+  pthread_mutex_lock(&memo->lock);
+  const uint8_t *GSUB_table = memo->GSUB_table;
+  pthread_mutex_unlock(&memo->lock);
+
+  pthread_mutex_lock(&memo->compile_lock);
+  uint8_t *serialized = memo->serialized;
+  size_t serialized_size = memo->serialized_size;
+  bool cached = serialized != NULL && memo->serialized_key_len == key_len &&
+                memcmp(memo->serialized_key, key, key_len) == 0;
+  if (!cached) {
+    serialized = new_serialized_chain(GSUB_table, script, lang, features, n_features, key, key_len, &serialized_size);
+  }
+
+  if (serialized != NULL && buffer != NULL && size >= serialized_size) {
+    memcpy(buffer, serialized, serialized_size);
+    // Written, so it's not needed anymore
+    if (cached) drop_serialized(memo);
+    else free(serialized);
+  } else if (serialized != NULL && !cached) {
+    uint8_t *serialized_key = malloc(key_len);
+    if (serialized_key != NULL) {
+      drop_serialized(memo);
+      memcpy(serialized_key, key, key_len);
+      memo->serialized_key = serialized_key;
+      memo->serialized_key_len = key_len;
+      memo->serialized = serialized;
+      memo->serialized_size = serialized_size;
+    } else {
+      // The size is still right, the write compiles it again
+      free(serialized);
+    }
+  }
+  pthread_mutex_unlock(&memo->compile_lock);
+  return serialized_size;
+}
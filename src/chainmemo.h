@@ -0,0 +1,30 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "gsub.h"
+
+// Chains generated from a GSUB table, shared by script, language and set of
+// features. Each chain is generated once, even if several threads ask for it
+// at the same time, and is destroyed when the last reference is released.
+// All the chains share the Lookups of the table, each compiled once, when the
+// first chain using it is generated.
+typedef struct ChainMemo ChainMemo;
+
+ChainMemo *ChainMemo_new(const uint8_t *GSUB_table);
+// Chains that are still referenced stay valid, and keep what they need of the
+// memo until they're released.
+void ChainMemo_free(ChainMemo *memo);
+// Returns a new reference to the chain, generating it if needed.
+Chain *ChainMemo_get(ChainMemo *memo, const unsigned char (*script)[4], const unsigned char (*lang)[4], const unsigned char (*features)[4], size_t n_features);
+// Returns the bytes that identify a chain, the same for the arguments that
+// ChainMemo_get gives the same chain for. Needs to be freed.
+uint8_t *new_chain_key(const unsigned char (*script)[4], const unsigned char (*lang)[4], const unsigned char (*features)[4], size_t n_features, size_t *key_len);
+// Writes the chain in buffer like serialize_chain, with key, but with only the
+// Lookups it uses rather than all the shared ones. These are compiled apart,
+// and kept from a call with a buffer too small to the one writing them.
+size_t ChainMemo_serialize(ChainMemo *memo, const unsigned char (*script)[4], const unsigned char (*lang)[4], const unsigned char (*features)[4], size_t n_features, const uint8_t *key, size_t key_len, uint8_t *buffer, size_t size);
+// Releases a reference to a chain from ChainMemo_get, or destroys a chain
+// that isn't shared.
+void ChainMemo_release(Chain *chain);
@@ -0,0 +1,75 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Compiled ClassDef tables are expanded into arrays indexed directly by glyph,
+// with uint8_t classes when they all fit.
+// Only tables whose ranges are too far apart keep the ranges, which need
+// a binary search.
+
+typedef enum {
+  ClassDefFormat_Dense8 = 1,
+  ClassDefFormat_Dense16 = 2,
+  ClassDefFormat_Ranges = 3,
+} CompiledClassDefFormats;
+
+typedef struct {
+  uint16_t format;
+  uint16_t startGlyphID; // Dense formats only
+  uint32_t count; // Classes for the dense formats, ranges otherwise
+} CompiledClassDef;
+
+typedef struct {
+  CompiledClassDef header;
+  uint8_t classes[];
+} CompiledClassDefDense8;
+
+typedef struct {
+  CompiledClassDef header;
+  uint16_t classes[];
+} CompiledClassDefDense16;
+
+typedef struct {
+  uint16_t startGlyphID;
+  uint16_t endGlyphID;
+  uint16_t _class;
+} CompiledClassRange;
+
+typedef struct {
+  CompiledClassDef header;
+  CompiledClassRange ranges[];
+} CompiledClassDefRanges;
+
+static inline uint16_t find_in_ClassDef(const CompiledClassDef *classDef, uint16_t id) {
+  switch (classDef->format) {
+    case ClassDefFormat_Dense8: {
+      uint32_t i = (uint32_t)id - classDef->startGlyphID;
+      if (id < classDef->startGlyphID || i >= classDef->count) break;
+      return ((const CompiledClassDefDense8 *)classDef)->classes[i];
+    }
+    case ClassDefFormat_Dense16: {
+      uint32_t i = (uint32_t)id - classDef->startGlyphID;
+      if (id < classDef->startGlyphID || i >= classDef->count) break;
+      return ((const CompiledClassDefDense16 *)classDef)->classes[i];
+    }
+    case ClassDefFormat_Ranges: {
+      const CompiledClassDefRanges *rangesTable = (const CompiledClassDefRanges *)classDef;
+      size_t bottom = 0, top = classDef->count;
+      while (bottom < top) {
+        size_t current = (top + bottom) / 2;
+        const CompiledClassRange *range = &rangesTable->ranges[current];
+        if (id < range->startGlyphID) {
+          top = current;
+        } else if (id > range->endGlyphID) {
+          bottom = current + 1;
+        } else {
+          return range->_class;
+        }
+      }
+      break;
+    }
+  }
+  // Glyphs not assigned to a class are in class 0
+  return 0;
+}
@@ -0,0 +1,1564 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "compile.h"
+#include "gsub.h"
+#include "bloom.h"
+#include "bswap.h"
+#include "hash.h"
+
+build_hash_functions(uintptr_t)
+
+struct Compiler {
+  Blob *blob;
+  const LookupList *lookupList;
+  uint16_t lookupCount;
+  // Compiled offset of each lookup, indexed by lookup index. 0 if not reached yet.
+  BlobOffset *lookup_offsets;
+  // Lookups that were reserved, but still need their subtables compiled.
+  uint16_t *pending;
+  size_t n_pending;
+  // Raw Coverage and ClassDef tables are often shared between subtables,
+  // so only compile them once.
+  HashTable_uintptr_t *table_hash;
+  // Compiled Coverages by content hash, to share identical ones.
+  HashTable_uintptr_t *coverage_hash;
+  // Where the Lookups to fuse were compiled, which may not be blob.
+  const uint8_t *source;
+  // Scratch set of GLYPH_SET_WORDS words, NULL until needed.
+  uint64_t *glyph_set;
+  bool failed;
+};
+
+#define at(compiler, offset, type) blob_at((compiler)->blob->data, (offset), type)
+
+static BlobOffset alloc(Compiler *compiler, size_t size) {
+  BlobOffset offset = 0;
+  if (compiler->failed) return 0;
+  if (!Blob_alloc(compiler->blob, size, &offset)) {
+    compiler->failed = true;
+    return 0;
+  }
+  return offset;
+}
+
+static void add_Coverage_to_set(const CompiledCoverage *coverage, uint64_t *set) {
+  switch (coverage->format) {
+    case CoverageFormat_Bitmap: {
+      const CompiledCoverageBitmap *bitmap = (const CompiledCoverageBitmap *)coverage;
+      for (uint32_t i = 0; i < coverage->size; i++) {
+        uint64_t word = bitmap->bits[i];
+        while (word) {
+          uint32_t glyph = coverage->first + i * 64 + ctz_64(word);
+          set[glyph / 64] |= (uint64_t)1 << (glyph % 64);
+          word &= word - 1;
+        }
+      }
+      break;
+    }
+    case CoverageFormat_Eytzinger: {
+      const CompiledCoverageEytzinger *eytzinger = (const CompiledCoverageEytzinger *)coverage;
+      for (uint32_t k = 1; k <= coverage->size; k++) {
+        uint16_t glyph = eytzinger->glyphs[k];
+        set[glyph / 64] |= (uint64_t)1 << (glyph % 64);
+      }
+      break;
+    }
+  }
+}
+
+// Returns the bloom digest that matches with the glyphs for the Coverage.
+static Bloom get_Coverage_bloom(const CompiledCoverage *coverage) {
+  Bloom bloom = null_bloom;
+  switch (coverage->format) {
+    case CoverageFormat_Bitmap: {
+      const CompiledCoverageBitmap *bitmap = (const CompiledCoverageBitmap *)coverage;
+      for (uint32_t i = 0; i < coverage->size && !is_full_bloom(bloom); i++) {
+        uint64_t word = bitmap->bits[i];
+        while (word) {
+          bloom = add_glyphID_to_bloom(bloom, coverage->first + i * 64 + ctz_64(word));
+          word &= word - 1;
+        }
+      }
+      break;
+    }
+    case CoverageFormat_Eytzinger: {
+      const CompiledCoverageEytzinger *eytzinger = (const CompiledCoverageEytzinger *)coverage;
+      for (uint32_t k = 1; k <= coverage->size && !is_full_bloom(bloom); k++) {
+        bloom = add_glyphID_to_bloom(bloom, eytzinger->glyphs[k]);
+      }
+      break;
+    }
+  }
+  return bloom;
+}
+
+// Coverage entries are stored as (glyph << 16) | coverage index,
+// so sorting them orders by glyph.
+#define entry_glyph(entry) ((uint16_t)((entry) >> 16))
+#define entry_index(entry) ((uint16_t)((entry) & 0xFFFF))
+
+static int compare_entries(const void *a, const void *b) {
+  uint32_t entry_a = *(const uint32_t *)a, entry_b = *(const uint32_t *)b;
+  return (entry_a > entry_b) - (entry_a < entry_b);
+}
+
+// Returns the entries of the Coverage, sorted by glyph and without duplicates.
+static bool decode_Coverage(const CoverageTable *coverageTable, uint32_t **entries, size_t *count) {
+  size_t n = 0;
+  *entries = NULL;
+  switch (parse_16(coverageTable->coverageFormat)) {
+    case 1: { // Individual glyph indices
+      const CoverageArrayTable *arrayTable = (CoverageArrayTable *)coverageTable;
+      uint16_t glyphCount = parse_16(arrayTable->glyphCount);
+      *entries = malloc((glyphCount + 1) * sizeof(uint32_t));
+      if (*entries == NULL) return false;
+      for (uint16_t i = 0; i < glyphCount; i++) {
+        (*entries)[n++] = ((uint32_t)parse_16(arrayTable->glyphArray[i]) << 16) | i;
+      }
+      break;
+    }
+    case 2: { // Range of glyphs
+      const CoverageRangesTable *rangesTable = (CoverageRangesTable *)coverageTable;
+      uint16_t rangeCount = parse_16(rangesTable->rangeCount);
+      size_t total = 1;
+      for (uint16_t i = 0; i < rangeCount; i++) {
+        const CoverageRangeRecordTable *range = &rangesTable->rangeRecords[i];
+        uint16_t startGlyphID = parse_16(range->startGlyphID);
+        uint16_t endGlyphID = parse_16(range->endGlyphID);
+        if (startGlyphID <= endGlyphID) total += endGlyphID - startGlyphID + 1;
+      }
+      *entries = malloc(total * sizeof(uint32_t));
+      if (*entries == NULL) return false;
+      // Don't trust startCoverageIndex, count the glyphs instead.
+      uint16_t k = 0;
+      for (uint16_t i = 0; i < rangeCount; i++) {
+        const CoverageRangeRecordTable *range = &rangesTable->rangeRecords[i];
+        uint16_t startGlyphID = parse_16(range->startGlyphID);
+        uint16_t endGlyphID = parse_16(range->endGlyphID);
+        for (uint32_t glyph = startGlyphID; glyph <= endGlyphID; glyph++) {
+          (*entries)[n++] = (glyph << 16) | k++;
+        }
+      }
+      break;
+    }
+    default:
+      fprintf(stderr, "UNKNOWN coverage format\n");
+      // Compile to an empty Coverage
+      break;
+  }
+
+  // Keep the first coverage index of repeated glyphs
+  qsort(*entries, n, sizeof(uint32_t), compare_entries);
+  size_t unique = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (unique == 0 || entry_glyph((*entries)[unique - 1]) != entry_glyph((*entries)[i])) {
+      (*entries)[unique++] = (*entries)[i];
+    }
+  }
+  *count = unique;
+  return true;
+}
+
+// FNV-1a, never 0 so it can be used as a hash key.
+static uintptr_t hash_entries(const uint32_t *entries, size_t count) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < count; i++) {
+    for (int j = 0; j < 32; j += 8) {
+      hash = (hash ^ ((entries[i] >> j) & 0xFF)) * 16777619u;
+    }
+  }
+  return hash ? hash : 1;
+}
+
+static bool Coverage_matches_entries(const CompiledCoverage *coverage, const uint32_t *entries, size_t count) {
+  if (coverage->count != count) return false;
+  for (size_t i = 0; i < count; i++) {
+    uint32_t index;
+    if (!find_in_Coverage(coverage, entry_glyph(entries[i]), &index) || index != entry_index(entries[i]))
+      return false;
+  }
+  return true;
+}
+
+// Fills the Eytzinger nodes from k down with the sorted entries, starting from i.
+// Returns the first entry that wasn't used.
+static size_t fill_Eytzinger(CompiledCoverageEytzinger *eytzinger, const uint32_t *entries, size_t i, size_t k) {
+  if (k > eytzinger->header.size) return i;
+  i = fill_Eytzinger(eytzinger, entries, i, 2 * k);
+  eytzinger->glyphs[k] = entry_glyph(entries[i]);
+  coverage_eytzinger_indices(eytzinger)[k] = entry_index(entries[i]);
+  return fill_Eytzinger(eytzinger, entries, i + 1, 2 * k + 1);
+}
+
+static BlobOffset build_Coverage(Compiler *compiler, const uint32_t *entries, size_t count) {
+  uint16_t first = count ? entry_glyph(entries[0]) : 1;
+  uint16_t last = count ? entry_glyph(entries[count - 1]) : 0;
+  size_t words = count ? (last - first) / 64 + 1 : 0;
+  size_t bitmap_size = words * (sizeof(uint64_t) + sizeof(uint16_t));
+  size_t eytzinger_size = (count + 1) * 2 * sizeof(uint16_t);
+
+  // The bitmap gets the coverage index by counting the glyphs before it,
+  // which only works if the indices follow the glyph order, as they should.
+  bool ordered = true;
+  for (size_t i = 0; i < count && ordered; i++) {
+    ordered = entry_index(entries[i]) == i;
+  }
+
+  // The bitmap is faster, so prefer it unless it's much bigger
+  if (ordered && count > 0 && bitmap_size <= 2 * eytzinger_size) {
+    BlobOffset offset = alloc(compiler, sizeof(CompiledCoverageBitmap) + bitmap_size);
+    if (offset == 0) return 0;
+    CompiledCoverageBitmap *bitmap = at(compiler, offset, CompiledCoverageBitmap);
+    bitmap->header = (CompiledCoverage){
+      .format = CoverageFormat_Bitmap,
+      .first = first,
+      .last = last,
+      .count = count,
+      .size = words,
+    };
+    uint16_t *ranks = coverage_bitmap_ranks(bitmap);
+    size_t word = 0;
+    for (size_t i = 0; i < count; i++) {
+      uint32_t bit = entry_glyph(entries[i]) - first;
+      while (word <= bit / 64) ranks[word++] = i;
+      bitmap->bits[bit / 64] |= (uint64_t)1 << (bit % 64);
+    }
+    return offset;
+  }
+
+  BlobOffset offset = alloc(compiler, sizeof(CompiledCoverageEytzinger) + eytzinger_size);
+  if (offset == 0) return 0;
+  CompiledCoverageEytzinger *eytzinger = at(compiler, offset, CompiledCoverageEytzinger);
+  eytzinger->header = (CompiledCoverage){
+    .format = CoverageFormat_Eytzinger,
+    .first = first,
+    .last = last,
+    .count = count,
+    .size = count,
+  };
+  fill_Eytzinger(eytzinger, entries, 0, 1);
+  return offset;
+}
+
+static BlobOffset compile_Coverage(Compiler *compiler, const CoverageTable *coverageTable) {
+  uintptr_t cached;
+  if (get_from_uintptr_t_hash(compiler->table_hash, coverageTable, &cached)) {
+    return (BlobOffset)cached;
+  }
+
+  uint32_t *entries;
+  size_t count;
+  if (!decode_Coverage(coverageTable, &entries, &count)) {
+    compiler->failed = true;
+    return 0;
+  }
+
+  // Different tables often have the same content
+  BlobOffset offset = 0;
+  uintptr_t content_hash = hash_entries(entries, count);
+  if (get_from_uintptr_t_hash(compiler->coverage_hash, (const void *)content_hash, &cached)
+      && Coverage_matches_entries(at(compiler, cached, CompiledCoverage), entries, count)) {
+    offset = (BlobOffset)cached;
+  } else {
+    offset = build_Coverage(compiler, entries, count);
+    // hash_entries never returns 0, which would be the empty marker
+    if (offset != 0 && !set_to_uintptr_t_hash(compiler->coverage_hash, (const void *)content_hash, offset)) {
+      offset = 0;
+    }
+  }
+  free(entries);
+  if (offset == 0 || !set_to_uintptr_t_hash(compiler->table_hash, coverageTable, offset)) {
+    compiler->failed = true;
+    return 0;
+  }
+  return offset;
+}
+
+// Returns the ranges of the ClassDef, one for each glyph for format 1.
+static bool decode_ClassDef(const ClassDefGeneric *classDefTable, CompiledClassRange **ranges, size_t *count) {
+  *ranges = NULL;
+  *count = 0;
+  switch (parse_16(classDefTable->classFormat)) {
+    case ClassFormat_1: {
+      const ClassDefFormat1 *arrayTable = (ClassDefFormat1 *)classDefTable;
+      uint16_t glyphCount = parse_16(arrayTable->glyphCount);
+      uint16_t startGlyphID = parse_16(arrayTable->startGlyphID);
+      *ranges = malloc((glyphCount + 1) * sizeof(CompiledClassRange));
+      if (*ranges == NULL) return false;
+      for (uint16_t i = 0; i < glyphCount && startGlyphID + i <= UINT16_MAX; i++) {
+        (*ranges)[(*count)++] = (CompiledClassRange){
+          .startGlyphID = startGlyphID + i,
+          .endGlyphID = startGlyphID + i,
+          ._class = parse_16(arrayTable->classValueArray[i]),
+        };
+      }
+      break;
+    }
+    case ClassFormat_2: {
+      const ClassDefFormat2 *rangesTable = (ClassDefFormat2 *)classDefTable;
+      uint16_t classRangeCount = parse_16(rangesTable->classRangeCount);
+      *ranges = malloc((classRangeCount + 1) * sizeof(CompiledClassRange));
+      if (*ranges == NULL) return false;
+      for (uint16_t i = 0; i < classRangeCount; i++) {
+        const ClassRangeRecord *range = &rangesTable->classRangeRecords[i];
+        (*ranges)[(*count)++] = (CompiledClassRange){
+          .startGlyphID = parse_16(range->startGlyphID),
+          .endGlyphID = parse_16(range->endGlyphID),
+          ._class = parse_16(range->_class),
+        };
+      }
+      break;
+    }
+    default:
+      fprintf(stderr, "UNKNOWN class format\n");
+      // Compile to an empty ClassDef, so everything is class 0
+      break;
+  }
+  return true;
+}
+
+static BlobOffset compile_ClassDef(Compiler *compiler, const ClassDefGeneric *classDefTable) {
+  uintptr_t cached;
+  if (get_from_uintptr_t_hash(compiler->table_hash, classDefTable, &cached)) {
+    return (BlobOffset)cached;
+  }
+
+  CompiledClassRange *ranges;
+  size_t count;
+  if (!decode_ClassDef(classDefTable, &ranges, &count)) {
+    compiler->failed = true;
+    return 0;
+  }
+
+  // Class 0 is the default, so it doesn't need to be stored
+  uint32_t first = UINT16_MAX + 1, last = 0;
+  uint16_t max_class = 0;
+  for (size_t i = 0; i < count; i++) {
+    const CompiledClassRange *range = &ranges[i];
+    if (range->_class == 0 || range->startGlyphID > range->endGlyphID) continue;
+    if (range->startGlyphID < first) first = range->startGlyphID;
+    if (range->endGlyphID > last) last = range->endGlyphID;
+    if (range->_class > max_class) max_class = range->_class;
+  }
+  size_t span = first <= last ? last - first + 1 : 0;
+  size_t class_size = max_class <= UINT8_MAX ? sizeof(uint8_t) : sizeof(uint16_t);
+  size_t dense_size = span * class_size;
+  size_t ranges_size = count * sizeof(CompiledClassRange);
+
+  BlobOffset offset = 0;
+  // Direct indexing is worth some extra space, but not a table
+  // spanning the whole font for a handful of ranges.
+  if (dense_size <= 4096 || dense_size <= 4 * ranges_size) {
+    offset = alloc(compiler, sizeof(CompiledClassDef) + dense_size);
+    if (offset == 0) goto end;
+    CompiledClassDef *compiled = at(compiler, offset, CompiledClassDef);
+    *compiled = (CompiledClassDef){
+      .format = class_size == sizeof(uint8_t) ? ClassDefFormat_Dense8 : ClassDefFormat_Dense16,
+      .startGlyphID = span ? first : 0,
+      .count = span,
+    };
+    for (size_t i = 0; i < count; i++) {
+      const CompiledClassRange *range = &ranges[i];
+      if (range->_class == 0) continue;
+      for (uint32_t glyph = range->startGlyphID; glyph <= range->endGlyphID; glyph++) {
+        if (compiled->format == ClassDefFormat_Dense8) {
+          ((CompiledClassDefDense8 *)compiled)->classes[glyph - first] = range->_class;
+        } else {
+          ((CompiledClassDefDense16 *)compiled)->classes[glyph - first] = range->_class;
+        }
+      }
+    }
+  } else {
+    offset = alloc(compiler, sizeof(CompiledClassDefRanges) + ranges_size);
+    if (offset == 0) goto end;
+    CompiledClassDefRanges *compiled = at(compiler, offset, CompiledClassDefRanges);
+    compiled->header = (CompiledClassDef){
+      .format = ClassDefFormat_Ranges,
+      .count = count,
+    };
+    memcpy(compiled->ranges, ranges, ranges_size);
+  }
+
+  if (!set_to_uintptr_t_hash(compiler->table_hash, classDefTable, offset)) {
+    compiler->failed = true;
+    offset = 0;
+  }
+end:
+  free(ranges);
+  return offset;
+}
+
+static BlobOffset compile_uint16_array(Compiler *compiler, const uint16_t *array, uint16_t count) {
+  BlobOffset offset = alloc(compiler, count * sizeof(uint16_t));
+  if (offset == 0) return 0;
+  uint16_t *compiled = at(compiler, offset, uint16_t);
+  for (uint16_t i = 0; i < count; i++) {
+    compiled[i] = parse_16(array[i]);
+  }
+  return offset;
+}
+
+static BlobOffset compile_Coverage_array(Compiler *compiler, const uint8_t *coverageTablesBase, const uint16_t *coverageTables, uint16_t count) {
+  BlobOffset offset = alloc(compiler, count * sizeof(BlobOffset));
+  if (offset == 0) return 0;
+  for (uint16_t i = 0; i < count; i++) {
+    const CoverageTable *coverageTable = (CoverageTable *)(coverageTablesBase + parse_16(coverageTables[i]));
+    BlobOffset coverage = compile_Coverage(compiler, coverageTable);
+    at(compiler, offset, BlobOffset)[i] = coverage;
+  }
+  return offset;
+}
+
+static BlobOffset reserve_Lookup(Compiler *compiler, uint16_t index);
+
+static BlobOffset compile_SequenceLookupRecords(Compiler *compiler, const SequenceLookupRecord *seqLookupRecords, uint16_t seqLookupCount) {
+  BlobOffset offset = alloc(compiler, seqLookupCount * sizeof(CompiledLookupRecord));
+  if (offset == 0) return 0;
+  for (uint16_t i = 0; i < seqLookupCount; i++) {
+    uint16_t sequenceIndex = parse_16(seqLookupRecords[i].sequenceIndex);
+    BlobOffset lookup = reserve_Lookup(compiler, parse_16(seqLookupRecords[i].lookupListIndex));
+    at(compiler, offset, CompiledLookupRecord)[i] = (CompiledLookupRecord){
+      .sequenceIndex = sequenceIndex,
+      .lookup = lookup,
+    };
+  }
+  return offset;
+}
+
+// Compiles a glyph or class based rule.
+static BlobOffset compile_Rule(Compiler *compiler,
+                               const uint16_t *backtrack, uint16_t backtrackCount,
+                               const uint16_t *input, uint16_t inputCount,
+                               const uint16_t *lookahead, uint16_t lookaheadCount,
+                               const SequenceLookupRecord *seqLookupRecords, uint16_t seqLookupCount) {
+  BlobOffset offset = alloc(compiler, sizeof(CompiledRule));
+  if (offset == 0) return 0;
+  // The input sequence doesn't include the initial glyph.
+  CompiledRule rule = {
+    .backtrackCount = backtrackCount,
+    .inputCount = inputCount,
+    .lookaheadCount = lookaheadCount,
+    .recordCount = seqLookupCount,
+    .backtrack = compile_uint16_array(compiler, backtrack, backtrackCount),
+    .input = compile_uint16_array(compiler, input, inputCount > 0 ? inputCount - 1 : 0),
+    .lookahead = compile_uint16_array(compiler, lookahead, lookaheadCount),
+    .records = compile_SequenceLookupRecords(compiler, seqLookupRecords, seqLookupCount),
+  };
+  if (compiler->failed) return 0;
+  *at(compiler, offset, CompiledRule) = rule;
+  return offset;
+}
+
+static BlobOffset compile_SequenceRule(Compiler *compiler, const SequenceRule *sequenceRule) {
+  uint16_t glyphCount = parse_16(sequenceRule->glyphCount);
+  uint16_t seqLookupCount = parse_16(sequenceRule->seqLookupCount);
+  const uint16_t *inputSequence = sequenceRule->inputSequence;
+  const SequenceLookupRecord *seqLookupRecords = (SequenceLookupRecord *)((uint8_t *)sequenceRule + (1 + glyphCount) * sizeof(uint16_t));
+  return compile_Rule(compiler, NULL, 0, inputSequence, glyphCount, NULL, 0, seqLookupRecords, seqLookupCount);
+}
+
+static BlobOffset compile_ChainedSequenceRule(Compiler *compiler, const ChainedSequenceRule *chainedSequenceRule) {
+  const ChainedSequenceRule_backtrack *backtrackSequenceRule = (ChainedSequenceRule_backtrack *)chainedSequenceRule;
+  uint16_t backtrackGlyphCount = parse_16(backtrackSequenceRule->backtrackGlyphCount);
+  const ChainedSequenceRule_input *inputSequenceRule = (ChainedSequenceRule_input *)((uint8_t *)backtrackSequenceRule + sizeof(uint16_t) * (backtrackGlyphCount + 1));
+  uint16_t inputGlyphCount = parse_16(inputSequenceRule->inputGlyphCount);
+  // inputGlyphCount includes the initial one, that's not present in the array, so no need to +1 here
+  const ChainedSequenceRule_lookahead *lookaheadSequenceRule = (ChainedSequenceRule_lookahead *)((uint8_t *)inputSequenceRule + sizeof(uint16_t) * (inputGlyphCount));
+  uint16_t lookaheadGlyphCount = parse_16(lookaheadSequenceRule->lookaheadGlyphCount);
+  const ChainedSequenceRule_seq *sequenceRule = (ChainedSequenceRule_seq *)((uint8_t *)lookaheadSequenceRule + sizeof(uint16_t) * (lookaheadGlyphCount + 1));
+  uint16_t seqLookupCount = parse_16(sequenceRule->seqLookupCount);
+
+  return compile_Rule(compiler,
+                      backtrackSequenceRule->backtrackSequence, backtrackGlyphCount,
+                      inputSequenceRule->inputSequence, inputGlyphCount,
+                      lookaheadSequenceRule->lookaheadSequence, lookaheadGlyphCount,
+                      sequenceRule->seqLookupRecords, seqLookupCount);
+}
+
+// Rule sets have the same layout for all the glyph and class based formats.
+static BlobOffset compile_RuleSet(Compiler *compiler, const SequenceRuleSet *ruleSet, bool chained) {
+  uint16_t ruleCount = parse_16(ruleSet->seqRuleCount);
+  BlobOffset offset = alloc(compiler, sizeof(CompiledRuleSet) + ruleCount * sizeof(BlobOffset));
+  if (offset == 0) return 0;
+  at(compiler, offset, CompiledRuleSet)->count = ruleCount;
+  for (uint16_t i = 0; i < ruleCount; i++) {
+    const uint8_t *rule = (uint8_t *)ruleSet + parse_16(ruleSet->seqRuleOffsets[i]);
+    BlobOffset compiled_rule = chained ? compile_ChainedSequenceRule(compiler, (ChainedSequenceRule *)rule)
+                                       : compile_SequenceRule(compiler, (SequenceRule *)rule);
+    at(compiler, offset, CompiledRuleSet)->rules[i] = compiled_rule;
+  }
+  return offset;
+}
+
+static BlobOffset alloc_Subtable(Compiler *compiler, size_t size, SubtableKind kind) {
+  BlobOffset offset = alloc(compiler, size);
+  if (offset == 0) return 0;
+  at(compiler, offset, CompiledSubtable)->kind = kind;
+  return offset;
+}
+
+static BlobOffset compile_SingleSubstitution(Compiler *compiler, const SingleSubstFormatGeneric *singleSubstFormatGeneric) {
+  const CoverageTable *coverageTable = (CoverageTable *)((uint8_t *)singleSubstFormatGeneric + parse_16(singleSubstFormatGeneric->coverageOffset));
+  switch (parse_16(singleSubstFormatGeneric->substFormat)) {
+    case SingleSubstitutionFormat_1: {
+      const SingleSubstFormat1 *singleSubst = (SingleSubstFormat1 *)singleSubstFormatGeneric;
+      BlobOffset offset = alloc_Subtable(compiler, sizeof(CompiledSingle1), Single1Subtable);
+      BlobOffset coverage = compile_Coverage(compiler, coverageTable);
+      if (compiler->failed) return 0;
+      CompiledSingle1 *compiled = at(compiler, offset, CompiledSingle1);
+      compiled->coverage = coverage;
+      compiled->deltaGlyphID = parse_16(singleSubst->deltaGlyphID);
+      return offset;
+    }
+    case SingleSubstitutionFormat_2: {
+      const SingleSubstFormat2 *singleSubst = (SingleSubstFormat2 *)singleSubstFormatGeneric;
+      uint16_t glyphCount = parse_16(singleSubst->glyphCount);
+      BlobOffset offset = alloc_Subtable(compiler, sizeof(CompiledSingle2) + glyphCount * sizeof(uint16_t), Single2Subtable);
+      BlobOffset coverage = compile_Coverage(compiler, coverageTable);
+      if (compiler->failed) return 0;
+      CompiledSingle2 *compiled = at(compiler, offset, CompiledSingle2);
+      compiled->coverage = coverage;
+      compiled->count = glyphCount;
+      for (uint16_t i = 0; i < glyphCount; i++) {
+        compiled->substitutes[i] = parse_16(singleSubst->substituteGlyphIDs[i]);
+      }
+      return offset;
+    }
+    default:
+      fprintf(stderr, "UNKNOWN SubstFormat %d\n", parse_16(singleSubstFormatGeneric->substFormat));
+      return alloc_Subtable(compiler, sizeof(CompiledSubtable), NoopSubtable);
+  }
+}
+
+static BlobOffset compile_MultipleSubstitution(Compiler *compiler, const MultipleSubstFormat1 *multipleSubstFormat) {
+  const CoverageTable *coverageTable = (CoverageTable *)((uint8_t *)multipleSubstFormat + parse_16(multipleSubstFormat->coverageOffset));
+  uint16_t sequenceCount = parse_16(multipleSubstFormat->sequenceCount);
+  BlobOffset offset = alloc_Subtable(compiler, sizeof(CompiledMultiple) + sequenceCount * sizeof(BlobOffset), MultipleSubtable);
+  BlobOffset coverage = compile_Coverage(compiler, coverageTable);
+  if (compiler->failed) return 0;
+  at(compiler, offset, CompiledMultiple)->coverage = coverage;
+  at(compiler, offset, CompiledMultiple)->sequenceCount = sequenceCount;
+  for (uint16_t i = 0; i < sequenceCount; i++) {
+    const SequenceTable *sequenceTable = (SequenceTable *)((uint8_t *)multipleSubstFormat + parse_16(multipleSubstFormat->sequenceOffsets[i]));
+    uint16_t glyphCount = parse_16(sequenceTable->glyphCount);
+    BlobOffset sequence = alloc(compiler, sizeof(CompiledSequence) + glyphCount * sizeof(uint16_t));
+    if (sequence == 0) return 0;
+    CompiledSequence *compiled = at(compiler, sequence, CompiledSequence);
+    compiled->count = glyphCount;
+    for (uint16_t j = 0; j < glyphCount; j++) {
+      compiled->glyphs[j] = parse_16(sequenceTable->substituteGlyphIDs[j]);
+    }
+    at(compiler, offset, CompiledMultiple)->sequences[i] = sequence;
+  }
+  return offset;
+}
+
+typedef struct {
+  const uint16_t *components; // Raw, without the first glyph
+  uint16_t componentCount; // Without the first glyph
+  uint16_t ligatureGlyph;
+  uint16_t priority;
+} LigatureEntry;
+
+static int compare_ligature_entries(const void *a, const void *b) {
+  const LigatureEntry *entry_a = a, *entry_b = b;
+  for (uint16_t i = 0; i < entry_a->componentCount && i < entry_b->componentCount; i++) {
+    uint16_t glyph_a = parse_16(entry_a->components[i]);
+    uint16_t glyph_b = parse_16(entry_b->components[i]);
+    if (glyph_a != glyph_b) return glyph_a < glyph_b ? -1 : 1;
+  }
+  if (entry_a->componentCount != entry_b->componentCount)
+    return entry_a->componentCount < entry_b->componentCount ? -1 : 1;
+  return entry_a->priority < entry_b->priority ? -1 : 1;
+}
+
+// Each trie node is built from the sorted entries that share its path.
+typedef struct {
+  uint16_t begin, end;
+  uint16_t depth;
+} LigatureNodeRange;
+
+static BlobOffset compile_LigatureSet(Compiler *compiler, const LigatureSetTable *ligatureSet) {
+  uint16_t ligatureCount = parse_16(ligatureSet->ligatureCount);
+  LigatureEntry *entries = malloc((ligatureCount + 1) * sizeof(LigatureEntry));
+  if (entries == NULL) goto fail;
+
+  uint16_t n = 0;
+  size_t maxNodes = 1;
+  for (uint16_t i = 0; i < ligatureCount; i++) {
+    const LigatureTable *ligature = (LigatureTable *)((uint8_t *)ligatureSet + parse_16(ligatureSet->ligatureOffsets[i]));
+    uint16_t componentCount = parse_16(ligature->componentCount);
+    // A ligature needs at least its first glyph
+    if (componentCount == 0) continue;
+    entries[n++] = (LigatureEntry){
+      .components = ligature->componentGlyphIDs,
+      .componentCount = componentCount - 1,
+      .ligatureGlyph = parse_16(ligature->ligatureGlyph),
+      .priority = i,
+    };
+    maxNodes += componentCount - 1;
+  }
+  qsort(entries, n, sizeof(LigatureEntry), compare_ligature_entries);
+
+  LigatureNodeRange *ranges = malloc(maxNodes * sizeof(LigatureNodeRange));
+  CompiledLigatureNode *nodes = malloc(maxNodes * sizeof(CompiledLigatureNode));
+  uint16_t *glyphs = malloc(maxNodes * sizeof(uint16_t));
+  if (ranges == NULL || nodes == NULL || glyphs == NULL) {
+    free(ranges);
+    free(nodes);
+    free(glyphs);
+    goto fail;
+  }
+
+  // Breadth-first, so that the children of each node are contiguous
+  uint32_t nodeCount = 1;
+  ranges[0] = (LigatureNodeRange){ .begin = 0, .end = n, .depth = 0 };
+  glyphs[0] = 0;
+  for (uint32_t i = 0; i < nodeCount; i++) {
+    LigatureNodeRange range = ranges[i];
+    CompiledLigatureNode *node = &nodes[i];
+    *node = (CompiledLigatureNode){
+      .priority = UINT16_MAX,
+      .firstChild = nodeCount,
+    };
+    // Entries ending here sort first, the earliest one wins
+    uint16_t j = range.begin;
+    if (j < range.end && entries[j].componentCount == range.depth) {
+      node->ligatureGlyph = entries[j].ligatureGlyph;
+      node->priority = entries[j].priority;
+    }
+    while (j < range.end && entries[j].componentCount == range.depth) j++;
+    while (j < range.end) {
+      uint16_t glyph = parse_16(entries[j].components[range.depth]);
+      uint16_t k = j;
+      while (k < range.end && parse_16(entries[k].components[range.depth]) == glyph) k++;
+      ranges[nodeCount] = (LigatureNodeRange){ .begin = j, .end = k, .depth = range.depth + 1 };
+      glyphs[nodeCount] = glyph;
+      nodeCount++;
+      node->childCount++;
+      j = k;
+    }
+  }
+  // Children come after their parent
+  for (uint32_t i = nodeCount; i-- > 0;) {
+    CompiledLigatureNode *node = &nodes[i];
+    node->subtreePriority = node->priority;
+    for (uint32_t c = node->firstChild; c < node->firstChild + node->childCount; c++) {
+      if (nodes[c].subtreePriority < node->subtreePriority)
+        node->subtreePriority = nodes[c].subtreePriority;
+    }
+  }
+
+  BlobOffset offset = alloc(compiler, sizeof(CompiledLigatureSet) + nodeCount * (sizeof(CompiledLigatureNode) + sizeof(uint16_t)));
+  if (offset != 0) {
+    CompiledLigatureSet *compiled = at(compiler, offset, CompiledLigatureSet);
+    compiled->nodeCount = nodeCount;
+    memcpy(compiled->nodes, nodes, nodeCount * sizeof(CompiledLigatureNode));
+    memcpy((uint16_t *)ligature_set_glyphs(compiled), glyphs, nodeCount * sizeof(uint16_t));
+  }
+  free(ranges);
+  free(nodes);
+  free(glyphs);
+  free(entries);
+  return offset;
+
+fail:
+  free(entries);
+  compiler->failed = true;
+  return 0;
+}
+
+static BlobOffset compile_LigatureSubstitution(Compiler *compiler, const LigatureSubstitutionTable *ligatureSubstitutionTable) {
+  const CoverageTable *coverageTable = (CoverageTable *)((uint8_t *)ligatureSubstitutionTable + parse_16(ligatureSubstitutionTable->coverageOffset));
+  uint16_t ligatureSetCount = parse_16(ligatureSubstitutionTable->ligatureSetCount);
+  BlobOffset offset = alloc_Subtable(compiler, sizeof(CompiledLigatureSubst) + ligatureSetCount * sizeof(BlobOffset), LigatureSubtable);
+  BlobOffset coverage = compile_Coverage(compiler, coverageTable);
+  if (compiler->failed) return 0;
+  at(compiler, offset, CompiledLigatureSubst)->coverage = coverage;
+  at(compiler, offset, CompiledLigatureSubst)->setCount = ligatureSetCount;
+  for (uint16_t i = 0; i < ligatureSetCount; i++) {
+    const LigatureSetTable *ligatureSet = (LigatureSetTable *)((uint8_t *)ligatureSubstitutionTable + parse_16(ligatureSubstitutionTable->ligatureSetOffsets[i]));
+    BlobOffset set = compile_LigatureSet(compiler, ligatureSet);
+    at(compiler, offset, CompiledLigatureSubst)->sets[i] = set;
+  }
+  return offset;
+}
+
+static BlobOffset compile_GlyphContext(Compiler *compiler, const uint8_t *subtable, uint16_t coverageOffset, uint16_t ruleSetCount, const uint16_t *ruleSetOffsets, bool chained) {
+  const CoverageTable *coverageTable = (CoverageTable *)(subtable + parse_16(coverageOffset));
+  BlobOffset offset = alloc_Subtable(compiler, sizeof(CompiledGlyphContext) + ruleSetCount * sizeof(BlobOffset), GlyphContextSubtable);
+  BlobOffset coverage = compile_Coverage(compiler, coverageTable);
+  if (compiler->failed) return 0;
+  at(compiler, offset, CompiledGlyphContext)->coverage = coverage;
+  at(compiler, offset, CompiledGlyphContext)->ruleSetCount = ruleSetCount;
+  for (uint16_t i = 0; i < ruleSetCount; i++) {
+    uint16_t ruleSetOffset = parse_16(ruleSetOffsets[i]);
+    if (ruleSetOffset == 0) continue;
+    BlobOffset ruleSet = compile_RuleSet(compiler, (SequenceRuleSet *)(subtable + ruleSetOffset), chained);
+    at(compiler, offset, CompiledGlyphContext)->ruleSets[i] = ruleSet;
+  }
+  return offset;
+}
+
+static BlobOffset compile_ClassContext(Compiler *compiler, const uint8_t *subtable, uint16_t coverageOffset,
+                                       uint16_t backtrackClassDefOffset, uint16_t inputClassDefOffset, uint16_t lookaheadClassDefOffset,
+                                       uint16_t ruleSetCount, const uint16_t *ruleSetOffsets, bool chained) {
+  const CoverageTable *coverageTable = (CoverageTable *)(subtable + parse_16(coverageOffset));
+  BlobOffset offset = alloc_Subtable(compiler, sizeof(CompiledClassContext) + ruleSetCount * sizeof(BlobOffset), ClassContextSubtable);
+  BlobOffset coverage = compile_Coverage(compiler, coverageTable);
+  BlobOffset inputClassDef = compile_ClassDef(compiler, (ClassDefGeneric *)(subtable + parse_16(inputClassDefOffset)));
+  BlobOffset backtrackClassDef = 0, lookaheadClassDef = 0;
+  if (chained) {
+    backtrackClassDef = compile_ClassDef(compiler, (ClassDefGeneric *)(subtable + parse_16(backtrackClassDefOffset)));
+    lookaheadClassDef = compile_ClassDef(compiler, (ClassDefGeneric *)(subtable + parse_16(lookaheadClassDefOffset)));
+  }
+  if (compiler->failed) return 0;
+  CompiledClassContext *compiled = at(compiler, offset, CompiledClassContext);
+  compiled->coverage = coverage;
+  compiled->backtrackClassDef = backtrackClassDef;
+  compiled->inputClassDef = inputClassDef;
+  compiled->lookaheadClassDef = lookaheadClassDef;
+  compiled->ruleSetCount = ruleSetCount;
+  for (uint16_t i = 0; i < ruleSetCount; i++) {
+    uint16_t ruleSetOffset = parse_16(ruleSetOffsets[i]);
+    if (ruleSetOffset == 0) continue;
+    BlobOffset ruleSet = compile_RuleSet(compiler, (SequenceRuleSet *)(subtable + ruleSetOffset), chained);
+    at(compiler, offset, CompiledClassContext)->ruleSets[i] = ruleSet;
+  }
+  return offset;
+}
+
+static BlobOffset compile_CoverageContext(Compiler *compiler, const uint8_t *subtable,
+                                          const uint16_t *backtrack, uint16_t backtrackCount,
+                                          const uint16_t *input, uint16_t inputCount,
+                                          const uint16_t *lookahead, uint16_t lookaheadCount,
+                                          const SequenceLookupRecord *seqLookupRecords, uint16_t seqLookupCount) {
+  BlobOffset offset = alloc_Subtable(compiler, sizeof(CompiledCoverageContext), CoverageContextSubtable);
+  CompiledRule rule = {
+    .backtrackCount = backtrackCount,
+    .inputCount = inputCount,
+    .lookaheadCount = lookaheadCount,
+    .recordCount = seqLookupCount,
+    .backtrack = compile_Coverage_array(compiler, subtable, backtrack, backtrackCount),
+    .input = compile_Coverage_array(compiler, subtable, input, inputCount),
+    .lookahead = compile_Coverage_array(compiler, subtable, lookahead, lookaheadCount),
+    .records = compile_SequenceLookupRecords(compiler, seqLookupRecords, seqLookupCount),
+  };
+  if (compiler->failed) return 0;
+  at(compiler, offset, CompiledCoverageContext)->rule = rule;
+  return offset;
+}
+
+static BlobOffset compile_SequenceSubstitution(Compiler *compiler, const GenericSequenceContextFormat *genericSequence) {
+  switch (parse_16(genericSequence->format)) {
+    case SequenceContextFormat_1: {
+      const SequenceContextFormat1 *sequenceContext = (SequenceContextFormat1 *)genericSequence;
+      return compile_GlyphContext(compiler, (uint8_t *)sequenceContext, sequenceContext->coverageOffset,
+                                  parse_16(sequenceContext->seqRuleSetCount), sequenceContext->seqRuleSetOffsets, false);
+    }
+    case SequenceContextFormat_2: {
+      const SequenceContextFormat2 *sequenceContext = (SequenceContextFormat2 *)genericSequence;
+      return compile_ClassContext(compiler, (uint8_t *)sequenceContext, sequenceContext->coverageOffset,
+                                  0, sequenceContext->classDefOffset, 0,
+                                  parse_16(sequenceContext->classSeqRuleSetCount), sequenceContext->classSeqRuleSetOffsets, false);
+    }
+    case SequenceContextFormat_3: {
+      const SequenceContextFormat3 *sequenceContext = (SequenceContextFormat3 *)genericSequence;
+      uint16_t glyphCount = parse_16(sequenceContext->glyphCount);
+      const SequenceLookupRecord *seqLookupRecords = (SequenceLookupRecord *)((uint8_t *)sequenceContext + (2 + glyphCount + 1) * sizeof(uint16_t));
+      return compile_CoverageContext(compiler, (uint8_t *)sequenceContext,
+                                     NULL, 0,
+                                     sequenceContext->coverageOffsets, glyphCount,
+                                     NULL, 0,
+                                     seqLookupRecords, parse_16(sequenceContext->seqLookupCount));
+    }
+    default:
+      fprintf(stderr, "UNKNOWN SequenceContextFormat %d\n", parse_16(genericSequence->format));
+      return alloc_Subtable(compiler, sizeof(CompiledSubtable), NoopSubtable);
+  }
+}
+
+static BlobOffset compile_ChainedSequenceSubstitution(Compiler *compiler, const GenericChainedSequenceContextFormat *genericChainedSequence) {
+  switch (parse_16(genericChainedSequence->format)) {
+    case ChainedSequenceContextFormat_1: {
+      const ChainedSequenceContextFormat1 *chainedSequenceContext = (ChainedSequenceContextFormat1 *)genericChainedSequence;
+      return compile_GlyphContext(compiler, (uint8_t *)chainedSequenceContext, chainedSequenceContext->coverageOffset,
+                                  parse_16(chainedSequenceContext->chainedSeqRuleSetCount), chainedSequenceContext->chainedSeqRuleSetOffsets, true);
+    }
+    case ChainedSequenceContextFormat_2: {
+      const ChainedSequenceContextFormat2 *chainedSequenceContext = (ChainedSequenceContextFormat2 *)genericChainedSequence;
+      return compile_ClassContext(compiler, (uint8_t *)chainedSequenceContext, chainedSequenceContext->coverageOffset,
+                                  chainedSequenceContext->backtrackClassDefOffset,
+                                  chainedSequenceContext->inputClassDefOffset,
+                                  chainedSequenceContext->lookaheadClassDefOffset,
+                                  parse_16(chainedSequenceContext->chainedClassSeqRuleSetCount), chainedSequenceContext->chainedClassSeqRuleSetOffsets, true);
+    }
+    case ChainedSequenceContextFormat_3: {
+      const ChainedSequenceContextFormat3_backtrack *backtrackCoverage = (ChainedSequenceContextFormat3_backtrack *)((uint8_t *)genericChainedSequence + sizeof(uint16_t));
+      uint16_t backtrackGlyphCount = parse_16(backtrackCoverage->backtrackGlyphCount);
+      const ChainedSequenceContextFormat3_input *inputCoverage = (ChainedSequenceContextFormat3_input *)((uint8_t *)backtrackCoverage + sizeof(uint16_t) * (backtrackGlyphCount + 1));
+      uint16_t inputGlyphCount = parse_16(inputCoverage->inputGlyphCount);
+      const ChainedSequenceContextFormat3_lookahead *lookaheadCoverage = (ChainedSequenceContextFormat3_lookahead *)((uint8_t *)inputCoverage + sizeof(uint16_t) * (inputGlyphCount + 1));
+      uint16_t lookaheadGlyphCount = parse_16(lookaheadCoverage->lookaheadGlyphCount);
+      const ChainedSequenceContextFormat3_seq *seqCoverage = (ChainedSequenceContextFormat3_seq *)((uint8_t *)lookaheadCoverage + sizeof(uint16_t) * (lookaheadGlyphCount + 1));
+      uint16_t seqLookupCount = parse_16(seqCoverage->seqLookupCount);
+      return compile_CoverageContext(compiler, (uint8_t *)genericChainedSequence,
+                                     backtrackCoverage->backtrackCoverageOffsets, backtrackGlyphCount,
+                                     inputCoverage->inputCoverageOffsets, inputGlyphCount,
+                                     lookaheadCoverage->lookaheadCoverageOffsets, lookaheadGlyphCount,
+                                     seqCoverage->seqLookupRecords, seqLookupCount);
+    }
+    default:
+      fprintf(stderr, "UNKNOWN ChainedSequenceContextFormat %d\n", parse_16(genericChainedSequence->format));
+      return alloc_Subtable(compiler, sizeof(CompiledSubtable), NoopSubtable);
+  }
+}
+
+static BlobOffset compile_ReverseChainingContextSingle(Compiler *compiler, const ReverseChainSingleSubstFormat1 *reverseChain) {
+  if (parse_16(reverseChain->substFormat) != ReverseChainSingleSubstFormat_1) {
+    fprintf(stderr, "UNKNOWN ReverseChainSingleSubstFormat %d\n", parse_16(reverseChain->substFormat));
+    return alloc_Subtable(compiler, sizeof(CompiledSubtable), NoopSubtable);
+  }
+  const CoverageTable *coverageTable = (CoverageTable *)((uint8_t *)reverseChain + parse_16(reverseChain->coverageOffset));
+  const ReverseChainSingleSubstFormat1_backtrack *backtrackCoverage = (ReverseChainSingleSubstFormat1_backtrack *)((uint8_t *)reverseChain + sizeof(uint16_t) * 2);
+  uint16_t backtrackGlyphCount = parse_16(backtrackCoverage->backtrackGlyphCount);
+  const ReverseChainSingleSubstFormat1_lookahead *lookaheadCoverage = (ReverseChainSingleSubstFormat1_lookahead *)((uint8_t *)backtrackCoverage + sizeof(uint16_t) * (backtrackGlyphCount + 1));
+  uint16_t lookaheadGlyphCount = parse_16(lookaheadCoverage->lookaheadGlyphCount);
+  const ReverseChainSingleSubstFormat1_sub *substitutionTable = (ReverseChainSingleSubstFormat1_sub *)((uint8_t *)lookaheadCoverage + sizeof(uint16_t) * (lookaheadGlyphCount + 1));
+  uint16_t glyphCount = parse_16(substitutionTable->glyphCount);
+
+  BlobOffset offset = alloc_Subtable(compiler, sizeof(CompiledReverseChain) + glyphCount * sizeof(uint16_t), ReverseChainSubtable);
+  BlobOffset coverage = compile_Coverage(compiler, coverageTable);
+  BlobOffset backtrack = compile_Coverage_array(compiler, (uint8_t *)reverseChain, backtrackCoverage->backtrackCoverageOffsets, backtrackGlyphCount);
+  BlobOffset lookahead = compile_Coverage_array(compiler, (uint8_t *)reverseChain, lookaheadCoverage->lookaheadCoverageOffsets, lookaheadGlyphCount);
+  if (compiler->failed) return 0;
+  CompiledReverseChain *compiled = at(compiler, offset, CompiledReverseChain);
+  compiled->coverage = coverage;
+  compiled->backtrackCount = backtrackGlyphCount;
+  compiled->lookaheadCount = lookaheadGlyphCount;
+  compiled->substituteCount = glyphCount;
+  compiled->backtrack = backtrack;
+  compiled->lookahead = lookahead;
+  for (uint16_t i = 0; i < glyphCount; i++) {
+    compiled->substitutes[i] = parse_16(substitutionTable->substituteGlyphIDs[i]);
+  }
+  return offset;
+}
+
+// Finds the Coverage of the glyphs that "start" a compiled Substitution table,
+// 0 if none can. Returns false if any glyph can.
+static bool get_Subtable_start(const uint8_t *base, const CompiledSubtable *subtable, BlobOffset *coverage) {
+  *coverage = 0;
+  switch (subtable->kind) {
+    case Single1Subtable:
+      *coverage = ((const CompiledSingle1 *)subtable)->coverage;
+      break;
+    case Single2Subtable:
+      *coverage = ((const CompiledSingle2 *)subtable)->coverage;
+      break;
+    case MultipleSubtable:
+      *coverage = ((const CompiledMultiple *)subtable)->coverage;
+      break;
+    case LigatureSubtable:
+      *coverage = ((const CompiledLigatureSubst *)subtable)->coverage;
+      break;
+    case GlyphContextSubtable:
+      *coverage = ((const CompiledGlyphContext *)subtable)->coverage;
+      break;
+    case ClassContextSubtable:
+      // TODO: I'm not sure we can do much for ClassSequences
+      *coverage = ((const CompiledClassContext *)subtable)->coverage;
+      break;
+    case CoverageContextSubtable: {
+      const CompiledRule *rule = &((const CompiledCoverageContext *)subtable)->rule;
+      if (rule->inputCount == 0) return false;
+      // Only the first input glyph "starts" the Substitution.
+      *coverage = compiled_at(base, rule->input, BlobOffset)[0];
+      break;
+    }
+    case ReverseChainSubtable:
+      *coverage = ((const CompiledReverseChain *)subtable)->coverage;
+      break;
+    case NoopSubtable:
+    default:
+      break;
+  }
+  return true;
+}
+
+// Returns the bloom digest that matches with the glyphs that "start" a compiled Substitution table.
+static Bloom get_Subtable_bloom(const uint8_t *base, const CompiledSubtable *subtable) {
+  BlobOffset coverage;
+  if (!get_Subtable_start(base, subtable, &coverage)) return full_bloom;
+  if (coverage == 0) return null_bloom;
+  return get_Coverage_bloom(compiled_at(base, coverage, CompiledCoverage));
+}
+
+static BlobOffset compile_Substitution(Compiler *compiler, const GenericSubstTable *genericSubstTable, uint16_t lookupType) {
+  BlobOffset offset = 0;
+  switch (lookupType) {
+    case SingleLookupType:
+      offset = compile_SingleSubstitution(compiler, (SingleSubstFormatGeneric *)genericSubstTable);
+      break;
+    case MultipleLookupType:
+      offset = compile_MultipleSubstitution(compiler, (MultipleSubstFormat1 *)genericSubstTable);
+      break;
+    case AlternateLookupType:
+      // We don't really need to support it.
+      // Most use-cases revolve around user selection from the list of alternates,
+      // which we don't... really care about.
+      // Maybe we could think about enabling this for some weird features like 'rand'.
+      offset = alloc_Subtable(compiler, sizeof(CompiledSubtable), NoopSubtable);
+      break;
+    case LigatureLookupType:
+      offset = compile_LigatureSubstitution(compiler, (LigatureSubstitutionTable *)genericSubstTable);
+      break;
+    case ContextLookupType:
+      offset = compile_SequenceSubstitution(compiler, (GenericSequenceContextFormat *)genericSubstTable);
+      break;
+    case ChainingLookupType:
+      offset = compile_ChainedSequenceSubstitution(compiler, (GenericChainedSequenceContextFormat *)genericSubstTable);
+      break;
+    case ReverseChainingContextSingleLookupType:
+      offset = compile_ReverseChainingContextSingle(compiler, (ReverseChainSingleSubstFormat1 *)genericSubstTable);
+      break;
+    default:
+      fprintf(stderr, "UNKNOWN LookupType\n");
+      offset = alloc_Subtable(compiler, sizeof(CompiledSubtable), NoopSubtable);
+      break;
+  }
+  if (offset == 0) return 0;
+  CompiledSubtable *subtable = at(compiler, offset, CompiledSubtable);
+  subtable->bloom = get_Subtable_bloom(compiler->blob->data, subtable);
+  return offset;
+}
+
+// Resolves the Extension Substitution, if any.
+static const GenericSubstTable *get_Substitution(const LookupTable *lookupTable, uint16_t index, uint16_t *lookupType) {
+  const GenericSubstTable *genericSubstTable = (GenericSubstTable *)((uint8_t *)lookupTable + parse_16(lookupTable->subtableOffsets[index]));
+  *lookupType = parse_16(lookupTable->lookupType);
+  if (*lookupType == ExtensionSubstitutionLookupType) {
+    const ExtensionSubstitutionTable *extensionSubstitutionTable = (ExtensionSubstitutionTable *)genericSubstTable;
+    *lookupType = parse_16(extensionSubstitutionTable->extensionLookupType);
+    genericSubstTable = (GenericSubstTable *)((uint8_t *)extensionSubstitutionTable + parse_32(extensionSubstitutionTable->extensionOffset));
+  }
+  return genericSubstTable;
+}
+
+static const LookupTable *get_raw_Lookup(const Compiler *compiler, uint16_t index) {
+  return (LookupTable *)((uint8_t *)compiler->lookupList + parse_16(compiler->lookupList->lookupOffsets[index]));
+}
+
+// Returns the compiled offset of the Lookup, allocating it if needed.
+// Its subtables are compiled later by compile_pending_Lookups.
+static BlobOffset reserve_Lookup(Compiler *compiler, uint16_t index) {
+  if (index >= compiler->lookupCount) {
+    fprintf(stderr, "Warning: invalid lookup index %d\n", index);
+    return 0;
+  }
+  if (compiler->lookup_offsets[index] != 0) return compiler->lookup_offsets[index];
+
+  const LookupTable *lookupTable = get_raw_Lookup(compiler, index);
+  uint16_t subTableCount = parse_16(lookupTable->subTableCount);
+  BlobOffset offset = alloc(compiler, sizeof(CompiledLookup) + subTableCount * sizeof(BlobOffset));
+  if (offset == 0) return 0;
+
+  // Extensions must all point to the same type, so use the first one.
+  uint16_t lookupType = parse_16(lookupTable->lookupType);
+  if (subTableCount > 0) {
+    get_Substitution(lookupTable, 0, &lookupType);
+  }
+  CompiledLookup *compiled = at(compiler, offset, CompiledLookup);
+  compiled->lookupType = lookupType;
+  compiled->lookupFlag = parse_16(lookupTable->lookupFlag);
+  compiled->subtableCount = subTableCount;
+
+  compiler->lookup_offsets[index] = offset;
+  compiler->pending[compiler->n_pending++] = index;
+  return offset;
+}
+
+// Adds to set the glyphs that can "start" the compiled Lookup.
+// Returns false if any glyph can.
+static bool add_Lookup_starts(const uint8_t *base, const CompiledLookup *lookup, uint64_t *set) {
+  for (uint16_t i = 0; i < lookup->subtableCount; i++) {
+    if (lookup->subtables[i] == 0) continue;
+    BlobOffset coverage;
+    if (!get_Subtable_start(base, compiled_at(base, lookup->subtables[i], CompiledSubtable), &coverage)) {
+      return false;
+    }
+    if (coverage != 0) add_Coverage_to_set(compiled_at(base, coverage, CompiledCoverage), set);
+  }
+  return true;
+}
+
+// Glyphs sampled to measure how many glyphs a bloom lets through by mistake
+#define FILTER_SAMPLES 4096
+// A set is used if the bloom lets through more than 1 in this many glyphs
+// that can't start the Lookup.
+#define FILTER_MAX_FALSE_POSITIVES 16
+
+// Compiles the exact set of glyphs that can "start" a compiled Lookup, if its
+// bloom would let too many others through. Otherwise returns 0.
+static BlobOffset compile_Lookup_filter(Compiler *compiler, BlobOffset lookup_offset) {
+  if (compiler->glyph_set == NULL) {
+    compiler->glyph_set = malloc(GLYPH_SET_WORDS * sizeof(uint64_t));
+    if (compiler->glyph_set == NULL) return 0;
+  }
+  uint64_t *set = compiler->glyph_set;
+  memset(set, 0, GLYPH_SET_WORDS * sizeof(uint64_t));
+  const CompiledLookup *lookup = at(compiler, lookup_offset, CompiledLookup);
+  if (!add_Lookup_starts(compiler->blob->data, lookup, set)) return 0;
+
+  uint32_t first = 0, last = GLYPH_SET_WORDS;
+  while (first < GLYPH_SET_WORDS && set[first] == 0) first++;
+  if (first == GLYPH_SET_WORDS) return 0;
+  while (set[last - 1] == 0) last--;
+
+  // Measure on the glyphs up to the last one that can start the Lookup, as
+  // fonts rarely have many more.
+  uint32_t n_glyphs = last * 64;
+  uint32_t step = n_glyphs / FILTER_SAMPLES + 1;
+  uint32_t false_positives = 0, negatives = 0;
+  for (uint32_t glyph = 0; glyph < n_glyphs; glyph += step) {
+    if ((set[glyph / 64] >> (glyph % 64)) & 1) continue;
+    negatives++;
+    if (glyphID_compare_bloom(glyph, lookup->bloom)) false_positives++;
+  }
+  if (false_positives * FILTER_MAX_FALSE_POSITIVES <= negatives) return 0;
+
+  BlobOffset offset = alloc(compiler, sizeof(CompiledGlyphSet) + (last - first) * sizeof(uint64_t));
+  if (offset == 0) return 0;
+  CompiledGlyphSet *compiled = at(compiler, offset, CompiledGlyphSet);
+  compiled->first = first * 64;
+  compiled->count = last - first;
+  memcpy(compiled->bits, set + first, (last - first) * sizeof(uint64_t));
+  return offset;
+}
+
+static void compile_pending_Lookups(Compiler *compiler) {
+  while (compiler->n_pending > 0 && !compiler->failed) {
+    uint16_t index = compiler->pending[--compiler->n_pending];
+    BlobOffset offset = compiler->lookup_offsets[index];
+    const LookupTable *lookupTable = get_raw_Lookup(compiler, index);
+    uint16_t subTableCount = parse_16(lookupTable->subTableCount);
+    Bloom lookup_bloom = null_bloom;
+    for (uint16_t i = 0; i < subTableCount; i++) {
+      uint16_t lookupType;
+      const GenericSubstTable *genericSubstTable = get_Substitution(lookupTable, i, &lookupType);
+      BlobOffset subtable = compile_Substitution(compiler, genericSubstTable, lookupType);
+      if (subtable == 0) return;
+      at(compiler, offset, CompiledLookup)->subtables[i] = subtable;
+      lookup_bloom = add_bloom_to_bloom(lookup_bloom, at(compiler, subtable, CompiledSubtable)->bloom);
+    }
+    at(compiler, offset, CompiledLookup)->bloom = lookup_bloom;
+    BlobOffset filter = compile_Lookup_filter(compiler, offset);
+    at(compiler, offset, CompiledLookup)->filter = filter;
+  }
+}
+
+// Only SingleSubstitution Lookups can be composed.
+static bool is_fusible_Lookup(const CompiledLookup *lookup, const uint8_t *base) {
+  if (lookup->lookupType != SingleLookupType) return false;
+  for (uint16_t i = 0; i < lookup->subtableCount; i++) {
+    uint16_t kind = compiled_at(base, lookup->subtables[i], CompiledSubtable)->kind;
+    if (kind != Single1Subtable && kind != Single2Subtable && kind != NoopSubtable) return false;
+  }
+  return true;
+}
+
+// Returns the glyph the SingleSubstitution Lookup turns id into.
+static uint16_t substitute_with_Lookup(const CompiledLookup *lookup, const uint8_t *base, uint16_t id) {
+  for (uint16_t i = 0; i < lookup->subtableCount; i++) {
+    const CompiledSubtable *subtable = compiled_at(base, lookup->subtables[i], CompiledSubtable);
+    uint32_t coverage_index;
+    switch (subtable->kind) {
+      case Single1Subtable: {
+        const CompiledSingle1 *singleSubst = (const CompiledSingle1 *)subtable;
+        if (find_in_Coverage(compiled_at(base, singleSubst->coverage, CompiledCoverage), id, NULL))
+          return (uint16_t)(id + singleSubst->deltaGlyphID);
+        break;
+      }
+      case Single2Subtable: {
+        const CompiledSingle2 *singleSubst = (const CompiledSingle2 *)subtable;
+        if (find_in_Coverage(compiled_at(base, singleSubst->coverage, CompiledCoverage), id, &coverage_index)
+            && coverage_index < singleSubst->count)
+          return singleSubst->substitutes[coverage_index];
+        break;
+      }
+    }
+  }
+  return id;
+}
+
+// Glyphs that could be changed by the SingleSubstitution Lookup.
+static void get_Lookup_domain(const CompiledLookup *lookup, const uint8_t *base, uint32_t *first, uint32_t *last) {
+  for (uint16_t i = 0; i < lookup->subtableCount; i++) {
+    const CompiledSubtable *subtable = compiled_at(base, lookup->subtables[i], CompiledSubtable);
+    BlobOffset coverage;
+    switch (subtable->kind) {
+      case Single1Subtable:
+        coverage = ((const CompiledSingle1 *)subtable)->coverage;
+        break;
+      case Single2Subtable:
+        coverage = ((const CompiledSingle2 *)subtable)->coverage;
+        break;
+      default:
+        continue;
+    }
+    const CompiledCoverage *compiled = compiled_at(base, coverage, CompiledCoverage);
+    if (compiled->count == 0) continue;
+    if (compiled->first < *first) *first = compiled->first;
+    if (compiled->last > *last) *last = compiled->last;
+  }
+}
+
+// Builds a Lookup equivalent to applying all the fusible Lookups in
+// lookup_offsets one after the other. Returns 0 if it changes no glyph.
+static BlobOffset fuse_Lookups(Compiler *compiler, const BlobOffset *lookup_offsets, size_t n_lookups) {
+  uint32_t first = UINT16_MAX + 1, last = 0;
+  for (size_t i = 0; i < n_lookups; i++) {
+    if (lookup_offsets[i] == 0) continue;
+    get_Lookup_domain(compiled_at(compiler->source, lookup_offsets[i], CompiledLookup), compiler->source, &first, &last);
+  }
+  if (first > last) return 0;
+
+  uint16_t *map = malloc((last - first + 1) * sizeof(uint16_t));
+  if (map == NULL) {
+    compiler->failed = true;
+    return 0;
+  }
+  for (uint32_t glyph = first; glyph <= last; glyph++) {
+    uint16_t id = glyph;
+    for (size_t i = 0; i < n_lookups; i++) {
+      if (lookup_offsets[i] == 0) continue;
+      id = substitute_with_Lookup(compiled_at(compiler->source, lookup_offsets[i], CompiledLookup), compiler->source, id);
+    }
+    map[glyph - first] = id;
+  }
+
+  // Only keep what actually changes
+  uint32_t changed = 0, changed_first = UINT16_MAX + 1, changed_last = 0;
+  Bloom bloom = null_bloom;
+  for (uint32_t glyph = first; glyph <= last; glyph++) {
+    if (map[glyph - first] == glyph) continue;
+    if (changed_first > glyph) changed_first = glyph;
+    changed_last = glyph;
+    changed++;
+    bloom = add_glyphID_to_bloom(bloom, glyph);
+  }
+
+  BlobOffset subtable = 0;
+  if (changed == 0) {
+    free(map);
+    return 0;
+  }
+  uint32_t span = changed_last - changed_first + 1;
+  if (span * sizeof(uint16_t) <= 4096 || span <= 4 * changed) {
+    // Dense, direct-indexed map
+    subtable = alloc_Subtable(compiler, sizeof(CompiledGlyphMap) + span * sizeof(uint16_t), GlyphMapSubtable);
+    if (subtable != 0) {
+      CompiledGlyphMap *compiled = at(compiler, subtable, CompiledGlyphMap);
+      compiled->first = changed_first;
+      compiled->count = span;
+      memcpy(compiled->glyphs, map + (changed_first - first), span * sizeof(uint16_t));
+    }
+  } else {
+    // Sparse map, as a SingleSubstitution with the changed glyphs
+    uint32_t *entries = malloc(changed * sizeof(uint32_t));
+    if (entries == NULL) {
+      compiler->failed = true;
+      free(map);
+      return 0;
+    }
+    uint32_t k = 0;
+    for (uint32_t glyph = changed_first; glyph <= changed_last; glyph++) {
+      if (map[glyph - first] == glyph) continue;
+      entries[k] = (glyph << 16) | k;
+      k++;
+    }
+    BlobOffset coverage = build_Coverage(compiler, entries, changed);
+    subtable = alloc_Subtable(compiler, sizeof(CompiledSingle2) + changed * sizeof(uint16_t), Single2Subtable);
+    if (subtable != 0) {
+      CompiledSingle2 *compiled = at(compiler, subtable, CompiledSingle2);
+      compiled->coverage = coverage;
+      compiled->count = changed;
+      for (uint32_t i = 0; i < changed; i++) {
+        compiled->substitutes[i] = map[entry_glyph(entries[i]) - first];
+      }
+    }
+    free(entries);
+  }
+  free(map);
+  if (subtable == 0) return 0;
+  at(compiler, subtable, CompiledSubtable)->bloom = bloom;
+
+  BlobOffset offset = alloc(compiler, sizeof(CompiledLookup) + sizeof(BlobOffset));
+  if (offset == 0) return 0;
+  CompiledLookup *compiled = at(compiler, offset, CompiledLookup);
+  compiled->lookupType = SingleLookupType;
+  compiled->subtableCount = 1;
+  compiled->bloom = bloom;
+  compiled->subtables[0] = subtable;
+  return offset;
+}
+
+// Replaces each run of adjacent SingleSubstitution Lookups with a single
+// composed one, so that they take a single pass over the glyphs.
+// The Lookups that were fused are set to 0 in lookup_offsets, and the composed
+// one is set in fused_offsets, where the run started.
+static void fuse_Single_Lookups(Compiler *compiler, BlobOffset *lookup_offsets, BlobOffset *fused_offsets, size_t n_lookups) {
+  size_t i = 0;
+  while (i < n_lookups && !compiler->failed) {
+    size_t run = 0, j = i;
+    for (; j < n_lookups; j++) {
+      if (lookup_offsets[j] == 0) continue;
+      if (!is_fusible_Lookup(compiled_at(compiler->source, lookup_offsets[j], CompiledLookup), compiler->source)) break;
+      run++;
+    }
+    if (run >= 2) {
+      BlobOffset fused = fuse_Lookups(compiler, lookup_offsets + i, j - i);
+      for (size_t k = i; k < j; k++) lookup_offsets[k] = 0;
+      fused_offsets[i] = fused;
+    }
+    i = j + 1;
+  }
+}
+
+// Finds which glyphs the Lookups can look at, and how far their rules reach.
+typedef struct {
+  const uint8_t *base;
+  uint64_t *touched;
+  LookupReach reach;
+  // Lookups already analyzed, a bit per BLOB_ALIGNMENT bytes of the blob,
+  // as that's where a Lookup can start.
+  uint64_t *visited;
+  bool failed;
+} Analyzer;
+
+#define touch_glyph(touched, id) ((touched)[(id) / 64] |= (uint64_t)1 << ((id) % 64))
+
+static void touch_all(Analyzer *analyzer) {
+  memset(analyzer->touched, 0xFF, GLYPH_SET_WORDS * sizeof(uint64_t));
+}
+
+static void touch_Coverage(Analyzer *analyzer, BlobOffset offset) {
+  if (offset == 0) return;
+  const CompiledCoverage *coverage = compiled_at(analyzer->base, offset, CompiledCoverage);
+  switch (coverage->format) {
+    case CoverageFormat_Bitmap: {
+      const CompiledCoverageBitmap *bitmap = (const CompiledCoverageBitmap *)coverage;
+      for (uint32_t i = 0; i < coverage->size; i++) {
+        uint64_t word = bitmap->bits[i];
+        while (word) {
+          touch_glyph(analyzer->touched, coverage->first + i * 64 + ctz_64(word));
+          word &= word - 1;
+        }
+      }
+      break;
+    }
+    case CoverageFormat_Eytzinger: {
+      const CompiledCoverageEytzinger *eytzinger = (const CompiledCoverageEytzinger *)coverage;
+      for (uint32_t k = 1; k <= coverage->size; k++) {
+        touch_glyph(analyzer->touched, eytzinger->glyphs[k]);
+      }
+      break;
+    }
+  }
+}
+
+static void touch_Coverage_array(Analyzer *analyzer, BlobOffset offset, uint16_t count) {
+  if (offset == 0) return;
+  const BlobOffset *coverages = compiled_at(analyzer->base, offset, BlobOffset);
+  for (uint16_t i = 0; i < count; i++) {
+    touch_Coverage(analyzer, coverages[i]);
+  }
+}
+
+static void touch_uint16_array(Analyzer *analyzer, BlobOffset offset, uint16_t count) {
+  if (offset == 0) return;
+  const uint16_t *glyphs = compiled_at(analyzer->base, offset, uint16_t);
+  for (uint16_t i = 0; i < count; i++) {
+    touch_glyph(analyzer->touched, glyphs[i]);
+  }
+}
+
+// Only the glyphs with a class, the others are handled by touch_class_array.
+static void touch_ClassDef(Analyzer *analyzer, BlobOffset offset) {
+  if (offset == 0) return;
+  const CompiledClassDef *classDef = compiled_at(analyzer->base, offset, CompiledClassDef);
+  switch (classDef->format) {
+    case ClassDefFormat_Dense8:
+    case ClassDefFormat_Dense16:
+      for (uint32_t i = 0; i < classDef->count; i++) {
+        if (find_in_ClassDef(classDef, classDef->startGlyphID + i) != 0)
+          touch_glyph(analyzer->touched, classDef->startGlyphID + i);
+      }
+      break;
+    case ClassDefFormat_Ranges: {
+      const CompiledClassRange *ranges = ((const CompiledClassDefRanges *)classDef)->ranges;
+      for (uint32_t i = 0; i < classDef->count; i++) {
+        if (ranges[i]._class == 0) continue;
+        for (uint32_t id = ranges[i].startGlyphID; id <= ranges[i].endGlyphID; id++) {
+          touch_glyph(analyzer->touched, id);
+        }
+      }
+      break;
+    }
+  }
+}
+
+// Class 0 matches every glyph without a class, so it could be anything.
+static void touch_class_array(Analyzer *analyzer, BlobOffset offset, uint16_t count) {
+  if (offset == 0) return;
+  const uint16_t *classes = compiled_at(analyzer->base, offset, uint16_t);
+  for (uint16_t i = 0; i < count; i++) {
+    if (classes[i] == 0) {
+      touch_all(analyzer);
+      return;
+    }
+  }
+}
+
+static void analyze_Lookup(Analyzer *analyzer, BlobOffset offset);
+
+// Extends the reach to include a match that looks at `backtrack` glyphs before
+// its first input glyph, and `lookahead` after it.
+static void extend_reach(Analyzer *analyzer, size_t backtrack, size_t lookahead) {
+  LookupReach *reach = &analyzer->reach;
+  if (backtrack + 1 + lookahead > reach->length) reach->length = backtrack + 1 + lookahead;
+  if (backtrack > reach->backtrack) reach->backtrack = backtrack;
+  if (lookahead > reach->lookahead) reach->lookahead = lookahead;
+}
+
+static void analyze_Rule(Analyzer *analyzer, const CompiledRule *rule, SubtableKind kind) {
+  if (rule->inputCount > 0) {
+    extend_reach(analyzer, rule->backtrackCount, (size_t)rule->inputCount - 1 + rule->lookaheadCount);
+  }
+  uint16_t input = kind == CoverageContextSubtable ? rule->inputCount
+                 : rule->inputCount > 0 ? rule->inputCount - 1 : 0;
+  switch (kind) {
+    case GlyphContextSubtable:
+      touch_uint16_array(analyzer, rule->backtrack, rule->backtrackCount);
+      touch_uint16_array(analyzer, rule->input, input);
+      touch_uint16_array(analyzer, rule->lookahead, rule->lookaheadCount);
+      break;
+    case ClassContextSubtable:
+      touch_class_array(analyzer, rule->backtrack, rule->backtrackCount);
+      touch_class_array(analyzer, rule->input, input);
+      touch_class_array(analyzer, rule->lookahead, rule->lookaheadCount);
+      break;
+    case CoverageContextSubtable:
+      touch_Coverage_array(analyzer, rule->backtrack, rule->backtrackCount);
+      touch_Coverage_array(analyzer, rule->input, input);
+      touch_Coverage_array(analyzer, rule->lookahead, rule->lookaheadCount);
+      break;
+    default:
+      break;
+  }
+  if (rule->records == 0) return;
+  const CompiledLookupRecord *records = compiled_at(analyzer->base, rule->records, CompiledLookupRecord);
+  for (uint16_t i = 0; i < rule->recordCount; i++) {
+    analyze_Lookup(analyzer, records[i].lookup);
+  }
+}
+
+static void analyze_RuleSets(Analyzer *analyzer, const BlobOffset *ruleSets, uint16_t ruleSetCount, SubtableKind kind) {
+  for (uint16_t i = 0; i < ruleSetCount; i++) {
+    if (ruleSets[i] == 0) continue;
+    const CompiledRuleSet *ruleSet = compiled_at(analyzer->base, ruleSets[i], CompiledRuleSet);
+    for (uint16_t j = 0; j < ruleSet->count; j++) {
+      if (ruleSet->rules[j] == 0) continue;
+      analyze_Rule(analyzer, compiled_at(analyzer->base, ruleSet->rules[j], CompiledRule), kind);
+    }
+  }
+}
+
+static void analyze_LigatureSet(Analyzer *analyzer, BlobOffset offset) {
+  if (offset == 0) return;
+  const CompiledLigatureSet *ligatureSet = compiled_at(analyzer->base, offset, CompiledLigatureSet);
+  const uint16_t *glyphs = ligature_set_glyphs(ligatureSet);
+  // The root is the first glyph, which is in the Coverage
+  for (uint32_t i = 1; i < ligatureSet->nodeCount; i++) {
+    touch_glyph(analyzer->touched, glyphs[i]);
+  }
+  // Nodes are breadth-first, so each level follows the previous one
+  size_t depth = 1;
+  uint32_t begin = 0, end = 1;
+  while (end < ligatureSet->nodeCount) {
+    uint32_t next = end;
+    for (uint32_t i = begin; i < end; i++) {
+      const CompiledLigatureNode *node = &ligatureSet->nodes[i];
+      if (node->firstChild + node->childCount > next) next = node->firstChild + node->childCount;
+    }
+    if (next == end) break;
+    begin = end;
+    end = next;
+    depth++;
+  }
+  if (depth > 0) extend_reach(analyzer, 0, depth - 1);
+}
+
+static void analyze_Subtable(Analyzer *analyzer, const CompiledSubtable *subtable) {
+  switch (subtable->kind) {
+    case Single1Subtable:
+      touch_Coverage(analyzer, ((const CompiledSingle1 *)subtable)->coverage);
+      break;
+    case Single2Subtable:
+      touch_Coverage(analyzer, ((const CompiledSingle2 *)subtable)->coverage);
+      break;
+    case MultipleSubtable:
+      touch_Coverage(analyzer, ((const CompiledMultiple *)subtable)->coverage);
+      break;
+    case LigatureSubtable: {
+      const CompiledLigatureSubst *ligatureSubst = (const CompiledLigatureSubst *)subtable;
+      touch_Coverage(analyzer, ligatureSubst->coverage);
+      for (uint16_t i = 0; i < ligatureSubst->setCount; i++) {
+        analyze_LigatureSet(analyzer, ligatureSubst->sets[i]);
+      }
+      break;
+    }
+    case GlyphContextSubtable: {
+      const CompiledGlyphContext *context = (const CompiledGlyphContext *)subtable;
+      touch_Coverage(analyzer, context->coverage);
+      analyze_RuleSets(analyzer, context->ruleSets, context->ruleSetCount, GlyphContextSubtable);
+      break;
+    }
+    case ClassContextSubtable: {
+      const CompiledClassContext *context = (const CompiledClassContext *)subtable;
+      touch_Coverage(analyzer, context->coverage);
+      touch_ClassDef(analyzer, context->backtrackClassDef);
+      touch_ClassDef(analyzer, context->inputClassDef);
+      touch_ClassDef(analyzer, context->lookaheadClassDef);
+      analyze_RuleSets(analyzer, context->ruleSets, context->ruleSetCount, ClassContextSubtable);
+      break;
+    }
+    case CoverageContextSubtable:
+      analyze_Rule(analyzer, &((const CompiledCoverageContext *)subtable)->rule, CoverageContextSubtable);
+      break;
+    case ReverseChainSubtable: {
+      const CompiledReverseChain *reverseChain = (const CompiledReverseChain *)subtable;
+      extend_reach(analyzer, reverseChain->backtrackCount, reverseChain->lookaheadCount);
+      touch_Coverage(analyzer, reverseChain->coverage);
+      touch_Coverage_array(analyzer, reverseChain->backtrack, reverseChain->backtrackCount);
+      touch_Coverage_array(analyzer, reverseChain->lookahead, reverseChain->lookaheadCount);
+      break;
+    }
+    case GlyphMapSubtable: {
+      const CompiledGlyphMap *map = (const CompiledGlyphMap *)subtable;
+      for (uint32_t i = 0; i < map->count; i++) {
+        if (map->glyphs[i] != map->first + i) touch_glyph(analyzer->touched, map->first + i);
+      }
+      break;
+    }
+  }
+}
+
+static void analyze_Lookup(Analyzer *analyzer, BlobOffset offset) {
+  if (offset == 0 || analyzer->failed) return;
+  const CompiledLookup *lookup = compiled_at(analyzer->base, offset, CompiledLookup);
+  size_t slot = offset / BLOB_ALIGNMENT;
+  if ((analyzer->visited[slot / 64] >> (slot % 64)) & 1) return;
+  analyzer->visited[slot / 64] |= (uint64_t)1 << (slot % 64);
+
+  extend_reach(analyzer, 0, 0);
+  for (uint16_t i = 0; i < lookup->subtableCount; i++) {
+    if (lookup->subtables[i] == 0) continue;
+    analyze_Subtable(analyzer, compiled_at(analyzer->base, lookup->subtables[i], CompiledSubtable));
+  }
+}
+
+bool analyze_lookups(const Blob *blob, const BlobOffset *lookup_offsets, size_t n_lookups, uint64_t *touched, LookupReach *reach) {
+  Analyzer analyzer = {
+    .base = blob->data,
+    .touched = touched,
+    .reach = { 0, 0, 0 },
+    .visited = calloc(blob->len / BLOB_ALIGNMENT / 64 + 1, sizeof(uint64_t)),
+    .failed = false,
+  };
+  if (analyzer.visited == NULL) return false;
+  memset(touched, 0, GLYPH_SET_WORDS * sizeof(uint64_t));
+
+  for (size_t i = 0; i < n_lookups; i++) {
+    analyze_Lookup(&analyzer, lookup_offsets[i]);
+  }
+
+  free(analyzer.visited);
+  *reach = analyzer.reach;
+  return !analyzer.failed;
+}
+
+void collect_triggers(const Blob *blob, const BlobOffset *lookup_offsets, size_t n_lookups, GlyphSet *triggers) {
+  memset(triggers->bits, 0, sizeof(triggers->bits));
+  for (size_t i = 0; i < n_lookups; i++) {
+    if (lookup_offsets[i] == 0) continue;
+    if (!add_Lookup_starts(blob->data, compiled_at(blob->data, lookup_offsets[i], CompiledLookup), triggers->bits)) {
+      memset(triggers->bits, 0xFF, sizeof(triggers->bits));
+      break;
+    }
+  }
+  GlyphSet_update_range(triggers);
+}
+
+Compiler *new_compiler(Blob *blob, const LookupList *lookupList, BlobOffset *lookup_offsets) {
+  Compiler *compiler = calloc(1, sizeof(Compiler));
+  if (compiler == NULL) return NULL;
+  uint16_t lookupCount = parse_16(lookupList->lookupCount);
+  compiler->blob = blob;
+  compiler->lookupList = lookupList;
+  compiler->lookupCount = lookupCount;
+  compiler->lookup_offsets = lookup_offsets;
+  compiler->pending = malloc(lookupCount * sizeof(uint16_t));
+  compiler->table_hash = new_uintptr_t_hash();
+  compiler->coverage_hash = new_uintptr_t_hash();
+  if ((compiler->pending == NULL && lookupCount > 0) ||
+      compiler->table_hash == NULL || compiler->coverage_hash == NULL) {
+    free_compiler(compiler);
+    return NULL;
+  }
+  memset(lookup_offsets, 0, lookupCount * sizeof(BlobOffset));
+  return compiler;
+}
+
+bool compile_lookups(Compiler *compiler, const uint16_t *indices, size_t n_indices) {
+  for (size_t i = 0; i < n_indices && !compiler->failed; i++) {
+    reserve_Lookup(compiler, indices[i]);
+    compile_pending_Lookups(compiler);
+  }
+  return !compiler->failed;
+}
+
+bool compiler_failed(const Compiler *compiler) {
+  return compiler->failed;
+}
+
+void free_compiler(Compiler *compiler) {
+  if (compiler == NULL) return;
+  free(compiler->pending);
+  free(compiler->glyph_set);
+  free_uintptr_t_hash(compiler->table_hash);
+  free_uintptr_t_hash(compiler->coverage_hash);
+  free(compiler);
+}
+
+// Composes each run of adjacent SingleSubstitution Lookups of a chain, which
+// were compiled in source, into a single Lookup compiled in blob.
+// The Lookups that were fused are set to 0 in lookup_offsets, and the offset
+// in blob of the composed one, if any, is set in fused_offsets where the run
+// started. The rest of fused_offsets is set to 0.
+bool fuse_lookups(Blob *blob, const Blob *source, BlobOffset *lookup_offsets, BlobOffset *fused_offsets, size_t n_lookups) {
+  Compiler compiler = {
+    .blob = blob,
+    .source = source->data,
+    .failed = false,
+  };
+  memset(fused_offsets, 0, n_lookups * sizeof(BlobOffset));
+  fuse_Single_Lookups(&compiler, lookup_offsets, fused_offsets, n_lookups);
+  if (!compiler.failed) {
+    Blob_trim(blob);
+  }
+  return !compiler.failed;
+}
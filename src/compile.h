@@ -0,0 +1,211 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "blob.h"
+#include "bloom.h"
+#include "classdef.h"
+#include "coverage.h"
+#include "gsub.h"
+#include "glyphset.h"
+
+// Compiled tables are native-endian copies of the GSUB ones, stored in a Blob.
+// Offsets to other tables are relative to the start of the Blob,
+// Extension Substitutions are resolved, and nested lookups are referenced
+// directly by their compiled offset.
+
+#define compiled_at(base, offset, type) ((const type *)((const uint8_t *)(base) + (offset)))
+
+// Decides which function applies a compiled Substitution table.
+typedef enum {
+  NoopSubtable = 0,
+  Single1Subtable,
+  Single2Subtable,
+  MultipleSubtable,
+  LigatureSubtable,
+  GlyphContextSubtable,
+  ClassContextSubtable,
+  CoverageContextSubtable,
+  ReverseChainSubtable,
+  GlyphMapSubtable,
+  SubtableKindCount
+} SubtableKind;
+
+/** Substitutions **/
+typedef struct {
+  uint16_t kind; // SubtableKind
+  Bloom bloom; // Glyphs that can "start" the Substitution
+} CompiledSubtable;
+
+typedef struct {
+  CompiledSubtable header;
+  BlobOffset coverage;
+  int16_t deltaGlyphID;
+} CompiledSingle1;
+
+typedef struct {
+  CompiledSubtable header;
+  BlobOffset coverage;
+  uint16_t count;
+  uint16_t substitutes[];
+} CompiledSingle2;
+
+typedef struct {
+  uint16_t count;
+  uint16_t glyphs[];
+} CompiledSequence;
+
+typedef struct {
+  CompiledSubtable header;
+  BlobOffset coverage;
+  uint16_t sequenceCount;
+  BlobOffset sequences[]; // CompiledSequence
+} CompiledMultiple;
+
+// The Ligatures of a LigatureSet form a trie over their components.
+// A glyph sequence can match many Ligatures along its path, and the one
+// that comes first in the set wins, so every node keeps the position of its
+// Ligature and the smallest one below it, to stop walking early.
+typedef struct {
+  uint16_t ligatureGlyph;
+  uint16_t priority; // Position of the Ligature ending here, UINT16_MAX if none
+  uint16_t subtreePriority; // Smallest priority of this node and the ones below
+  uint16_t childCount;
+  uint32_t firstChild; // Children are contiguous, sorted by glyph
+} CompiledLigatureNode;
+
+typedef struct {
+  uint32_t nodeCount;
+  CompiledLigatureNode nodes[/* nodeCount */]; // The root matches the first glyph
+  // Followed by uint16_t glyphs[nodeCount], the glyph that leads to each node.
+} CompiledLigatureSet;
+
+#define ligature_set_glyphs(set) ((const uint16_t *)((set)->nodes + (set)->nodeCount))
+
+typedef struct {
+  CompiledSubtable header;
+  BlobOffset coverage;
+  uint16_t setCount;
+  BlobOffset sets[]; // CompiledLigatureSet
+} CompiledLigatureSubst;
+
+typedef struct {
+  uint16_t sequenceIndex;
+  BlobOffset lookup; // CompiledLookup, 0 if the index was invalid
+} CompiledLookupRecord;
+
+// Sequence Context and Chained Sequence Context rules share this layout,
+// the former just has no backtrack and lookahead.
+// For glyph and class rules the sequences are uint16_t arrays, and the input
+// one doesn't contain the first glyph.
+// For coverage rules they're BlobOffset arrays, with all the input coverages.
+typedef struct {
+  uint16_t backtrackCount;
+  uint16_t inputCount; // Includes the first glyph
+  uint16_t lookaheadCount;
+  uint16_t recordCount;
+  BlobOffset backtrack;
+  BlobOffset input;
+  BlobOffset lookahead;
+  BlobOffset records; // CompiledLookupRecord
+} CompiledRule;
+
+typedef struct {
+  uint16_t count;
+  BlobOffset rules[]; // CompiledRule
+} CompiledRuleSet;
+
+typedef struct {
+  CompiledSubtable header;
+  BlobOffset coverage;
+  uint16_t ruleSetCount;
+  BlobOffset ruleSets[]; // CompiledRuleSet, indexed by coverage index
+} CompiledGlyphContext;
+
+typedef struct {
+  CompiledSubtable header;
+  BlobOffset coverage;
+  BlobOffset backtrackClassDef;
+  BlobOffset inputClassDef;
+  BlobOffset lookaheadClassDef;
+  uint16_t ruleSetCount;
+  BlobOffset ruleSets[]; // CompiledRuleSet, indexed by class
+} CompiledClassContext;
+
+typedef struct {
+  CompiledSubtable header;
+  CompiledRule rule;
+} CompiledCoverageContext;
+
+typedef struct {
+  CompiledSubtable header;
+  BlobOffset coverage;
+  uint16_t backtrackCount;
+  uint16_t lookaheadCount;
+  uint16_t substituteCount;
+  BlobOffset backtrack; // BlobOffset array of CompiledCoverage
+  BlobOffset lookahead; // BlobOffset array of CompiledCoverage
+  uint16_t substitutes[];
+} CompiledReverseChain;
+
+// Adjacent SingleSubstitution Lookups of a chain, composed into one table.
+typedef struct {
+  CompiledSubtable header;
+  uint16_t first; // Glyphs outside [first, first + count) are unchanged
+  uint32_t count;
+  uint16_t glyphs[];
+} CompiledGlyphMap;
+
+/** Lookup **/
+// Exact set of glyphs, for Lookups whose bloom lets too many others through.
+typedef struct {
+  uint32_t first; // Multiple of 64
+  uint32_t count; // Words
+  uint64_t bits[];
+} CompiledGlyphSet;
+
+static inline bool CompiledGlyphSet_has(const CompiledGlyphSet *set, uint16_t glyphID) {
+  uint32_t word = (uint32_t)(glyphID - set->first) / 64;
+  return glyphID >= set->first && word < set->count && ((set->bits[word] >> (glyphID % 64)) & 1);
+}
+
+typedef struct {
+  uint16_t lookupType; // Never ExtensionSubstitutionLookupType
+  uint16_t lookupFlag;
+  uint16_t subtableCount;
+  Bloom bloom; // Union of the blooms of the subtables
+  // CompiledGlyphSet of the glyphs that can "start" the Lookup, checked
+  // instead of bloom for each glyph. 0 if bloom is good enough.
+  BlobOffset filter;
+  BlobOffset subtables[]; // CompiledSubtable
+} CompiledLookup;
+
+// Compiles the Lookups of a LookupList into a Blob as they're needed, so that
+// the ones shared by several chains are only compiled once.
+typedef struct Compiler Compiler;
+// lookup_offsets has room for every Lookup of lookupList, and gets the
+// compiled offset of each one, 0 until it's compiled.
+Compiler *new_compiler(Blob *blob, const LookupList *lookupList, BlobOffset *lookup_offsets);
+// Compiles the Lookups with the given indices that weren't already, with the
+// ones they reference. It only appends to the Blob.
+// Once it fails, it keeps failing, as the Lookups may be half compiled.
+bool compile_lookups(Compiler *compiler, const uint16_t *indices, size_t n_indices);
+bool compiler_failed(const Compiler *compiler);
+void free_compiler(Compiler *compiler);
+bool fuse_lookups(Blob *blob, const Blob *source, BlobOffset *lookup_offsets, BlobOffset *fused_offsets, size_t n_lookups);
+
+// How far a match can extend, in glyphs.
+typedef struct {
+  size_t length; // Longest sequence of glyphs a match can look at
+  size_t backtrack; // Most glyphs a match can look at before its first input glyph
+  size_t lookahead; // Most glyphs a match can look at after its first input glyph
+} LookupReach;
+
+// Sets in touched the glyphs that the compiled Lookups can match or change,
+// and in reach how far their matches can extend.
+// Lookup flags aren't applied, so matches never skip glyphs: a glyph that's
+// not touched can't be part of any match.
+bool analyze_lookups(const Blob *blob, const BlobOffset *lookup_offsets, size_t n_lookups, uint64_t *touched, LookupReach *reach);
+// Sets in triggers the glyphs that can "start" one of the compiled Lookups.
+// Only they can be changed, and only from the first one in a run on.
+void collect_triggers(const Blob *blob, const BlobOffset *lookup_offsets, size_t n_lookups, GlyphSet *triggers);
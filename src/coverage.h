@@ -0,0 +1,78 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "bitops.h"
+
+// Compiled Coverage tables don't keep the GSUB layout.
+// Each one is turned into the index that fits it best:
+// - a bitmap over [first, last] with the rank of each 64-bit word,
+//   for dense tables, where a lookup is a bit test and a popcount;
+// - the sorted glyphs in Eytzinger (BFS) order, for sparse tables,
+//   where a lookup is a branch-free, cache-friendly binary search.
+
+typedef enum {
+  CoverageFormat_Bitmap = 1,
+  CoverageFormat_Eytzinger = 2,
+} CompiledCoverageFormats;
+
+typedef struct {
+  uint16_t format;
+  uint16_t first; // Smallest glyph in the Coverage
+  uint16_t last; // Biggest glyph in the Coverage
+  uint16_t _reserved;
+  uint32_t count; // Number of glyphs
+  uint32_t size; // Bitmap words or Eytzinger nodes
+} CompiledCoverage;
+
+typedef struct {
+  CompiledCoverage header;
+  uint64_t bits[/* size */]; // Bit i is glyph first + i
+  // Followed by uint16_t ranks[size], the coverage index of the first
+  // glyph of each word.
+} CompiledCoverageBitmap;
+
+typedef struct {
+  CompiledCoverage header;
+  uint16_t glyphs[/* size + 1 */]; // 1-based, glyphs[0] is unused
+  // Followed by uint16_t indices[size + 1], the coverage index of each glyph.
+} CompiledCoverageEytzinger;
+
+#define coverage_bitmap_ranks(bitmap) ((uint16_t *)((bitmap)->bits + (bitmap)->header.size))
+#define coverage_eytzinger_indices(eytzinger) ((uint16_t *)((eytzinger)->glyphs + (eytzinger)->header.size + 1))
+
+static inline bool find_in_Coverage(const CompiledCoverage *coverage, uint16_t id, uint32_t *index) {
+  // Also rejects everything for empty Coverages, as first > last
+  if (id < coverage->first || id > coverage->last) return false;
+
+  switch (coverage->format) {
+    case CoverageFormat_Bitmap: {
+      const CompiledCoverageBitmap *bitmap = (const CompiledCoverageBitmap *)coverage;
+      uint32_t bit = id - coverage->first;
+      uint64_t word = bitmap->bits[bit / 64];
+      uint64_t mask = (uint64_t)1 << (bit % 64);
+      if (!(word & mask)) return false;
+      if (index != NULL) {
+        *index = coverage_bitmap_ranks(bitmap)[bit / 64] + popcount_64(word & (mask - 1));
+      }
+      return true;
+    }
+    case CoverageFormat_Eytzinger: {
+      const CompiledCoverageEytzinger *eytzinger = (const CompiledCoverageEytzinger *)coverage;
+      const uint16_t *glyphs = eytzinger->glyphs;
+      size_t k = 1;
+      while (k <= coverage->size) {
+        k = 2 * k + (glyphs[k] < id);
+      }
+      // Go back up to the last node where we went left
+      k >>= ffs_not_64(k);
+      if (k == 0 || glyphs[k] != id) return false;
+      if (index != NULL) {
+        *index = coverage_eytzinger_indices(eytzinger)[k];
+      }
+      return true;
+    }
+  }
+  return false;
+}
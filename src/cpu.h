@@ -0,0 +1,35 @@
+#pragma once
+#include <stdbool.h>
+
+// SIMD_X86 is defined where SSE2 can always be used, and AVX2 code can be
+// compiled in functions marked TARGET_AVX2, to be called only if
+// cpu_has_avx2() says so.
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+
+#define SIMD_X86
+#include <immintrin.h>
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define cpu_has_avx2() __builtin_cpu_supports("avx2")
+
+#elif defined(_MSC_VER) && defined(_M_X64)
+
+#define SIMD_X86
+#include <intrin.h>
+#include <immintrin.h>
+#define TARGET_AVX2
+static inline bool cpu_has_avx2(void) {
+  // -1 until checked, racing to set it is harmless
+  static volatile int has_avx2 = -1;
+  if (has_avx2 < 0) {
+    int info[4];
+    __cpuidex(info, 7, 0);
+    bool avx2 = info[1] & (1 << 5);
+    __cpuid(info, 1);
+    // The OS must also save the AVX registers
+    has_avx2 = avx2 && (info[2] & (1 << 27)) && (_xgetbv(0) & 6) == 6;
+  }
+  return has_avx2;
+}
+
+#endif
@@ -9,6 +9,11 @@
 //   uint16_t *array;
 //   Bloom bloom;
 //   bool bloom_valid;
+//   bool borrowed;
+//   bool copy_on_write;
+//   bool modified;
+//   uint8_t *flags;
+//   uint32_t *clusters;
 // } GlyphArray;
 
 GlyphArray *GlyphArray_new(size_t size) {
@@ -18,6 +23,11 @@ GlyphArray *GlyphArray_new(size_t size) {
   ga->allocated = size;
   ga->bloom = null_bloom;
   ga->bloom_valid = true;
+  ga->borrowed = false;
+  ga->copy_on_write = false;
+  ga->modified = false;
+  ga->flags = NULL;
+  ga->clusters = NULL;
   ga->array = malloc(sizeof(uint16_t) * size);
   if (ga->array == NULL) {
     free(ga);
@@ -26,20 +36,131 @@ GlyphArray *GlyphArray_new(size_t size) {
   return ga;
 }
 
+// Initializes an empty GlyphArray, that allocates when something is added.
+// Use GlyphArray_free_storage, not GlyphArray_free, when done with it.
+void GlyphArray_init(GlyphArray *glyph_array) {
+  GlyphArray_init_with_storage(glyph_array, NULL, 0);
+  glyph_array->borrowed = false;
+}
+
+// Initializes an empty GlyphArray that uses `storage` until it needs to grow
+// past `size`, after which it moves to memory it owns.
+// Use GlyphArray_free_storage, not GlyphArray_free, when done with it.
+void GlyphArray_init_with_storage(GlyphArray *glyph_array, uint16_t *storage, size_t size) {
+  *glyph_array = (GlyphArray){
+    .len = 0,
+    .allocated = size,
+    .array = storage,
+    .bloom = null_bloom,
+    .bloom_valid = true,
+    .borrowed = true,
+    .copy_on_write = false,
+    .modified = false,
+  };
+}
+
+// Initializes a GlyphArray that reads from `data`, and only makes a copy of it
+// the first time it's modified.
+// Use GlyphArray_free_storage, not GlyphArray_free, when done with it.
+void GlyphArray_init_read_only(GlyphArray *glyph_array, const uint16_t *data, size_t len) {
+  GlyphArray_init_with_storage(glyph_array, (uint16_t *)data, len);
+  glyph_array->len = len;
+  glyph_array->bloom_valid = false;
+  glyph_array->copy_on_write = true;
+}
+
+void GlyphArray_free_storage(GlyphArray *glyph_array) {
+  if (!glyph_array->borrowed) free(glyph_array->array);
+  free(glyph_array->flags);
+  free(glyph_array->clusters);
+  glyph_array->flags = NULL;
+  glyph_array->clusters = NULL;
+  glyph_array->array = NULL;
+  glyph_array->allocated = 0;
+}
+
 void GlyphArray_free(GlyphArray *ga) {
   if (ga == NULL) return;
-  free(ga->array);
-  ga->array = NULL;
+  GlyphArray_free_storage(ga);
   free(ga);
 }
 
+// Makes room for the per-glyph data of `new_size` glyphs, if it's tracked.
+static bool GlyphArray_grow_tracked(GlyphArray *ga, size_t new_size) {
+  if (ga->flags != NULL) {
+    uint8_t *flags = realloc(ga->flags, new_size);
+    if (flags == NULL) return false;
+    ga->flags = flags;
+  }
+  if (ga->clusters != NULL) {
+    uint32_t *clusters = realloc(ga->clusters, new_size * sizeof(uint32_t));
+    if (clusters == NULL) return false;
+    ga->clusters = clusters;
+  }
+  return true;
+}
 
-bool GlyphArray_set1(GlyphArray *glyph_array, size_t index, uint16_t data) {
+// Moves the glyphs to an owned area of `new_size` glyphs.
+static bool GlyphArray_grow(GlyphArray *ga, size_t new_size) {
+  uint16_t *_array;
+  if (!GlyphArray_grow_tracked(ga, new_size)) return false;
+  if (ga->borrowed) {
+    _array = malloc(sizeof(uint16_t) * new_size);
+    if (_array == NULL) return false;
+    memcpy(_array, ga->array, ga->len * sizeof(uint16_t));
+  } else {
+    _array = realloc(ga->array, sizeof(uint16_t) * new_size);
+    if (_array == NULL) return false;
+  }
+  ga->array = _array;
+  ga->allocated = new_size;
+  ga->borrowed = false;
+  ga->copy_on_write = false;
+  return true;
+}
+
+// Gets the glyphs ready to be modified.
+bool GlyphArray_make_writable(GlyphArray *glyph_array) {
   GlyphArray *ga = glyph_array;
-  if (index > ga->len) {
+  if (ga->copy_on_write && !GlyphArray_grow(ga, ga->len > 0 ? ga->len : 1)) {
     return false;
   }
   ga->bloom_valid = false;
+  ga->modified = true;
+  return true;
+}
+
+// Starts keeping the GlyphFlags of each glyph, all unset for now.
+bool GlyphArray_track_flags(GlyphArray *glyph_array) {
+  GlyphArray *ga = glyph_array;
+  if (ga->flags != NULL) return true;
+  ga->flags = calloc(ga->allocated > 0 ? ga->allocated : 1, sizeof(uint8_t));
+  return ga->flags != NULL;
+}
+
+// Starts keeping the cluster of each glyph, which for now is its index.
+bool GlyphArray_track_clusters(GlyphArray *glyph_array) {
+  GlyphArray *ga = glyph_array;
+  if (ga->clusters != NULL) return true;
+  ga->clusters = malloc((ga->allocated > 0 ? ga->allocated : 1) * sizeof(uint32_t));
+  if (ga->clusters == NULL) return false;
+  for (size_t i = 0; i < ga->len; i++) ga->clusters[i] = i;
+  return true;
+}
+
+void GlyphArray_untrack_clusters(GlyphArray *glyph_array) {
+  free(glyph_array->clusters);
+  glyph_array->clusters = NULL;
+}
+
+
+bool GlyphArray_set1(GlyphArray *glyph_array, size_t index, uint16_t data) {
+  GlyphArray *ga = glyph_array;
+  if (index >= ga->len) {
+    return false;
+  }
+  if (ga->array[index] == data) return true;
+  if (!GlyphArray_make_writable(ga)) return false;
   ga->array[index] = data;
   return true;
 }
@@ -50,7 +171,7 @@ bool GlyphArray_set(GlyphArray *glyph_array, size_t from, const uint16_t *data,
     // TODO: error out maybe?
     return false;
   }
-  ga->bloom_valid = false;
+  if (!GlyphArray_make_writable(ga)) return false;
   if (from + data_size > ga->len) {
     size_t remainder = (from + data_size) - ga->len;
     if (ga->len + remainder > ga->allocated) {
@@ -65,27 +186,32 @@ bool GlyphArray_set(GlyphArray *glyph_array, size_t from, const uint16_t *data,
       if ((data >= ga->array && data < ga->array + ga->len) ||
           (data + data_size > ga->array && data + data_size <= ga->array + ga->len)) {
         uint16_t *new_array = NULL;
+        if (!GlyphArray_grow_tracked(ga, new_size)) return false;
         new_array = malloc(sizeof(uint16_t) * new_size);
         if (new_array == NULL) return false;
         memcpy(new_array, ga->array, ga->len * sizeof(uint16_t));
         uint16_t *old_array = ga->array;
+        bool borrowed = ga->borrowed;
         ga->array = new_array;
         ga->allocated = new_size;
+        ga->borrowed = false;
 
         bool res = GlyphArray_set(ga, from, data, data_size);
-        free(old_array);
+        if (!borrowed) free(old_array);
         return res;
       }
-      uint16_t *_array = realloc(ga->array, sizeof(uint16_t) * new_size);
-      if (_array == NULL) {
+      if (!GlyphArray_grow(ga, new_size)) {
         return false;
       }
-      ga->array = _array;
-      ga->allocated = new_size;
+    }
+    if (ga->flags != NULL) memset(&ga->flags[ga->len], 0, remainder);
+    if (ga->clusters != NULL) {
+      for (size_t i = ga->len; i < ga->len + remainder; i++) ga->clusters[i] = i;
     }
     ga->len += remainder;
   }
-  memcpy(&ga->array[from], data, data_size * sizeof(uint16_t));
+  // data can overlap with the array
+  memmove(&ga->array[from], data, data_size * sizeof(uint16_t));
   return true;
 }
 
@@ -94,16 +220,90 @@ bool GlyphArray_put(GlyphArray *dst, size_t dst_index, GlyphArray *src, size_t s
   return GlyphArray_set(dst, dst_index, &src->array[src_index], len);
 }
 
+// Makes sure the GlyphArray can contain at least `size` glyphs.
+static bool GlyphArray_reserve(GlyphArray *ga, size_t size) {
+  if (size <= ga->allocated) return true;
+  size_t new_size = size * 1.3;
+  if (new_size < size) {
+    // Would have overflown
+    return false;
+  }
+  return GlyphArray_grow(ga, new_size);
+}
+
+// Replaces `len` glyphs starting at `index` with the `data_size` glyphs in `data`.
+// `data` must not point inside the GlyphArray.
+// If clusters are tracked, the new glyphs all get the cluster of the first
+// replaced glyph, so ligatures and multiple substitutions keep where they came
+// from.
+bool GlyphArray_splice(GlyphArray *glyph_array, size_t index, size_t len, const uint16_t *data, size_t data_size) {
+  return GlyphArray_splice_with_clusters(glyph_array, index, len, data, NULL, data_size);
+}
+
+// Like GlyphArray_splice, but the new glyphs get `clusters`, unless it's NULL.
+bool GlyphArray_splice_with_clusters(GlyphArray *glyph_array, size_t index, size_t len, const uint16_t *data, const uint32_t *clusters, size_t data_size) {
+  GlyphArray *ga = glyph_array;
+  if (index + len > ga->len) {
+    return false;
+  }
+  if (len == data_size && (len == 0 || memcmp(&ga->array[index], data, len * sizeof(uint16_t)) == 0) &&
+      (clusters == NULL || ga->clusters == NULL || len == 0 ||
+       memcmp(&ga->clusters[index], clusters, len * sizeof(uint32_t)) == 0)) {
+    return true;
+  }
+  size_t new_len = ga->len - len + data_size;
+  if (!GlyphArray_make_writable(ga) || !GlyphArray_reserve(ga, new_len)) {
+    return false;
+  }
+  size_t tail = ga->len - (index + len);
+  memmove(&ga->array[index + data_size], &ga->array[index + len], tail * sizeof(uint16_t));
+  if (data_size > 0) memcpy(&ga->array[index], data, data_size * sizeof(uint16_t));
+  if (ga->flags != NULL) {
+    // The new glyphs can't be split from each other, and the first one keeps
+    // the flags of the first replaced glyph.
+    uint8_t first = index < ga->len ? ga->flags[index] : 0;
+    memmove(&ga->flags[index + data_size], &ga->flags[index + len], tail);
+    if (data_size > 0) {
+      ga->flags[index] = first;
+      memset(&ga->flags[index + 1], GlyphFlag_UnsafeToBreak, data_size - 1);
+    } else if (tail > 0) {
+      ga->flags[index] |= first;
+    }
+  }
+  if (ga->clusters != NULL) {
+    uint32_t cluster = index < ga->len ? ga->clusters[index]
+                     : index > 0 ? ga->clusters[index - 1] : 0;
+    memmove(&ga->clusters[index + data_size], &ga->clusters[index + len], tail * sizeof(uint32_t));
+    if (clusters != NULL) {
+      if (data_size > 0) memcpy(&ga->clusters[index], clusters, data_size * sizeof(uint32_t));
+    } else {
+      for (size_t i = index; i < index + data_size; i++) ga->clusters[i] = cluster;
+    }
+  }
+  ga->len = new_len;
+  return true;
+}
+
 bool GlyphArray_shrink(GlyphArray *glyph_array, size_t reduction) {
   GlyphArray *ga = glyph_array;
   if (reduction > ga->len) {
     return false;
   }
+  if (reduction == 0) return true;
   ga->bloom_valid = false;
+  ga->modified = true;
   ga->len -= reduction;
   return true;
 }
 
+// Empties the GlyphArray, keeping its storage.
+void GlyphArray_clear(GlyphArray *glyph_array) {
+  glyph_array->len = 0;
+  glyph_array->bloom = null_bloom;
+  glyph_array->bloom_valid = true;
+  glyph_array->modified = false;
+}
+
 bool GlyphArray_append(GlyphArray *glyph_array, const uint16_t *data, size_t data_size) {
   return GlyphArray_set(glyph_array, glyph_array->len, data, data_size);
 }
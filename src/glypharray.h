@@ -16,9 +16,29 @@ typedef struct GlyphArray {
   uint16_t *array;
   Bloom bloom;
   bool bloom_valid;
+  bool borrowed; // array isn't owned, and must be copied before growing it
+  bool copy_on_write; // array is borrowed and read-only, copy it before writing
+  bool modified; // Some glyph was changed, added or removed
+  // Per-glyph data, next to array and NULL unless tracked. Always owned.
+  uint8_t *flags; // GlyphFlags of each glyph
+  uint32_t *clusters; // Index of the input glyph each glyph comes from
 } GlyphArray;
 
+typedef enum {
+  // Breaking the run before this glyph, and applying the chain to both
+  // sides separately, could give a different result.
+  GlyphFlag_UnsafeToBreak = 1,
+} GlyphFlags;
+
 GlyphArray *GlyphArray_new(size_t size);
+void GlyphArray_init(GlyphArray *glyph_array);
+void GlyphArray_init_with_storage(GlyphArray *glyph_array, uint16_t *storage, size_t size);
+void GlyphArray_init_read_only(GlyphArray *glyph_array, const uint16_t *data, size_t len);
+void GlyphArray_free_storage(GlyphArray *glyph_array);
+bool GlyphArray_make_writable(GlyphArray *glyph_array);
+bool GlyphArray_track_flags(GlyphArray *glyph_array);
+bool GlyphArray_track_clusters(GlyphArray *glyph_array);
+void GlyphArray_untrack_clusters(GlyphArray *glyph_array);
 #if !defined(NO_FREETYPE)
 GlyphArray *GlyphArray_new_from_utf8(FT_Face face, const char *string, size_t len);
 #endif
@@ -30,7 +50,10 @@ bool GlyphArray_set1(GlyphArray *glyph_array, size_t index, uint16_t data);
 bool GlyphArray_set(GlyphArray *glyph_array, size_t from, const uint16_t *data, size_t data_size);
 bool GlyphArray_append(GlyphArray *glyph_array, const uint16_t *data, size_t data_size);
 bool GlyphArray_put(GlyphArray *dst, size_t dst_index, GlyphArray *src, size_t src_index, size_t len);
+bool GlyphArray_splice(GlyphArray *glyph_array, size_t index, size_t len, const uint16_t *data, size_t data_size);
+bool GlyphArray_splice_with_clusters(GlyphArray *glyph_array, size_t index, size_t len, const uint16_t *data, const uint32_t *clusters, size_t data_size);
 bool GlyphArray_shrink(GlyphArray *glyph_array, size_t reduction);
+void GlyphArray_clear(GlyphArray *glyph_array);
 bool GlyphArray_compare(GlyphArray *ga1, GlyphArray *ga2);
 void GlyphArray_free(GlyphArray *ga);
 void GlyphArray_print(GlyphArray *ga);
@@ -0,0 +1,71 @@
+#include "glyphset.h"
+#include "bitops.h"
+#include "cpu.h"
+
+void GlyphSet_update_range(GlyphSet *set) {
+  uint32_t first = 0, last = GLYPH_SET_WORDS;
+  while (first < GLYPH_SET_WORDS && set->bits[first] == 0) first++;
+  if (first == GLYPH_SET_WORDS) {
+    set->first = 1;
+    set->last = 0;
+    return;
+  }
+  while (set->bits[last - 1] == 0) last--;
+  set->first = first * 64 + ctz_64(set->bits[first]);
+  set->last = (last - 1) * 64 + 63 - clz_64(set->bits[last - 1]);
+}
+
+static size_t find_scalar(const GlyphSet *set, const uint16_t *glyphs, size_t start, size_t len) {
+  for (size_t i = start; i < len; i++) {
+    if (GlyphSet_has(set, glyphs[i])) return i;
+  }
+  return len;
+}
+
+#if defined(SIMD_X86)
+
+// Looks up 8 glyphs at a time, gathering the 32-bit word of the set each one
+// falls into.
+TARGET_AVX2 static size_t find_avx2(const GlyphSet *set, const uint16_t *glyphs, size_t len) {
+  const int *words = (const int *)set->bits;
+  const __m256i low_bits = _mm256_set1_epi32(31);
+  const __m256i ones = _mm256_set1_epi32(1);
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    __m256i ids = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)&glyphs[i]));
+    __m256i gathered = _mm256_i32gather_epi32(words, _mm256_srli_epi32(ids, 5), 4);
+    __m256i bits = _mm256_srlv_epi32(gathered, _mm256_and_si256(ids, low_bits));
+    if (!_mm256_testz_si256(bits, ones)) return find_scalar(set, glyphs, i, i + 8);
+  }
+  return find_scalar(set, glyphs, i, len);
+}
+
+// Without gathers, first skip 8 glyphs at a time while they're all outside
+// the range of the set.
+static size_t find_sse2(const GlyphSet *set, const uint16_t *glyphs, size_t len) {
+  const __m128i first = _mm_set1_epi16((short)set->first);
+  const __m128i range = _mm_set1_epi16((short)(set->last - set->first));
+  const __m128i zero = _mm_setzero_si128();
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8) {
+    __m128i ids = _mm_loadu_si128((const __m128i *)&glyphs[i]);
+    // Saturates to 0 only for glyphs from first to last
+    __m128i above = _mm_subs_epu16(_mm_sub_epi16(ids, first), range);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi16(above, zero)) == 0) continue;
+    size_t found = find_scalar(set, glyphs, i, i + 8);
+    if (found < i + 8) return found;
+  }
+  return find_scalar(set, glyphs, i, len);
+}
+
+#endif
+
+size_t GlyphSet_find(const GlyphSet *set, const uint16_t *glyphs, size_t len) {
+  if (set->first > set->last) return len;
+#if defined(SIMD_X86)
+  if (cpu_has_avx2()) return find_avx2(set, glyphs, len);
+  return find_sse2(set, glyphs, len);
+#else
+  return find_scalar(set, glyphs, 0, len);
+#endif
+}
@@ -0,0 +1,20 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// A bit for each glyph ID
+#define GLYPH_SET_WORDS ((UINT16_MAX + 1) / 64)
+
+typedef struct {
+  // Range of the glyphs in the set, first > last if it's empty.
+  uint32_t first, last;
+  uint64_t bits[GLYPH_SET_WORDS];
+} GlyphSet;
+
+#define GlyphSet_has(set, id) (((set)->bits[(id) / 64] >> ((id) % 64)) & 1)
+
+// Updates first and last after bits changed.
+void GlyphSet_update_range(GlyphSet *set);
+// Returns the index of the first glyph that's in the set, len if none is.
+size_t GlyphSet_find(const GlyphSet *set, const uint16_t *glyphs, size_t len);
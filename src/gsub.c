@@ -1,25 +1,64 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
 
 #include "gsub.h"
 #include "bloom.h"
+#include "blob.h"
+#include "compile.h"
+#include "classdef.h"
+#include "coverage.h"
 #include "glypharray.h"
 #include "bswap.h"
-#include "hash.h"
-
-build_hash_functions(Bloom)
-build_hash_functions(uintptr_t)
+#include "cache.h"
+#include "candidates.h"
+#include "bitops.h"
 
+// Chains are read-only once generated, and applying them only writes to the
+// GlyphArray, so they can be shared between threads.
 typedef struct LBT_Chain {
-  const LookupTable * const *lookupsArray;
+  // Compiled offsets of the Lookups to apply, in order.
+  // 0 for the ones that were fused.
+  BlobOffset *lookupsArray;
   size_t lookupCount;
-  const GsubHeader *gsubHeader;
-  const LookupList *lookupList;
-  HashTable_Bloom *bloom_hash;
-  HashTable_uintptr_t *ptr_hash;
+  // Data of the CompiledGSUB the Lookups belong to, shared with other chains.
+  // The chain holds a reference to it, NULL for chains that don't read one.
+  CompiledGSUB *compiled_GSUB;
+  const uint8_t *compiled;
+  size_t compiledLength;
+  // Lookups composed from runs of SingleSubstitutions, in place of the first
+  // one of each run; 0 elsewhere. Only this chain uses them.
+  BlobOffset *fusedArray;
+  Blob fused;
+  // Glyphs that some Lookup can match or change, a bit per glyph ID.
+  // NULL if there are no Lookups.
+  uint64_t *touched;
+  // Glyphs that can "start" some Lookup. NULL if there are no Lookups.
+  GlyphSet *triggers;
+  // How far the matches of the Lookups can extend.
+  LookupReach reach;
+  // Results of previous runs, NULL if disabled. It has its own locks.
+  // Set at most once, as everyone sharing the chain can be using it.
+  ResultCache *_Atomic cache;
+  // The ChainMemo entry sharing it, NULL if it's not shared.
+  struct ChainMemoEntry *memo_entry;
+  // The arrays and fused point into serialized data that isn't owned.
+  bool borrowed;
 } Chain;
 
+#define chain_at(chain, offset, type) compiled_at((chain)->compiled, (offset), type)
+
+struct CompiledGSUB {
+  // Keeps its old areas as it grows, as chains generated before still read them.
+  Blob compiled;
+  BlobOffset *lookupsArray; // By Lookup index, 0 until it's compiled
+  Compiler *compiler;
+  // One for the owner, and one for each chain reading it
+  atomic_size_t refs;
+};
+
 #define compare_tags(tag1, tag2) ((tag1)[0] == (tag2)[0] &&                     \
                                   (tag1)[1] == (tag2)[1] &&                     \
                                   (tag1)[2] == (tag2)[2] &&                     \
@@ -30,44 +69,6 @@ const unsigned char dflt_tag[4] = {'d', 'f', 'l', 't'};
 const unsigned char _RQD_tag[4] = {' ', 'R', 'Q', 'D'};
 const unsigned char latn_tag[4] = {'l', 'a', 't', 'n'};
 
-typedef enum {
-  SingleLookupType = 1,
-  MultipleLookupType,
-  AlternateLookupType,
-  LigatureLookupType,
-  ContextLookupType,
-  ChainingLookupType,
-  ExtensionSubstitutionLookupType,
-  ReverseChainingContextSingleLookupType,
-  ReservedLookupType
-} LookupTypes;
-
-typedef enum {
-  SingleSubstitutionFormat_1 = 1,
-  SingleSubstitutionFormat_2
-} SingleSubstitutionFormats;
-
-typedef enum {
-  SequenceContextFormat_1 = 1,
-  SequenceContextFormat_2,
-  SequenceContextFormat_3
-} SequenceContextFormats;
-
-typedef enum {
-  ChainedSequenceContextFormat_1 = 1,
-  ChainedSequenceContextFormat_2,
-  ChainedSequenceContextFormat_3
-} ChainedSequenceContextFormats;
-
-typedef enum {
-  ClassFormat_1 = 1,
-  ClassFormat_2
-} ClassFormats;
-
-typedef enum {
-  ReverseChainSingleSubstFormat_1 = 1,
-} ReverseChainSingleSubstFormat;
-
 // Return the ScriptTable with the specified tag.
 // If the tag is NULL, the default script is returned.
 static const ScriptTable *get_script_table(const ScriptList *scriptList, const unsigned char (*script)[4]) {
@@ -135,7 +136,7 @@ static const FeatureTable *get_feature(const FeatureList *featureList, uint16_t
 }
 
 static LookupTable *get_lookup(const LookupList *lookupList, uint16_t index) {
-  if (index > parse_16(lookupList->lookupCount)) return NULL;
+  if (index >= parse_16(lookupList->lookupCount)) return NULL;
   return (LookupTable *)((uint8_t *)lookupList + parse_16(lookupList->lookupOffsets[index]));
 }
 
@@ -163,10 +164,10 @@ static size_t get_lookups_from_feature(const FeatureTable *featureTable, const L
 }
 
 // Returns the number of lookups of the given LangSysTable,
-// filtered and sorted as specified in features_enabled.
-// lookups must either be an array big enough to contain
-// all the pointers to lookups, or be NULL.
-static size_t get_lookups(const LangSysTable* langSysTable, const FeatureList *featureList, const LookupList *lookupList, const unsigned char (*features_enabled)[4], size_t nFeatures, LookupTable ***lookups) {
+// filtered as specified in features_enabled, and sorted in Lookup order.
+// If lookups is not NULL, it's set to a new array with the indices
+// of the lookups.
+static size_t get_lookups(const LangSysTable* langSysTable, const FeatureList *featureList, const LookupList *lookupList, const unsigned char (*features_enabled)[4], size_t nFeatures, uint16_t **lookups) {
   bool *lookups_map = calloc(parse_16(lookupList->lookupCount), sizeof(bool));
   if (lookups_map == NULL) return 0;
 
@@ -199,15 +200,16 @@ static size_t get_lookups(const LangSysTable* langSysTable, const FeatureList *f
     }
   }
   if (lookups != NULL) {
-    LookupTable **_lookups = malloc(sizeof(LookupTable *) * c);
+    uint16_t *_lookups = malloc(sizeof(uint16_t) * c);
     if (_lookups == NULL) {
       *lookups = NULL;
+      c = 0;
       goto end;
     }
     uint16_t lookupCount = parse_16(lookupList->lookupCount);
     for (uint16_t i = 0, j = 0; i < lookupCount; i++) {
       if (lookups_map[i]) {
-        _lookups[j] = get_lookup(lookupList, i);
+        _lookups[j] = i;
         ///printf("%d -> %d\n", j, i);
         j++;
       }
@@ -219,20 +221,62 @@ end:
   return c;
 }
 
+CompiledGSUB *compile_GSUB(const uint8_t *GSUB_table) {
+  if (GSUB_table == NULL) return NULL;
+  const GsubHeader *gsubHeader = (GsubHeader *)GSUB_table;
+  const LookupList *lookupList = (LookupList *)((uint8_t *)gsubHeader + parse_16(gsubHeader->lookupListOffset));
+  uint16_t lookupCount = parse_16(lookupList->lookupCount);
+
+  CompiledGSUB *compiled_GSUB = calloc(1, sizeof(CompiledGSUB));
+  if (compiled_GSUB == NULL)
+    goto fail;
+  atomic_init(&compiled_GSUB->refs, 1);
+  compiled_GSUB->compiled.keep_old = true;
+  compiled_GSUB->lookupsArray = malloc(sizeof(BlobOffset) * lookupCount);
+  if (compiled_GSUB->lookupsArray == NULL && lookupCount > 0)
+    goto fail;
+  compiled_GSUB->compiler = new_compiler(&compiled_GSUB->compiled, lookupList, compiled_GSUB->lookupsArray);
+  if (compiled_GSUB->compiler == NULL)
+    goto fail;
+  return compiled_GSUB;
+
+fail:
+  free_compiled_GSUB(compiled_GSUB);
+  return NULL;
+}
+
+void free_compiled_GSUB(CompiledGSUB *compiled_GSUB) {
+  if (compiled_GSUB == NULL) return;
+  if (atomic_fetch_sub_explicit(&compiled_GSUB->refs, 1, memory_order_acq_rel) > 1) return;
+  free_compiler(compiled_GSUB->compiler);
+  free(compiled_GSUB->lookupsArray);
+  Blob_free(&compiled_GSUB->compiled);
+  free(compiled_GSUB);
+}
+
+bool compiled_GSUB_failed(const CompiledGSUB *compiled_GSUB) {
+  return compiler_failed(compiled_GSUB->compiler);
+}
+
 // Generates a chain of Lookups to apply in order, given the script and language selected,
 // as well as the features enabled.
+// compiled_GSUB must come from the same GSUB_table, the chain keeps a reference to it.
+// The Lookups of the chain are compiled into it if they weren't already.
 // script and lang can be NULL to select the default ones.
 // features specifies the list of features to apply, and in which order.
 // Some fonts specify required features; use the tag `{' ', 'R', 'Q', 'D'}` in the features
 // to specify where it belongs in the chain.
 // Use `get_required_feature` if the tag is needed to decide where to place it.
-Chain *generate_chain(const uint8_t *GSUB_table, const unsigned char (*script)[4], const unsigned char (*lang)[4], const unsigned char (*features)[4], size_t n_features) {
-  LookupTable **lookupsArray = NULL;
+Chain *generate_chain(const uint8_t *GSUB_table, CompiledGSUB *compiled_GSUB, const unsigned char (*script)[4], const unsigned char (*lang)[4], const unsigned char (*features)[4], size_t n_features) {
+  uint16_t *lookupIndices = NULL;
 
   if (GSUB_table == NULL) {
     // There is no GSUB table, so return an empty chain
     return calloc(1, sizeof(Chain));
   }
+  if (compiled_GSUB == NULL) {
+    goto fail;
+  }
 
   const GsubHeader *gsubHeader = (GsubHeader *)GSUB_table;
 
@@ -255,32 +299,50 @@ Chain *generate_chain(const uint8_t *GSUB_table, const unsigned char (*script)[4
   const LookupList *lookupList = (LookupList *)((uint8_t *)gsubHeader + parse_16(gsubHeader->lookupListOffset));
   ///printf("Total of %d lookups\n", parse_16(lookupList->lookupCount));
 
-  size_t lookupCount = get_lookups(langSysTable, featureList, lookupList, features, n_features, &lookupsArray);
+  size_t lookupCount = get_lookups(langSysTable, featureList, lookupList, features, n_features, &lookupIndices);
+  if (!compile_lookups(compiled_GSUB->compiler, lookupIndices, lookupCount))
+    goto fail;
 
   Chain *chain = NULL;
   chain = calloc(1, sizeof(Chain));
   if (chain == NULL)
     goto fail;
 
-  chain->lookupsArray = (const LookupTable * const *)lookupsArray;
+  atomic_fetch_add_explicit(&compiled_GSUB->refs, 1, memory_order_relaxed);
+  chain->compiled_GSUB = compiled_GSUB;
+  chain->compiled = compiled_GSUB->compiled.data;
+  chain->compiledLength = compiled_GSUB->compiled.len;
+  chain->lookupsArray = malloc(sizeof(BlobOffset) * lookupCount);
+  chain->fusedArray = malloc(sizeof(BlobOffset) * lookupCount);
+  if ((chain->lookupsArray == NULL || chain->fusedArray == NULL) && lookupCount > 0)
+    goto fail_chain;
   chain->lookupCount = lookupCount;
-  chain->gsubHeader = gsubHeader;
-  chain->lookupList = lookupList;
-  chain->bloom_hash = new_Bloom_hash();
-  if (chain->bloom_hash == NULL)
+  for (size_t i = 0; i < lookupCount; i++) {
+    chain->lookupsArray[i] = compiled_GSUB->lookupsArray[lookupIndices[i]];
+  }
+  chain->touched = malloc(GLYPH_SET_WORDS * sizeof(uint64_t));
+  if (chain->touched == NULL)
+    goto fail_chain;
+  // Fusing doesn't change what the Lookups do, so analyze them as they are.
+  if (!analyze_lookups(&compiled_GSUB->compiled, chain->lookupsArray, lookupCount, chain->touched, &chain->reach))
+    goto fail_chain;
+  chain->triggers = malloc(sizeof(GlyphSet));
+  if (chain->triggers == NULL)
     goto fail_chain;
-  chain->ptr_hash = new_uintptr_t_hash();
-  if (chain->ptr_hash == NULL)
+  collect_triggers(&compiled_GSUB->compiled, chain->lookupsArray, lookupCount, chain->triggers);
+  if (!fuse_lookups(&chain->fused, &compiled_GSUB->compiled, chain->lookupsArray, chain->fusedArray, lookupCount))
     goto fail_chain;
 
+  free(lookupIndices);
   return chain;
 
 fail:
   // free(GSUB_table);
-  free(lookupsArray);
+  free(lookupIndices);
   return NULL;
 
 fail_chain:
+  free(lookupIndices);
   destroy_chain(chain);
   return NULL;
 }
@@ -288,20 +350,149 @@ fail_chain:
 void destroy_chain(Chain *chain) {
   if (chain == NULL) return;
   // free((void *)chain->gsubHeader);
-  free((void *)chain->lookupsArray);
-  free_Bloom_hash(chain->bloom_hash);
-  // uintptr_t_hash has malloc'd stuff inside, so free that first
-  if (chain->ptr_hash != NULL) {
-    for (size_t i = 0; i < chain->ptr_hash->size; i++) {
-      if (chain->ptr_hash->entries[i].address != NULL) {
-        free((void *)chain->ptr_hash->entries[i].value);
-      }
-    }
+  if (!chain->borrowed) {
+    free(chain->lookupsArray);
+    free(chain->fusedArray);
+    free(chain->touched);
+    free(chain->triggers);
+    Blob_free(&chain->fused);
   }
-  free_uintptr_t_hash(chain->ptr_hash);
+  ResultCache_free(chain->cache);
+  free_compiled_GSUB(chain->compiled_GSUB);
   free(chain);
 }
 
+#define SERIALIZED_CHAIN_MAGIC {'L', 'B', 'T', 'C'}
+// Change it whenever the layout of the compiled tables changes.
+#define SERIALIZED_CHAIN_VERSION 3
+#define SERIALIZED_CHAIN_BYTE_ORDER 0x01020304
+
+// Everything a chain needs to be applied, laid out so that it can be used in
+// place. The sections follow the header, each aligned to BLOB_ALIGNMENT.
+// Offsets are from the start of the header, 0 for empty sections.
+typedef struct {
+  uint8_t magic[4];
+  uint32_t version;
+  uint32_t byteOrder; // SERIALIZED_CHAIN_BYTE_ORDER, as written
+  uint32_t keyLength;
+  uint64_t size;
+  uint64_t keyOffset; // What the chain was generated from, as given
+  uint64_t lookupCount;
+  uint64_t lookupsOffset; // lookupCount BlobOffsets into compiled
+  uint64_t fusedArrayOffset; // lookupCount BlobOffsets into fused
+  uint64_t compiledOffset;
+  uint64_t compiledLength;
+  uint64_t fusedOffset;
+  uint64_t fusedLength;
+  uint64_t touchedOffset; // GLYPH_SET_WORDS words
+  uint64_t triggersOffset; // GlyphSet
+  uint64_t reachLength;
+  uint64_t reachBacktrack;
+  uint64_t reachLookahead;
+} SerializedChain;
+
+// Reserves len bytes for a section, returning its offset.
+static uint64_t add_section(uint64_t *size, size_t len) {
+  if (len == 0) return 0;
+  uint64_t offset = (*size + BLOB_ALIGNMENT - 1) & ~(uint64_t)(BLOB_ALIGNMENT - 1);
+  *size = offset + len;
+  return offset;
+}
+
+size_t serialize_chain(const Chain *chain, const void *key, size_t key_len, uint8_t *buffer, size_t buffer_size) {
+  size_t offsets_len = chain->lookupCount * sizeof(BlobOffset);
+  SerializedChain header = {
+    .magic = SERIALIZED_CHAIN_MAGIC,
+    .version = SERIALIZED_CHAIN_VERSION,
+    .byteOrder = SERIALIZED_CHAIN_BYTE_ORDER,
+    .keyLength = key_len,
+    .lookupCount = chain->lookupCount,
+    .compiledLength = chain->compiledLength,
+    .fusedLength = chain->fused.len,
+    .reachLength = chain->reach.length,
+    .reachBacktrack = chain->reach.backtrack,
+    .reachLookahead = chain->reach.lookahead,
+  };
+  uint64_t size = sizeof(SerializedChain);
+  header.keyOffset = add_section(&size, key_len);
+  header.lookupsOffset = add_section(&size, offsets_len);
+  header.fusedArrayOffset = add_section(&size, offsets_len);
+  header.compiledOffset = add_section(&size, chain->compiledLength);
+  header.fusedOffset = add_section(&size, chain->fused.len);
+  header.touchedOffset = add_section(&size, chain->touched != NULL ? GLYPH_SET_WORDS * sizeof(uint64_t) : 0);
+  header.triggersOffset = add_section(&size, chain->triggers != NULL ? sizeof(GlyphSet) : 0);
+  header.size = size;
+  if (size > SIZE_MAX) return 0;
+  if (buffer == NULL || buffer_size < size) return size;
+
+  memset(buffer, 0, size);
+  memcpy(buffer, &header, sizeof(SerializedChain));
+  if (key_len > 0) memcpy(buffer + header.keyOffset, key, key_len);
+  if (offsets_len > 0) {
+    memcpy(buffer + header.lookupsOffset, chain->lookupsArray, offsets_len);
+    memcpy(buffer + header.fusedArrayOffset, chain->fusedArray, offsets_len);
+  }
+  if (header.compiledLength > 0) memcpy(buffer + header.compiledOffset, chain->compiled, header.compiledLength);
+  if (header.fusedLength > 0) memcpy(buffer + header.fusedOffset, chain->fused.data, header.fusedLength);
+  if (header.touchedOffset != 0) memcpy(buffer + header.touchedOffset, chain->touched, GLYPH_SET_WORDS * sizeof(uint64_t));
+  if (header.triggersOffset != 0) memcpy(buffer + header.triggersOffset, chain->triggers, sizeof(GlyphSet));
+  return size;
+}
+
+static bool fits_section(const SerializedChain *header, uint64_t offset, uint64_t len) {
+  if (len == 0) return true;
+  return offset >= sizeof(SerializedChain) && offset % BLOB_ALIGNMENT == 0 &&
+         offset <= header->size && len <= header->size - offset;
+}
+
+Chain *load_chain(const uint8_t *data, size_t len, const void *key, size_t key_len) {
+  if (data == NULL || len < sizeof(SerializedChain) || (uintptr_t)data % BLOB_ALIGNMENT != 0) return NULL;
+  const SerializedChain *header = (const SerializedChain *)data;
+  static const uint8_t magic[4] = SERIALIZED_CHAIN_MAGIC;
+  if (memcmp(header->magic, magic, 4) != 0 ||
+      header->version != SERIALIZED_CHAIN_VERSION ||
+      header->byteOrder != SERIALIZED_CHAIN_BYTE_ORDER ||
+      header->size > len) {
+    return NULL;
+  }
+  if (header->keyLength != key_len ||
+      !fits_section(header, header->keyOffset, key_len) ||
+      (key_len > 0 && memcmp(data + header->keyOffset, key, key_len) != 0)) {
+    return NULL;
+  }
+  if (header->lookupCount > SIZE_MAX / sizeof(BlobOffset)) return NULL;
+  uint64_t offsets_len = header->lookupCount * sizeof(BlobOffset);
+  if (!fits_section(header, header->lookupsOffset, offsets_len) ||
+      !fits_section(header, header->fusedArrayOffset, offsets_len) ||
+      !fits_section(header, header->compiledOffset, header->compiledLength) ||
+      !fits_section(header, header->fusedOffset, header->fusedLength) ||
+      !fits_section(header, header->touchedOffset, GLYPH_SET_WORDS * sizeof(uint64_t)) ||
+      !fits_section(header, header->triggersOffset, sizeof(GlyphSet))) {
+    return NULL;
+  }
+
+  Chain *chain = calloc(1, sizeof(Chain));
+  if (chain == NULL) return NULL;
+  chain->borrowed = true;
+  chain->lookupCount = header->lookupCount;
+  if (offsets_len > 0) {
+    chain->lookupsArray = (BlobOffset *)(data + header->lookupsOffset);
+    chain->fusedArray = (BlobOffset *)(data + header->fusedArrayOffset);
+  }
+  if (header->compiledLength > 0) chain->compiled = data + header->compiledOffset;
+  chain->compiledLength = header->compiledLength;
+  if (header->fusedLength > 0) chain->fused.data = (uint8_t *)(data + header->fusedOffset);
+  chain->fused.len = header->fusedLength;
+  if (header->touchedOffset != 0) chain->touched = (uint64_t *)(data + header->touchedOffset);
+  if (header->triggersOffset != 0) chain->triggers = (GlyphSet *)(data + header->triggersOffset);
+  chain->reach = (LookupReach){
+    .length = header->reachLength,
+    .backtrack = header->reachBacktrack,
+    .lookahead = header->reachLookahead,
+  };
+  return chain;
+}
+
 // Returns whether the specified script and language combo has a required feature.
 // `script` and `lang` can be NULL to select the default ones.
 // Writes in `required_feature` the tag.
@@ -337,829 +528,594 @@ end:
   return result;
 }
 
-// Returns the bloom digest that matches with the glyphs for the Coverage.
-static Bloom get_Coverage_bloom(const CoverageTable *coverageTable) {
-  Bloom bloom = null_bloom;
-  switch (parse_16(coverageTable->coverageFormat)) {
-    case 1: { // Individual glyph indices
-      const CoverageArrayTable *arrayTable = (CoverageArrayTable *)coverageTable;
-      uint16_t glyphCount = parse_16(arrayTable->glyphCount);
-      if (glyphCount == 0) break;
-
-      for (uint16_t i = 0; i < glyphCount; i++) {
-        uint16_t coverageID = parse_16(arrayTable->glyphArray[i]);
-        bloom = add_glyphID_to_bloom(bloom, coverageID);
-        if (is_full_bloom(bloom)) break;
-      }
-      break;
-    }
-    case 2: { // Range of glyphs
-      const CoverageRangesTable *rangesTable = (CoverageRangesTable *)coverageTable;
-      uint16_t rangeCount = parse_16(rangesTable->rangeCount);
-      if (rangeCount == 0) break;
-      for (uint16_t i = 0; i < rangeCount; i++) {
-        const CoverageRangeRecordTable *range = &rangesTable->rangeRecords[i];
-        uint16_t startGlyphID = parse_16(range->startGlyphID);
-        uint16_t endGlyphID = parse_16(range->endGlyphID);
-        Bloom range_bloom = get_glyphID_range_bloom(startGlyphID, endGlyphID);
-        bloom = add_bloom_to_bloom(bloom, range_bloom);
-        if (is_full_bloom(bloom)) break;
-      }
-      break;
+static bool check_with_Sequence(const GlyphArray *glyph_array, size_t index, const uint16_t *sequence, uint16_t sequenceSize, int8_t step) {
+  for (uint16_t i = 0; i < sequenceSize; i++) {
+    if (glyph_array->array[index + (i * step)] != sequence[i]) {
+      return false;
     }
-    default:
-      fprintf(stderr, "UNKNOWN coverage format\n");
-      return full_bloom;
   }
-  return bloom;
+  return true;
 }
 
-// Returns the bloom digest that matches with the glyphs for all the Coverages.
-static inline Bloom get_Coverage_array_bloom(const uint8_t *coverageTablesBase, uint16_t *coverageTables, uint16_t coverageSize) {
-  Bloom bloom = null_bloom;
+static bool check_with_Coverage(const Chain *chain, const GlyphArray *glyph_array, size_t index, const BlobOffset *coverages, uint16_t coverageSize, int8_t step) {
   for (uint16_t i = 0; i < coverageSize; i++) {
-    const CoverageTable *coverageTable = (CoverageTable *)(coverageTablesBase + parse_16(coverageTables[i]));
-    Bloom coverage_bloom = get_Coverage_bloom((const void *)coverageTable);
-    bloom = add_bloom_to_bloom(bloom, coverage_bloom);
-    if (is_full_bloom(bloom)) break;
+    const CompiledCoverage *coverage = chain_at(chain, coverages[i], CompiledCoverage);
+    if (!find_in_Coverage(coverage, glyph_array->array[index + (i * step)], NULL))
+      return false;
   }
-  return bloom;
+  return true;
 }
 
-static bool find_in_Coverage(const CoverageTable *coverageTable, uint16_t id, uint32_t *index) {
-  switch (parse_16(coverageTable->coverageFormat)) {
-    case 1: { // Individual glyph indices
-      const CoverageArrayTable *arrayTable = (CoverageArrayTable *)coverageTable;
-      uint16_t glyphCount = parse_16(arrayTable->glyphCount);
-      if (glyphCount == 0) return false;
-      uint16_t first_ID = parse_16(arrayTable->glyphArray[0]);
-      if (first_ID > id) return false;
-      uint16_t last_ID = parse_16(arrayTable->glyphArray[glyphCount - 1]);
-      if (last_ID < id) return false;
-
-      // Binary search because we can
-      uint16_t top = glyphCount - 1;
-      uint16_t bottom = 0;
-      while (top - bottom >= 0) {
-        uint16_t current = (top + bottom) / 2;
-        uint16_t coverageID = parse_16(arrayTable->glyphArray[current]);
-        if (id < coverageID) {
-          top = current - 1;
-        } else if (id > coverageID) {
-          bottom = current + 1;
-        } else {
-          if (index != NULL) {
-            *index = current;
-          }
-          return true;
-        }
-      }
-      break;
-    }
-    case 2: { // Range of glyphs
-      const CoverageRangesTable *rangesTable = (CoverageRangesTable *)coverageTable;
-      uint16_t rangeCount = parse_16(rangesTable->rangeCount);
-      if (rangeCount == 0) return false;
-      const CoverageRangeRecordTable *first_range = &(rangesTable->rangeRecords[0]);
-      if (parse_16(first_range->startGlyphID) > id) return false;
-      const CoverageRangeRecordTable *last_range = &(rangesTable->rangeRecords[rangeCount - 1]);
-      if (parse_16(last_range->endGlyphID) < id) return false;
-      uint16_t k = 0;
-      for (uint16_t i = 0; i < rangeCount; i++) {
-        const CoverageRangeRecordTable *range = &rangesTable->rangeRecords[i];
-        uint16_t startGlyphID = parse_16(range->startGlyphID);
-        if (id < startGlyphID) break;
-        uint16_t endGlyphID = parse_16(range->endGlyphID);
-        if (id > endGlyphID) {
-          k += endGlyphID - startGlyphID + 1;
-          continue;
-        }
-        if (index != NULL) {
-          *index = k + (id - startGlyphID);
-        }
-        return true;
-      }
-      break;
-    }
-    default:
-      fprintf(stderr, "UNKNOWN coverage format\n");
+// Classes of the glyphs on one side of a position, so that the rules of
+// a RuleSet don't search the same glyphs over and over in a ClassDef.
+// Only used for ClassDefs that aren't direct arrays.
+#define CLASS_MEMO_SIZE 64
+typedef struct {
+  const CompiledClassDef *classDef;
+  size_t origin;
+  uint64_t known; // Bit i is set if classes[i] is valid
+  uint16_t classes[CLASS_MEMO_SIZE]; // By distance from origin
+} ClassMemo;
+
+static inline void ClassMemo_init(ClassMemo *memo, const CompiledClassDef *classDef, size_t origin) {
+  memo->classDef = classDef;
+  memo->origin = origin;
+  memo->known = 0;
+}
+
+static inline uint16_t ClassMemo_get(ClassMemo *memo, const GlyphArray *glyph_array, size_t index) {
+  uint16_t id = glyph_array->array[index];
+  size_t distance = index > memo->origin ? index - memo->origin : memo->origin - index;
+  // Dense ClassDefs are faster than the memo
+  if (memo->classDef->format != ClassDefFormat_Ranges || distance >= CLASS_MEMO_SIZE)
+    return find_in_ClassDef(memo->classDef, id);
+  uint64_t bit = (uint64_t)1 << distance;
+  if (!(memo->known & bit)) {
+    memo->classes[distance] = find_in_ClassDef(memo->classDef, id);
+    memo->known |= bit;
+  }
+  return memo->classes[distance];
+}
+
+static bool check_with_Class(const GlyphArray *glyph_array, size_t index, ClassMemo *memo, const uint16_t *sequence, uint16_t sequenceSize, int8_t step) {
+  for (uint16_t i = 0; i < sequenceSize; i++) {
+    if (ClassMemo_get(memo, glyph_array, index + (i * step)) != sequence[i]) {
       return false;
+    }
   }
-  return false;
+  return true;
 }
 
-static bool find_in_class_array(const ClassDefGeneric *classDefTable, uint16_t id, uint16_t *class) {
-  switch (parse_16(classDefTable->classFormat)) {
-    case ClassFormat_1: { // Individual glyph indices
-      const ClassDefFormat1 *arrayTable = (ClassDefFormat1 *)classDefTable;
-      uint16_t startGlyphID = parse_16(arrayTable->startGlyphID);
-      uint16_t glyphCount = parse_16(arrayTable->glyphCount);
-      if (id < startGlyphID || id >= startGlyphID + glyphCount) {
-        break;
-      }
-      if (class != NULL) {
-        *class = parse_16(arrayTable->classValueArray[id - startGlyphID]);
-      }
-      return true;
+// Returns whether the rule fits around index, without checking its contents.
+static inline bool rule_fits(const CompiledRule *rule, const GlyphArray *glyph_array, size_t index) {
+  return rule->inputCount > 0 &&
+         rule->backtrackCount <= index &&
+         index + rule->inputCount + rule->lookaheadCount <= glyph_array->len;
+}
+
+static bool apply_Lookup_at_index(const Chain *chain, Workspace *workspace, const CompiledLookup *lookup, GlyphArray* glyph_array, size_t *index);
+
+// Marks the glyphs in [start, end), which a match looked at, as not safe to
+// break between, if the GlyphArray tracks it.
+static inline void mark_unsafe(GlyphArray *glyph_array, size_t start, size_t end) {
+  if (glyph_array->flags == NULL) return;
+  for (size_t i = start + 1; i < end; i++) {
+    glyph_array->flags[i] |= GlyphFlag_UnsafeToBreak;
+  }
+}
+
+// Most rules have short inputs, so they fit on the stack when there's no
+// Workspace to use.
+#define SEQUENCE_RULE_STORAGE 32
+
+static void apply_SequenceRule(const Chain *chain, Workspace *workspace, const CompiledRule *rule, GlyphArray *glyph_array, size_t *index) {
+  uint16_t glyphCount = rule->inputCount;
+  uint16_t storage[SEQUENCE_RULE_STORAGE];
+  GlyphArray stack_ga, *input_ga;
+  bool use_workspace = workspace != NULL && workspace->depth < WORKSPACE_NESTED_DEPTH;
+  if (use_workspace) {
+    input_ga = &workspace->nested[workspace->depth++];
+    GlyphArray_clear(input_ga);
+  } else {
+    input_ga = &stack_ga;
+    GlyphArray_init_with_storage(input_ga, storage, SEQUENCE_RULE_STORAGE);
+  }
+  // The input keeps its clusters through the nested Lookups, only if asked to
+  bool clusters = glyph_array->clusters != NULL;
+  if (!clusters) {
+    GlyphArray_untrack_clusters(input_ga);
+  }
+
+  if ((!clusters || GlyphArray_track_clusters(input_ga)) &&
+      GlyphArray_append(input_ga, &glyph_array->array[*index], glyphCount)) {
+    if (clusters) {
+      memcpy(input_ga->clusters, &glyph_array->clusters[*index], glyphCount * sizeof(uint32_t));
     }
-    case ClassFormat_2: { // Range of glyphs
-      const ClassDefFormat2 *rangesTable = (ClassDefFormat2 *)classDefTable;
-      uint16_t classRangeCount = parse_16(rangesTable->classRangeCount);
-      if (classRangeCount == 0) break;
-      const ClassRangeRecord *first_range = &(rangesTable->classRangeRecords[0]);
-      if (parse_16(first_range->startGlyphID) > id) break;
-      const ClassRangeRecord *last_range = &(rangesTable->classRangeRecords[classRangeCount - 1]);
-      if (parse_16(last_range->endGlyphID) < id) break;
-
-      // Binary search because we can
-      uint16_t top = classRangeCount - 1;
-      uint16_t bottom = 0;
-      while (top - bottom >= 0) {
-        uint16_t current = (top + bottom) / 2;
-        const ClassRangeRecord *range = &rangesTable->classRangeRecords[current];
-        if (id < parse_16(range->startGlyphID)) {
-          top = current - 1;
-        } else if (id > parse_16(range->endGlyphID)) {
-          bottom = current + 1;
-        } else {
-          if (class != NULL) {
-            *class = parse_16(range->_class);
-          }
-          return true;
-        }
-      }
-      break;
+    const CompiledLookupRecord *records = chain_at(chain, rule->records, CompiledLookupRecord);
+    for (uint16_t i = 0; i < rule->recordCount; i++) {
+      size_t input_index = records[i].sequenceIndex;
+      if (records[i].lookup == 0 || input_index >= input_ga->len) continue;
+      const CompiledLookup *lookup = chain_at(chain, records[i].lookup, CompiledLookup);
+      apply_Lookup_at_index(chain, workspace, lookup, input_ga, &input_index);
     }
-    default:
-      fprintf(stderr, "UNKNOWN class format\n");
-      break;
+    mark_unsafe(glyph_array, *index - rule->backtrackCount, *index + glyphCount + rule->lookaheadCount);
+    GlyphArray_splice_with_clusters(glyph_array, *index, glyphCount, input_ga->array, input_ga->clusters, input_ga->len);
+    *index += input_ga->len - 1; // ++ will be done by apply_Lookup
   }
-  if (class != NULL) {
-    *class = 0;
+
+  if (use_workspace) {
+    workspace->depth--;
+  } else {
+    GlyphArray_free_storage(input_ga);
   }
+}
+
+static bool apply_Noop(const Chain *chain, Workspace *workspace, const CompiledSubtable *subtable, GlyphArray* glyph_array, size_t *index) {
+  (void)chain; (void)workspace; (void)subtable; (void)glyph_array; (void)index;
   return false;
 }
 
-static bool apply_SingleSubstitution(const SingleSubstFormatGeneric *singleSubstFormatGeneric, GlyphArray* glyph_array, size_t index) {
-  const CoverageTable *coverageTable = (CoverageTable *)((uint8_t *)singleSubstFormatGeneric + parse_16(singleSubstFormatGeneric->coverageOffset));
-  switch (parse_16(singleSubstFormatGeneric->substFormat)) {
-    case SingleSubstitutionFormat_1: {
-      const SingleSubstFormat1 *singleSubst = (SingleSubstFormat1 *)singleSubstFormatGeneric;
-      if (find_in_Coverage(coverageTable, glyph_array->array[index], NULL)) {
-        GlyphArray_set1(glyph_array, index, glyph_array->array[index] + parse_16(singleSubst->deltaGlyphID));
-        return true;
-      }
-      break;
-    }
-    case SingleSubstitutionFormat_2: {
-      const SingleSubstFormat2 *singleSubst = (SingleSubstFormat2 *)singleSubstFormatGeneric;
-      uint32_t coverage_index;
-      if (find_in_Coverage(coverageTable, glyph_array->array[index], &coverage_index)) {
-        GlyphArray_set1(glyph_array, index, parse_16(singleSubst->substituteGlyphIDs[coverage_index]));
-        return true;
-      }
-      break;
-    }
-    default:
-      fprintf(stderr, "UNKNOWN SubstFormat %d\n", parse_16(singleSubstFormatGeneric->substFormat));
-      break;
+static bool apply_SingleSubstitution1(const Chain *chain, Workspace *workspace, const CompiledSubtable *subtable, GlyphArray* glyph_array, size_t *index) {
+  (void)workspace;
+  const CompiledSingle1 *singleSubst = (const CompiledSingle1 *)subtable;
+  const CompiledCoverage *coverage = chain_at(chain, singleSubst->coverage, CompiledCoverage);
+  if (find_in_Coverage(coverage, glyph_array->array[*index], NULL)) {
+    GlyphArray_set1(glyph_array, *index, glyph_array->array[*index] + singleSubst->deltaGlyphID);
+    return true;
   }
   return false;
 }
 
-static bool apply_MultipleSubstitution(const MultipleSubstFormat1 *multipleSubstFormat, GlyphArray* glyph_array, size_t *index) {
-  const CoverageTable *coverageTable = (CoverageTable *)((uint8_t *)multipleSubstFormat + parse_16(multipleSubstFormat->coverageOffset));
+static bool apply_SingleSubstitution2(const Chain *chain, Workspace *workspace, const CompiledSubtable *subtable, GlyphArray* glyph_array, size_t *index) {
+  (void)workspace;
+  const CompiledSingle2 *singleSubst = (const CompiledSingle2 *)subtable;
+  const CompiledCoverage *coverage = chain_at(chain, singleSubst->coverage, CompiledCoverage);
   uint32_t coverage_index;
-  bool applicable = find_in_Coverage(coverageTable, glyph_array->array[*index], &coverage_index);
-  if (!applicable || coverage_index >= parse_16(multipleSubstFormat->sequenceCount)) return false;
-
-  const SequenceTable *sequenceTable = (SequenceTable *)((uint8_t *)multipleSubstFormat + parse_16(multipleSubstFormat->sequenceOffsets[coverage_index]));
-  uint16_t glyphCount = parse_16(sequenceTable->glyphCount);
-  GlyphArray_put(glyph_array, *index + glyphCount - 1, glyph_array, *index, glyph_array->len - *index - 1);
-  for (uint16_t j = 0; j < glyphCount; j++) {
-    GlyphArray_set1(glyph_array, *index + j, parse_16(sequenceTable->substituteGlyphIDs[j]));
+  if (find_in_Coverage(coverage, glyph_array->array[*index], &coverage_index) && coverage_index < singleSubst->count) {
+    GlyphArray_set1(glyph_array, *index, singleSubst->substitutes[coverage_index]);
+    return true;
   }
-  *index += glyphCount - 1; // ++ will be done by apply_Lookup
+  return false;
+}
+
+static bool apply_MultipleSubstitution(const Chain *chain, Workspace *workspace, const CompiledSubtable *subtable, GlyphArray* glyph_array, size_t *index) {
+  (void)workspace;
+  const CompiledMultiple *multipleSubst = (const CompiledMultiple *)subtable;
+  const CompiledCoverage *coverage = chain_at(chain, multipleSubst->coverage, CompiledCoverage);
+  uint32_t coverage_index;
+  bool applicable = find_in_Coverage(coverage, glyph_array->array[*index], &coverage_index);
+  if (!applicable || coverage_index >= multipleSubst->sequenceCount) return false;
+
+  const CompiledSequence *sequence = chain_at(chain, multipleSubst->sequences[coverage_index], CompiledSequence);
+  GlyphArray_splice(glyph_array, *index, 1, sequence->glyphs, sequence->count);
+  *index += sequence->count - 1; // ++ will be done by apply_Lookup
   return true;
 }
 
-static const LigatureTable *find_Ligature(const LigatureSetTable *ligatureSet, GlyphArray* glyph_array, size_t index) {
-  uint16_t ligatureCount = parse_16(ligatureSet->ligatureCount);
-  for (uint16_t i = 0; i < ligatureCount; i++) {
-    const LigatureTable *ligature = (LigatureTable *)((uint8_t *)ligatureSet + parse_16(ligatureSet->ligatureOffsets[i]));
-    bool fail = false;
-    uint16_t componentCount = parse_16(ligature->componentCount);
-    if (index + componentCount - 1 > glyph_array->len) continue;
-    for (uint16_t j = 0; j < componentCount - 1; j++) {
-      if (parse_16(ligature->componentGlyphIDs[j]) != glyph_array->array[index+j]) {
-        fail = true;
+// Walks the trie of the LigatureSet from index, and returns the first
+// Ligature of the set that matches, with the number of glyphs it takes.
+static const CompiledLigatureNode *find_Ligature(const CompiledLigatureSet *ligatureSet, const GlyphArray* glyph_array, size_t index, uint16_t *componentCount) {
+  const CompiledLigatureNode *best = NULL;
+  const uint16_t *glyphs = ligature_set_glyphs(ligatureSet);
+  const CompiledLigatureNode *node = &ligatureSet->nodes[0];
+  for (uint16_t depth = 0; ; depth++) {
+    if (node->priority < (best ? best->priority : UINT16_MAX)) {
+      best = node;
+      *componentCount = depth + 1;
+    }
+    // Nothing below can come before what we already have
+    if (best != NULL && node->subtreePriority >= best->priority) break;
+    if (node->childCount == 0 || index + depth >= glyph_array->len) break;
+
+    uint16_t id = glyph_array->array[index + depth];
+    const CompiledLigatureNode *child = NULL;
+    size_t bottom = node->firstChild, top = node->firstChild + node->childCount;
+    while (bottom < top) {
+      size_t current = (top + bottom) / 2;
+      if (id < glyphs[current]) {
+        top = current;
+      } else if (id > glyphs[current]) {
+        bottom = current + 1;
+      } else {
+        child = &ligatureSet->nodes[current];
         break;
       }
     }
-    if (!fail) {
-      return ligature;
-    }
+    if (child == NULL) break;
+    node = child;
   }
-  return NULL;
+  return best;
 }
 
-static bool apply_LigatureSubstitution(const LigatureSubstitutionTable *ligatureSubstitutionTable, GlyphArray* glyph_array, size_t index) {
-  const CoverageTable *coverageTable = (CoverageTable *)((uint8_t *)ligatureSubstitutionTable + parse_16(ligatureSubstitutionTable->coverageOffset));
+static bool apply_LigatureSubstitution(const Chain *chain, Workspace *workspace, const CompiledSubtable *subtable, GlyphArray* glyph_array, size_t *index) {
+  (void)workspace;
+  const CompiledLigatureSubst *ligatureSubst = (const CompiledLigatureSubst *)subtable;
+  const CompiledCoverage *coverage = chain_at(chain, ligatureSubst->coverage, CompiledCoverage);
   uint32_t coverage_index;
-  bool applicable = find_in_Coverage(coverageTable, glyph_array->array[index], &coverage_index);
-  if (!applicable || coverage_index >= parse_16(ligatureSubstitutionTable->ligatureSetCount)) return false;
-  const LigatureSetTable *ligatureSet = (LigatureSetTable *)((uint8_t *)ligatureSubstitutionTable + parse_16(ligatureSubstitutionTable->ligatureSetOffsets[coverage_index]));
-  const LigatureTable *ligature = find_Ligature(ligatureSet, glyph_array, index + 1);
+  bool applicable = find_in_Coverage(coverage, glyph_array->array[*index], &coverage_index);
+  if (!applicable || coverage_index >= ligatureSubst->setCount || ligatureSubst->sets[coverage_index] == 0) return false;
+  const CompiledLigatureSet *ligatureSet = chain_at(chain, ligatureSubst->sets[coverage_index], CompiledLigatureSet);
+  uint16_t componentCount;
+  const CompiledLigatureNode *ligature = find_Ligature(ligatureSet, glyph_array, *index + 1, &componentCount);
   if (ligature != NULL) {
-    GlyphArray_set1(glyph_array, index, parse_16(ligature->ligatureGlyph));
-    uint16_t componentCount = parse_16(ligature->componentCount);
-    GlyphArray_put(glyph_array, index + 1, glyph_array, index + componentCount, glyph_array->len - (index + componentCount));
-    GlyphArray_shrink(glyph_array, componentCount - 1);
+    mark_unsafe(glyph_array, *index, *index + componentCount);
+    GlyphArray_splice(glyph_array, *index, componentCount, &ligature->ligatureGlyph, 1);
     return true;
   }
   return false;
 }
 
-static bool check_with_Sequence(GlyphArray *glyph_array, size_t index, const uint16_t *sequenceRule, uint16_t sequenceSize, int8_t step) {
-  if (sequenceSize == 0) return true;
-  for (uint16_t i = 0; i < sequenceSize; i++) {
-    if (glyph_array->array[index + (i * step)] != parse_16(sequenceRule[i])) {
-      return false;
-    }
-  }
-  return true;
-}
+static bool apply_GlyphContext(const Chain *chain, Workspace *workspace, const CompiledSubtable *subtable, GlyphArray* glyph_array, size_t *index) {
+  const CompiledGlyphContext *context = (const CompiledGlyphContext *)subtable;
+  const CompiledCoverage *coverage = chain_at(chain, context->coverage, CompiledCoverage);
+  uint32_t coverage_index;
+  bool applicable = find_in_Coverage(coverage, glyph_array->array[*index], &coverage_index);
+  if (!applicable || coverage_index >= context->ruleSetCount || context->ruleSets[coverage_index] == 0) return false;
 
-static bool check_with_Coverage(const GlyphArray *glyph_array, size_t index, const uint8_t *coverageTablesBase, const uint16_t *coverageTables, uint16_t coverageSize, int8_t step) {
-  if (coverageSize == 0) return true;
+  const CompiledRuleSet *ruleSet = chain_at(chain, context->ruleSets[coverage_index], CompiledRuleSet);
+  for (uint16_t i = 0; i < ruleSet->count; i++) {
+    const CompiledRule *rule = chain_at(chain, ruleSet->rules[i], CompiledRule);
+    if (!rule_fits(rule, glyph_array, *index)) {
+      continue;
+    }
+    // The input sequence doesn't include the initial glyph.
+    if (!check_with_Sequence(glyph_array, *index + 1, chain_at(chain, rule->input, uint16_t), rule->inputCount - 1, +1)) {
+      continue;
+    }
+    if (!check_with_Sequence(glyph_array, *index - 1, chain_at(chain, rule->backtrack, uint16_t), rule->backtrackCount, -1)) {
+      continue;
+    }
+    if (!check_with_Sequence(glyph_array, *index + rule->inputCount, chain_at(chain, rule->lookahead, uint16_t), rule->lookaheadCount, +1)) {
+      continue;
+    }
 
-  for (uint16_t i = 0; i < coverageSize; i++) {
-    const CoverageTable *coverageTable = (CoverageTable *)(coverageTablesBase + parse_16(coverageTables[i]));
-    if (!find_in_Coverage(coverageTable, glyph_array->array[index + (i * step)], NULL))
-      return false;
+    apply_SequenceRule(chain, workspace, rule, glyph_array, index);
+    // Only use the first one that matches.
+    return true;
   }
-  return true;
+  return false;
 }
 
-static bool check_with_Class(const GlyphArray *glyph_array, size_t index, const ClassDefGeneric *classDef, const uint16_t *sequenceTable, uint16_t sequence_size, int8_t step) {
-  for (uint16_t i = 0; i < sequence_size; i++) {
-    uint16_t glyph = glyph_array->array[index + (i * step)];
-    uint16_t class;
-    find_in_class_array(classDef, glyph, &class);
-    if (class != parse_16(sequenceTable[i])) {
-      return false;
-    }
-  }
-  return true;
-}
+static bool apply_ClassContext(const Chain *chain, Workspace *workspace, const CompiledSubtable *subtable, GlyphArray* glyph_array, size_t *index) {
+  const CompiledClassContext *context = (const CompiledClassContext *)subtable;
+  const CompiledCoverage *coverage = chain_at(chain, context->coverage, CompiledCoverage);
+  if (!find_in_Coverage(coverage, glyph_array->array[*index], NULL))
+    return false;
 
-static void apply_Lookup_at_index(const Chain *chain, const LookupTable *lookupTable, const Bloom* blooms, GlyphArray* glyph_array, size_t *index);
-
-static void apply_SequenceRule(const Chain *chain, uint16_t glyphCount, const SequenceLookupRecord *seqLookupRecords, uint16_t seqLookupCount, GlyphArray *glyph_array, size_t *index) {
-  GlyphArray *input_ga = GlyphArray_new(glyphCount);
-  if (input_ga == NULL)
-    return; // TODO: panic? We could even just have one per chain and reuse it.
-  GlyphArray_append(input_ga, &glyph_array->array[*index], glyphCount);
-  for (uint16_t i = 0; i < seqLookupCount; i++) {
-    const SequenceLookupRecord *sequenceLookupRecord = &seqLookupRecords[i];
-    const LookupTable *lookupTable = get_lookup(chain->lookupList, parse_16(sequenceLookupRecord->lookupListIndex));
-    size_t input_index = parse_16(sequenceLookupRecord->sequenceIndex);
-    apply_Lookup_at_index(chain, lookupTable, NULL, input_ga, &input_index);
-  }
-  GlyphArray_put(glyph_array, *index + input_ga->len, glyph_array, *index + glyphCount, glyph_array->len - (*index + glyphCount));
-  GlyphArray_put(glyph_array, *index, input_ga, 0, input_ga->len);
-  if (input_ga->len < glyphCount) {
-    GlyphArray_shrink(glyph_array, glyphCount - input_ga->len);
+  const CompiledClassDef *inputClassDef = chain_at(chain, context->inputClassDef, CompiledClassDef);
+  uint16_t starting_class = find_in_ClassDef(inputClassDef, glyph_array->array[*index]);
+  if (starting_class >= context->ruleSetCount || context->ruleSets[starting_class] == 0) {
+    return false;
   }
-  *index += input_ga->len - 1; // ++ will be done by apply_Lookup
-  GlyphArray_free(input_ga);
-}
 
-// Returns the bloom digest that matches with the glyphs that "start" a SequenceSubstitution.
-static Bloom get_SequenceSubstitution_bloom(const GenericSequenceContextFormat *genericSequence) {
-  switch (parse_16(genericSequence->format)) {
-    case SequenceContextFormat_1: {
-      const SequenceContextFormat1 *sequenceContext = (SequenceContextFormat1 *)genericSequence;
-      const CoverageTable *coverageTable = (CoverageTable *)((uint8_t *)sequenceContext + parse_16(sequenceContext->coverageOffset));
-      return get_Coverage_bloom(coverageTable);
+  // Nothing changes the glyphs until a rule matches, so the classes
+  // can be shared between all the rules.
+  ClassMemo input_memo, backtrack_memo, lookahead_memo;
+  ClassMemo_init(&input_memo, inputClassDef, *index);
+  ClassMemo_init(&backtrack_memo, chain_at(chain, context->backtrackClassDef, CompiledClassDef), *index);
+  ClassMemo_init(&lookahead_memo, chain_at(chain, context->lookaheadClassDef, CompiledClassDef), *index);
+
+  const CompiledRuleSet *ruleSet = chain_at(chain, context->ruleSets[starting_class], CompiledRuleSet);
+  for (uint16_t i = 0; i < ruleSet->count; i++) {
+    const CompiledRule *rule = chain_at(chain, ruleSet->rules[i], CompiledRule);
+    if (!rule_fits(rule, glyph_array, *index)) {
+      continue;
+    }
+    // The input sequence doesn't include the initial glyph.
+    if (!check_with_Class(glyph_array, *index + 1, &input_memo, chain_at(chain, rule->input, uint16_t), rule->inputCount - 1, +1)) {
+      continue;
     }
-    case SequenceContextFormat_2: {
-      const SequenceContextFormat2 *sequenceContext = (SequenceContextFormat2 *)genericSequence;
-      const CoverageTable *coverageTable = (CoverageTable *)((uint8_t *)sequenceContext + parse_16(sequenceContext->coverageOffset));
-      // TODO: I'm not sure we can do much for ClassSequences
-      return get_Coverage_bloom(coverageTable);
+    if (rule->backtrackCount > 0 &&
+        !check_with_Class(glyph_array, *index - 1, &backtrack_memo, chain_at(chain, rule->backtrack, uint16_t), rule->backtrackCount, -1)) {
+      continue;
     }
-    case SequenceContextFormat_3: {
-      const SequenceContextFormat3 *sequenceContext = (SequenceContextFormat3 *)genericSequence;
-      uint16_t glyphCount = parse_16(sequenceContext->glyphCount);
-      if (glyphCount == 0) return full_bloom;
-      return get_Coverage_array_bloom((uint8_t *)genericSequence, (uint16_t *)((uint8_t *)sequenceContext + sizeof(uint16_t) * 3), glyphCount);
+    if (rule->lookaheadCount > 0 &&
+        !check_with_Class(glyph_array, *index + rule->inputCount, &lookahead_memo, chain_at(chain, rule->lookahead, uint16_t), rule->lookaheadCount, +1)) {
+      continue;
     }
-    default:
-      fprintf(stderr, "UNKNOWN SequenceContextFormat %d\n", parse_16(genericSequence->format));
-      return full_bloom;
+
+    apply_SequenceRule(chain, workspace, rule, glyph_array, index);
+    // Only use the first one that matches.
+    return true;
   }
+  return false;
 }
 
-static bool apply_SequenceSubstitution(const Chain *chain, const GenericSequenceContextFormat *genericSequence, GlyphArray* glyph_array, size_t *index) {
-  switch (parse_16(genericSequence->format)) {
-    case SequenceContextFormat_1: {
-      const SequenceContextFormat1 *sequenceContext = (SequenceContextFormat1 *)genericSequence;
-      const CoverageTable *coverageTable = (CoverageTable *)((uint8_t *)sequenceContext + parse_16(sequenceContext->coverageOffset));
-      uint32_t coverage_index;
-      bool applicable = find_in_Coverage(coverageTable, glyph_array->array[*index], &coverage_index);
-      if (!applicable || coverage_index >= parse_16(sequenceContext->seqRuleSetCount)) return false;
-
-      const SequenceRuleSet *sequenceRuleSet = (SequenceRuleSet *)((uint8_t *)sequenceContext + parse_16(sequenceContext->seqRuleSetOffsets[coverage_index]));
-      uint16_t seqRuleCount = parse_16(sequenceRuleSet->seqRuleCount);
-      for (uint16_t i = 0; i < seqRuleCount; i++) {
-        const SequenceRule *sequenceRule = (SequenceRule *)((uint8_t *)sequenceRuleSet + parse_16(sequenceRuleSet->seqRuleOffsets[i]));
-        uint16_t sequenceGlyphCount = parse_16(sequenceRule->glyphCount);
-
-        if (*index + sequenceGlyphCount > glyph_array->len) {
-          continue;
-        }
-        // The inputSequence doesn't include the initial glyph.
-        if(!check_with_Sequence(glyph_array, *index + 1, (uint16_t *)((uint8_t *)sequenceRule + sizeof(uint16_t) * 2), sequenceGlyphCount - 1, +1)) {
-          continue;
-        }
-        const SequenceLookupRecord *seqLookupRecords = (SequenceLookupRecord *)((uint8_t *)sequenceRule + (1 + sequenceGlyphCount) * sizeof(uint16_t));
-        apply_SequenceRule(chain, sequenceGlyphCount, seqLookupRecords, parse_16(sequenceRule->seqLookupCount), glyph_array, index);
-        return true;
-      }
-      break;
-    }
-    case SequenceContextFormat_2: {
-      const SequenceContextFormat2 *sequenceContext = (SequenceContextFormat2 *)genericSequence;
-      const CoverageTable *coverageTable = (CoverageTable *)((uint8_t *)sequenceContext + parse_16(sequenceContext->coverageOffset));
-      if (!find_in_Coverage(coverageTable, glyph_array->array[*index], NULL))
-        return false;
-
-      const ClassDefGeneric *inputClassDef = (ClassDefGeneric *)((uint8_t *)sequenceContext + parse_16(sequenceContext->classDefOffset));
-
-      uint16_t starting_class;
-      find_in_class_array(inputClassDef, glyph_array->array[*index], &starting_class);
-      if (starting_class >= parse_16(sequenceContext->classSeqRuleSetCount)) {
-        // ??
-        break;
-      }
-      uint16_t starting_class_offset = parse_16(sequenceContext->classSeqRuleSetOffsets[starting_class]);
-      if (starting_class_offset == 0) {
-        break;
-      }
-      const ClassSequenceRuleSet *ruleSet = (ClassSequenceRuleSet *)((uint8_t *)sequenceContext + starting_class_offset);
-      uint16_t classSeqRuleCount = parse_16(ruleSet->classSeqRuleCount);
-      for (uint16_t i = 0; i < classSeqRuleCount; i++) {
-        const ClassSequenceRule *sequenceRule = (ClassSequenceRule *)((uint8_t *)ruleSet + parse_16(ruleSet->classSeqRuleOffsets[i]));
-        uint16_t sequenceGlyphCount = parse_16(sequenceRule->glyphCount);
-
-        if (*index + sequenceGlyphCount > glyph_array->len) {
-          continue;
-        }
-        // The sequenceRule doesn't include the initial glyph.
-        if(!check_with_Class(glyph_array, *index + 1, inputClassDef, (uint16_t *)((uint8_t *)sequenceRule + 2 * sizeof(uint16_t)), sequenceGlyphCount - 1, +1)) {
-          continue;
-        }
-
-        const SequenceLookupRecord *seqLookupRecords = (SequenceLookupRecord *)((uint8_t *)sequenceRule + (1 + sequenceGlyphCount) * sizeof(uint16_t));
-        apply_SequenceRule(chain, sequenceGlyphCount, seqLookupRecords, parse_16(sequenceRule->seqLookupCount), glyph_array, index);
-        // Only use the first one that matches.
-        return true;
-      }
-      break;
-    }
-    case SequenceContextFormat_3: {
-      const SequenceContextFormat3 *sequenceContext = (SequenceContextFormat3 *)genericSequence;
-      uint16_t glyphCount = parse_16(sequenceContext->glyphCount);
+static bool apply_CoverageContext(const Chain *chain, Workspace *workspace, const CompiledSubtable *subtable, GlyphArray* glyph_array, size_t *index) {
+  const CompiledRule *rule = &((const CompiledCoverageContext *)subtable)->rule;
+  // Unlike the other rules, these can have no input, and still need the
+  // context around index to match.
+  if (rule->backtrackCount > *index ||
+      *index + rule->inputCount + rule->lookaheadCount > glyph_array->len) {
+    return false;
+  }
+  if (!check_with_Coverage(chain, glyph_array, *index, chain_at(chain, rule->input, BlobOffset), rule->inputCount, +1)) {
+    return false;
+  }
+  // backtrack is defined with inverse order, so glyph index - 2 will be backtrack coverage index 2
+  if (!check_with_Coverage(chain, glyph_array, *index - 1, chain_at(chain, rule->backtrack, BlobOffset), rule->backtrackCount, -1)) {
+    return false;
+  }
+  if (!check_with_Coverage(chain, glyph_array, *index + rule->inputCount, chain_at(chain, rule->lookahead, BlobOffset), rule->lookaheadCount, +1)) {
+    return false;
+  }
 
-      if (*index + glyphCount > glyph_array->len) {
-        return false;
-      }
-      if (!check_with_Coverage(glyph_array, *index, (uint8_t *)genericSequence, (uint16_t *)((uint8_t *)sequenceContext + sizeof(uint16_t) * 3), glyphCount, +1)) {
-        return false;
-      }
+  if (rule->inputCount == 0) return true;
 
-      const SequenceLookupRecord *seqLookupRecords = (SequenceLookupRecord *)((uint8_t *)sequenceContext + (2 + glyphCount + 1) * sizeof(uint16_t));
-      apply_SequenceRule(chain, glyphCount, seqLookupRecords, parse_16(sequenceContext->seqLookupCount), glyph_array, index);
-      return true;
-    }
-    default:
-      fprintf(stderr, "UNKNOWN SequenceContextFormat %d\n", parse_16(genericSequence->format));
-      break;
-  }
-  return false;
+  apply_SequenceRule(chain, workspace, rule, glyph_array, index);
+  return true;
 }
 
-// Returns the bloom digest that matches with the glyphs that "start" a ChainedSequenceSubstitution.
-static Bloom get_ChainedSequenceSubstitution_bloom(const GenericChainedSequenceContextFormat *genericChainedSequence) {
-  switch (parse_16(genericChainedSequence->format)) {
-    case ChainedSequenceContextFormat_1: {
-      const ChainedSequenceContextFormat1 *chainedSequenceContext = (ChainedSequenceContextFormat1 *)genericChainedSequence;
-      const CoverageTable *coverageTable = (CoverageTable *)((uint8_t *)chainedSequenceContext + parse_16(chainedSequenceContext->coverageOffset));
-      return get_Coverage_bloom(coverageTable);
-    }
-    case ChainedSequenceContextFormat_2: {
-      const ChainedSequenceContextFormat2 *chainedSequenceContext = (ChainedSequenceContextFormat2 *)genericChainedSequence;
-      const CoverageTable *coverageTable = (CoverageTable *)((uint8_t *)chainedSequenceContext + parse_16(chainedSequenceContext->coverageOffset));
-      // TODO: I'm not sure we can do much for ClassSequences
-      return get_Coverage_bloom(coverageTable);
-    }
-    case ChainedSequenceContextFormat_3: {
-      const ChainedSequenceContextFormat3_backtrack *backtrackCoverage = (ChainedSequenceContextFormat3_backtrack *)((uint8_t *)genericChainedSequence + sizeof(uint16_t));
-      uint16_t backtrackGlyphCount = parse_16(backtrackCoverage->backtrackGlyphCount);
-      const ChainedSequenceContextFormat3_input *inputCoverage = (ChainedSequenceContextFormat3_input *)((uint8_t *)backtrackCoverage + sizeof(uint16_t) * (backtrackGlyphCount + 1));
-      uint16_t inputGlyphCount = parse_16(inputCoverage->inputGlyphCount);
+static bool apply_ReverseChainingContextSingle(const Chain *chain, Workspace *workspace, const CompiledSubtable *subtable, GlyphArray* glyph_array, size_t *index) {
+  (void)workspace;
+  const CompiledReverseChain *reverseChain = (const CompiledReverseChain *)subtable;
+  const CompiledCoverage *coverage = chain_at(chain, reverseChain->coverage, CompiledCoverage);
+  uint32_t coverage_index;
+  bool applicable = find_in_Coverage(coverage, glyph_array->array[*index], &coverage_index);
+  if (!applicable) return false;
 
-      if (inputGlyphCount == 0) return full_bloom;
+  if (*index + reverseChain->lookaheadCount >= glyph_array->len) {
+    return false;
+  }
+  if (reverseChain->backtrackCount > *index) {
+    return false;
+  }
+  // backtrack is defined with inverse order, so glyph index - 2 will be backtrack coverage index 2
+  if (!check_with_Coverage(chain, glyph_array, *index - 1, chain_at(chain, reverseChain->backtrack, BlobOffset), reverseChain->backtrackCount, -1)) {
+    return false;
+  }
+  if (!check_with_Coverage(chain, glyph_array, *index + 1, chain_at(chain, reverseChain->lookahead, BlobOffset), reverseChain->lookaheadCount, +1)) {
+    return false;
+  }
 
-      return get_Coverage_array_bloom((uint8_t *)genericChainedSequence, (uint16_t *)((uint8_t *)inputCoverage + sizeof(uint16_t) * 1), inputGlyphCount);
-    }
-    default:
-      fprintf(stderr, "UNKNOWN ChainedSequenceContextFormat %d\n", parse_16(genericChainedSequence->format));
-      return full_bloom;
+  if (coverage_index >= reverseChain->substituteCount) {
+    fprintf(stderr, "Possible mistake in ReverseChainingContextSingleLookupType implementation\n");
+    return false;
   }
+  mark_unsafe(glyph_array, *index - reverseChain->backtrackCount, *index + 1 + reverseChain->lookaheadCount);
+  GlyphArray_set1(glyph_array, *index, reverseChain->substitutes[coverage_index]);
+  return true;
 }
 
-static bool apply_ChainedSequenceSubstitution(const Chain *chain, const GenericChainedSequenceContextFormat *genericChainedSequence, GlyphArray* glyph_array, size_t *index) {
-  switch (parse_16(genericChainedSequence->format)) {
-    case ChainedSequenceContextFormat_1: {
-      const ChainedSequenceContextFormat1 *chainedSequenceContext = (ChainedSequenceContextFormat1 *)genericChainedSequence;
-      const CoverageTable *coverageTable = (CoverageTable *)((uint8_t *)chainedSequenceContext + parse_16(chainedSequenceContext->coverageOffset));
-      uint32_t coverage_index;
-      bool applicable = find_in_Coverage(coverageTable, glyph_array->array[*index], &coverage_index);
-      if (!applicable || coverage_index >= parse_16(chainedSequenceContext->chainedSeqRuleSetCount)) return false;
-
-      const ChainedSequenceRuleSet *chainedSequenceRuleSet = (ChainedSequenceRuleSet *)((uint8_t *)chainedSequenceContext + parse_16(chainedSequenceContext->chainedSeqRuleSetOffsets[coverage_index]));
-      uint16_t chainedSeqRuleCount = parse_16(chainedSequenceRuleSet->chainedSeqRuleCount);
-      for (uint16_t i = 0; i < chainedSeqRuleCount; i++) {
-        const ChainedSequenceRule *chainedSequenceRule = (ChainedSequenceRule *)((uint8_t *)chainedSequenceRuleSet + parse_16(chainedSequenceRuleSet->chainedSeqRuleOffsets[i]));
-        const ChainedSequenceRule_backtrack *backtrackSequenceRule = (ChainedSequenceRule_backtrack *)chainedSequenceRule;
-        uint16_t backtrackGlyphCount = parse_16(backtrackSequenceRule->backtrackGlyphCount);
-        const ChainedSequenceRule_input *inputSequenceRule = (ChainedSequenceRule_input *)((uint8_t *)backtrackSequenceRule + sizeof(uint16_t) * (backtrackGlyphCount + 1));
-        uint16_t inputGlyphCount = parse_16(inputSequenceRule->inputGlyphCount);
-        // inputGlyphCount includes the initial one, that's not present in the array, so no need to +1 here
-        const ChainedSequenceRule_lookahead *lookaheadSequenceRule = (ChainedSequenceRule_lookahead *)((uint8_t *)inputSequenceRule + sizeof(uint16_t) * (inputGlyphCount));
-        uint16_t lookaheadGlyphCount = parse_16(lookaheadSequenceRule->lookaheadGlyphCount);
-        const ChainedSequenceRule_seq *sequenceRule = (ChainedSequenceRule_seq *)((uint8_t *)lookaheadSequenceRule + sizeof(uint16_t) * (lookaheadGlyphCount + 1));
-        uint16_t seqLookupCount = parse_16(sequenceRule->seqLookupCount);
-
-        if (*index + inputGlyphCount + lookaheadGlyphCount > glyph_array->len) {
-          continue;
-        }
-        if (backtrackGlyphCount > *index) {
-          continue;
-        }
-        // The inputSequence doesn't include the initial glyph.
-        if(!check_with_Sequence(glyph_array, *index + 1, (uint16_t *)((uint8_t *)inputSequenceRule + sizeof(uint16_t) * 1), inputGlyphCount - 1, +1)) {
-          continue;
-        }
-        if(!check_with_Sequence(glyph_array, *index - 1, (uint16_t *)((uint8_t *)backtrackSequenceRule + sizeof(uint16_t) * 1), backtrackGlyphCount, -1)) {
-          continue;
-        }
-        if(!check_with_Sequence(glyph_array, *index + inputGlyphCount, (uint16_t *)((uint8_t *)lookaheadSequenceRule + sizeof(uint16_t) * 1), lookaheadGlyphCount, +1)) {
-          continue;
-        }
-
-        apply_SequenceRule(chain, inputGlyphCount, sequenceRule->seqLookupRecords, seqLookupCount, glyph_array, index);
-        return true;
-      }
-      break;
-    }
-    case ChainedSequenceContextFormat_2: {
-      const ChainedSequenceContextFormat2 *chainedSequenceContext = (ChainedSequenceContextFormat2 *)genericChainedSequence;
-      const CoverageTable *coverageTable = (CoverageTable *)((uint8_t *)chainedSequenceContext + parse_16(chainedSequenceContext->coverageOffset));
-      bool applicable = find_in_Coverage(coverageTable, glyph_array->array[*index], NULL);
-      if (!applicable) return false;
+static bool apply_GlyphMap(const Chain *chain, Workspace *workspace, const CompiledSubtable *subtable, GlyphArray* glyph_array, size_t *index) {
+  (void)chain; (void)workspace;
+  const CompiledGlyphMap *map = (const CompiledGlyphMap *)subtable;
+  uint32_t i = (uint32_t)glyph_array->array[*index] - map->first;
+  if (glyph_array->array[*index] < map->first || i >= map->count) return false;
+  GlyphArray_set1(glyph_array, *index, map->glyphs[i]);
+  return true;
+}
 
-      const ClassDefGeneric *inputClassDef = (ClassDefGeneric *)((uint8_t *)chainedSequenceContext + parse_16(chainedSequenceContext->inputClassDefOffset));
-      const ClassDefGeneric *backtrackClassDef = (ClassDefGeneric *)((uint8_t *)chainedSequenceContext + parse_16(chainedSequenceContext->backtrackClassDefOffset));
-      const ClassDefGeneric *lookaheadClassDef = (ClassDefGeneric *)((uint8_t *)chainedSequenceContext + parse_16(chainedSequenceContext->lookaheadClassDefOffset));
+// Applies the GlyphMap to all the glyphs at once.
+static void apply_GlyphMap_to_all(const CompiledGlyphMap *map, GlyphArray* glyph_array) {
+  const uint16_t *glyphs = map->glyphs;
+  uint16_t first = map->first;
+  uint32_t count = map->count;
+  // Don't touch the glyphs unless something changes: glyphs in range can
+  // be mapped to themselves too.
+  size_t start = 0;
+  for (; start < glyph_array->len; start++) {
+    uint32_t j = (uint16_t)(glyph_array->array[start] - first);
+    if (j < count && glyphs[j] != glyph_array->array[start]) break;
+  }
+  if (start == glyph_array->len) return;
+
+  if (!GlyphArray_make_writable(glyph_array)) return;
+  uint16_t *array = glyph_array->array;
+  for (size_t i = start; i < glyph_array->len; i++) {
+    // Glyphs before first wrap around, and end up out of range too
+    uint32_t j = (uint16_t)(array[i] - first);
+    array[i] = j < count ? glyphs[j] : array[i];
+  }
+}
 
-      uint16_t starting_class;
-      find_in_class_array(inputClassDef, glyph_array->array[*index], &starting_class);
+typedef bool (*SubtableApplier)(const Chain *chain, Workspace *workspace, const CompiledSubtable *subtable, GlyphArray* glyph_array, size_t *index);
+
+// The function to use for each compiled Substitution table is decided by its kind.
+static const SubtableApplier subtable_appliers[SubtableKindCount] = {
+  [NoopSubtable] = apply_Noop,
+  [Single1Subtable] = apply_SingleSubstitution1,
+  [Single2Subtable] = apply_SingleSubstitution2,
+  [MultipleSubtable] = apply_MultipleSubstitution,
+  [LigatureSubtable] = apply_LigatureSubstitution,
+  [GlyphContextSubtable] = apply_GlyphContext,
+  [ClassContextSubtable] = apply_ClassContext,
+  [CoverageContextSubtable] = apply_CoverageContext,
+  [ReverseChainSubtable] = apply_ReverseChainingContextSingle,
+  [GlyphMapSubtable] = apply_GlyphMap,
+};
+
+static bool apply_Lookup_at_index(const Chain *chain, Workspace *workspace, const CompiledLookup *lookup, GlyphArray* glyph_array, size_t *index) {
+  uint16_t glyphID = glyph_array->array[*index];
+  Bloom glyphID_bloom = get_glyphID_bloom(glyphID);
 
-      if (starting_class >= parse_16(chainedSequenceContext->chainedClassSeqRuleSetCount)) {
-        // ??
-        break;
-      }
-      uint16_t starting_class_offset = parse_16(chainedSequenceContext->chainedClassSeqRuleSetOffsets[starting_class]);
-      if (starting_class_offset == 0) {
-        break;
-      }
-      const ChainedClassSequenceRuleSet *chainedRuleSet = (ChainedClassSequenceRuleSet *)((uint8_t *)chainedSequenceContext + starting_class_offset);
-      uint16_t chainedClassSeqRuleCount = parse_16(chainedRuleSet->chainedClassSeqRuleCount);
-      for (uint16_t i = 0; i < chainedClassSeqRuleCount; i++) {
-        const ChainedClassSequenceRule *chainedClassSequenceRule = (ChainedClassSequenceRule *)((uint8_t *)chainedRuleSet + parse_16(chainedRuleSet->chainedClassSeqRuleOffsets[i]));
-        const ChainedClassSequenceRule_backtrack *backtrackSequenceRule = (ChainedClassSequenceRule_backtrack *)chainedClassSequenceRule;
-        uint16_t backtrackGlyphCount = parse_16(backtrackSequenceRule->backtrackGlyphCount);
-        const ChainedClassSequenceRule_input *inputSequenceRule = (ChainedClassSequenceRule_input *)((uint8_t *)backtrackSequenceRule + sizeof(uint16_t) * (backtrackGlyphCount + 1));
-        uint16_t inputGlyphCount = parse_16(inputSequenceRule->inputGlyphCount);
-        const ChainedClassSequenceRule_lookahead *lookaheadSequenceRule = (ChainedClassSequenceRule_lookahead *)((uint8_t *)inputSequenceRule + sizeof(uint16_t) * (inputGlyphCount)); // inputGlyphCount includes the initial one, that's not present in the array
-        uint16_t lookaheadGlyphCount = parse_16(lookaheadSequenceRule->lookaheadGlyphCount);
-        const ChainedClassSequenceRule_seq *sequenceRule = (ChainedClassSequenceRule_seq *)((uint8_t *)lookaheadSequenceRule + sizeof(uint16_t) * (lookaheadGlyphCount + 1));
-        uint16_t seqLookupCount = parse_16(sequenceRule->seqLookupCount);
-
-        if (*index + inputGlyphCount + lookaheadGlyphCount > glyph_array->len) {
-          continue;
-        }
-        if (backtrackGlyphCount > *index) {
-          continue;
-        }
-        // The inputSequence doesn't include the initial glyph.
-        if(!check_with_Class(glyph_array, *index + 1, inputClassDef, (uint16_t *)((uint8_t *)inputSequenceRule + sizeof(uint16_t) * 1), inputGlyphCount - 1, +1)) {
-          continue;
-        }
-        if(!check_with_Class(glyph_array, *index - 1, backtrackClassDef, (uint16_t *)((uint8_t *)backtrackSequenceRule + sizeof(uint16_t) * 1), backtrackGlyphCount, -1)) {
-          continue;
-        }
-        if(!check_with_Class(glyph_array, *index + inputGlyphCount, lookaheadClassDef, (uint16_t *)((uint8_t *)lookaheadSequenceRule + sizeof(uint16_t) * 1), lookaheadGlyphCount, +1)) {
-          continue;
-        }
-
-        apply_SequenceRule(chain, inputGlyphCount, sequenceRule->seqLookupRecords, seqLookupCount, glyph_array, index);
-        // Only use the first one that matches.
-        return true;
-      }
-      break;
+  // Stop at the first Substitution that's successfully applied, and return
+  // whether there was one.
+  for (uint16_t i = 0; i < lookup->subtableCount; i++) {
+    const CompiledSubtable *subtable = chain_at(chain, lookup->subtables[i], CompiledSubtable);
+    // If the glyph doesn't match the bloom digest for the Substitution, skip it.
+    if (!glyphID_bloom_compare_bloom(glyphID_bloom, subtable->bloom)) {
+      continue;
     }
-    case ChainedSequenceContextFormat_3: {
-      const ChainedSequenceContextFormat3_backtrack *backtrackCoverage = (ChainedSequenceContextFormat3_backtrack *)((uint8_t *)genericChainedSequence + sizeof(uint16_t));
-      uint16_t backtrackGlyphCount = parse_16(backtrackCoverage->backtrackGlyphCount);
-      const ChainedSequenceContextFormat3_input *inputCoverage = (ChainedSequenceContextFormat3_input *)((uint8_t *)backtrackCoverage + sizeof(uint16_t) * (backtrackGlyphCount + 1));
-      uint16_t inputGlyphCount = parse_16(inputCoverage->inputGlyphCount);
-      const ChainedSequenceContextFormat3_lookahead *lookaheadCoverage = (ChainedSequenceContextFormat3_lookahead *)((uint8_t *)inputCoverage + sizeof(uint16_t) * (inputGlyphCount + 1));
-      uint16_t lookaheadGlyphCount = parse_16(lookaheadCoverage->lookaheadGlyphCount);
-      const ChainedSequenceContextFormat3_seq *seqCoverage = (ChainedSequenceContextFormat3_seq *)((uint8_t *)lookaheadCoverage + sizeof(uint16_t) * (lookaheadGlyphCount + 1));
-      uint16_t seqLookupCount = parse_16(seqCoverage->seqLookupCount);
-
-      if (*index + inputGlyphCount + lookaheadGlyphCount > glyph_array->len) {
-        return false;
-      }
-      if (backtrackGlyphCount > *index) {
-        return false;
-      }
-      if (!check_with_Coverage(glyph_array, *index, (uint8_t *)genericChainedSequence, (uint16_t *)((uint8_t *)inputCoverage + sizeof(uint16_t) * 1), inputGlyphCount, +1)) {
-        return false;
-      }
-      // backtrack is defined with inverse order, so glyph index - 2 will be backtrack coverage index 2
-      if (!check_with_Coverage(glyph_array, *index - 1, (uint8_t *)genericChainedSequence, (uint16_t *)((uint8_t *)backtrackCoverage + sizeof(uint16_t) * 1), backtrackGlyphCount, -1)) {
-        return false;
-      }
-      if (!check_with_Coverage(glyph_array, *index + inputGlyphCount, (uint8_t *)genericChainedSequence, (uint16_t *)((uint8_t *)lookaheadCoverage + sizeof(uint16_t) * 1), lookaheadGlyphCount, +1)) {
-        return false;
-      }
-
-      if (inputGlyphCount == 0) return true;
-
-      apply_SequenceRule(chain, inputGlyphCount, seqCoverage->seqLookupRecords, seqLookupCount, glyph_array, index);
+    if (subtable_appliers[subtable->kind](chain, workspace, subtable, glyph_array, index)) {
       return true;
     }
-    default:
-      fprintf(stderr, "UNKNOWN ChainedSequenceContextFormat %d\n", parse_16(genericChainedSequence->format));
-      break;
   }
   return false;
 }
 
+// Whether the glyph can "start" one of the Substitutions of the Lookup.
+static inline bool may_start_Lookup(const Chain *chain, const CompiledLookup *lookup, uint16_t glyphID) {
+  if (lookup->filter == 0) return glyphID_compare_bloom(glyphID, lookup->bloom);
+  return CompiledGlyphSet_has(chain_at(chain, lookup->filter, CompiledGlyphSet), glyphID);
+}
 
-static bool apply_ReverseChainingContextSingleLookupType(const ReverseChainSingleSubstFormat1 *reverseChain, GlyphArray* glyph_array, size_t index) {
-  CoverageTable *coverageTable = (CoverageTable *)((uint8_t *)reverseChain + parse_16(reverseChain->coverageOffset));
-  switch (parse_16(reverseChain->substFormat)) {
-    case ReverseChainSingleSubstFormat_1: {
-      uint32_t coverage_index;
-      bool applicable = find_in_Coverage(coverageTable, glyph_array->array[index], &coverage_index);
-      if (!applicable) return false;
-
-      const ReverseChainSingleSubstFormat1_backtrack *backtrackCoverage = (ReverseChainSingleSubstFormat1_backtrack *)((uint8_t *)reverseChain + sizeof(uint16_t) * 2);
-      uint16_t backtrackGlyphCount = parse_16(backtrackCoverage->backtrackGlyphCount);
-      const ReverseChainSingleSubstFormat1_lookahead *lookaheadCoverage = (ReverseChainSingleSubstFormat1_lookahead *)((uint8_t *)backtrackCoverage + sizeof(uint16_t) * (backtrackGlyphCount + 1));
-      uint16_t lookaheadGlyphCount = parse_16(lookaheadCoverage->lookaheadGlyphCount);
-      const ReverseChainSingleSubstFormat1_sub *substitutionTable = (ReverseChainSingleSubstFormat1_sub *)((uint8_t *)lookaheadCoverage + sizeof(uint16_t) * (lookaheadGlyphCount + 1));
-
-      if (index + lookaheadGlyphCount >= glyph_array->len) {
-        return false;
-      }
-      if (backtrackGlyphCount > index) {
-        return false;
-      }
-      // backtrack is defined with inverse order, so glyph index - 2 will be backtrack coverage index 2
-      if (!check_with_Coverage(glyph_array, index - 1, (uint8_t *)reverseChain, (uint16_t *)((uint8_t *)backtrackCoverage + sizeof(uint16_t) * 1), backtrackGlyphCount, -1)) {
-        return false;
-      }
-      if (!check_with_Coverage(glyph_array, index + 1, (uint8_t *)reverseChain, (uint16_t *)((uint8_t *)lookaheadCoverage + sizeof(uint16_t) * 1), lookaheadGlyphCount, +1)) {
-        return false;
-      }
+static void apply_Lookup(const Chain *chain, Workspace *workspace, const CompiledLookup *lookup, GlyphArray* glyph_array) {
+  // If no glyph in the input matches any of the Substitutions, skip the Lookup.
+  Bloom ga_bloom = GlyphArray_get_bloom(glyph_array);
+  if (!bloom_compare_bloom(ga_bloom, lookup->bloom)) {
+    return;
+  }
 
-      if (coverage_index > parse_16(substitutionTable->glyphCount)) {
-        fprintf(stderr, "Possible mistake in ReverseChainingContextSingleLookupType implementation\n");
-        return false;
-      }
-      GlyphArray_set1(glyph_array, index, parse_16(substitutionTable->substituteGlyphIDs[coverage_index]));
-      return true;
+  // Fused SingleSubstitutions don't need to go glyph by glyph.
+  if (lookup->subtableCount == 1) {
+    const CompiledSubtable *subtable = chain_at(chain, lookup->subtables[0], CompiledSubtable);
+    if (subtable->kind == GlyphMapSubtable) {
+      apply_GlyphMap_to_all((const CompiledGlyphMap *)subtable, glyph_array);
+      return;
     }
-    default:
-      fprintf(stderr, "UNKNOWN ReverseChainSingleSubstFormat %d\n", parse_16(reverseChain->substFormat));
-      break;
   }
-  return false;
-}
 
-static bool apply_Substitution(const Chain *chain, GlyphArray* glyph_array, const GenericSubstTable *genericSubstTable, uint16_t lookupType, size_t *index) {
-  switch (lookupType) {
-    case SingleLookupType: {
-      const SingleSubstFormatGeneric *singleSubstFormatGeneric = (SingleSubstFormatGeneric *)genericSubstTable;
-      return apply_SingleSubstitution(singleSubstFormatGeneric, glyph_array, *index);
-    }
-    case MultipleLookupType: {
-      const MultipleSubstFormat1 *multipleSubstFormat = (MultipleSubstFormat1 *)genericSubstTable;
-      // Stop at the first one we apply
-      return apply_MultipleSubstitution(multipleSubstFormat, glyph_array, index);
-    }
-    case AlternateLookupType: // TODO: just filter those out at chain creation time...
-      // We don't really need to support it.
-      // Most use-cases revolve around user selection from the list of alternates,
-      // which we don't... really care about.
-      // Maybe we could think about enabling this for some weird features like 'rand'.
-      fprintf(stderr, "AlternateLookupType unsupported\n");
-      return false;
-    case LigatureLookupType: {
-      const LigatureSubstitutionTable *ligatureSubstitutionTable = (LigatureSubstitutionTable *)genericSubstTable;
-      // Stop at the first one we apply
-      return apply_LigatureSubstitution(ligatureSubstitutionTable, glyph_array, *index);
-    }
-    case ContextLookupType: {
-      const GenericSequenceContextFormat *genericSequence = (GenericSequenceContextFormat *)genericSubstTable;
-      return apply_SequenceSubstitution(chain, genericSequence, glyph_array, index);
-    }
-    case ChainingLookupType: {
-      const GenericChainedSequenceContextFormat *genericChainedSequence = (GenericChainedSequenceContextFormat *)genericSubstTable;
-      return apply_ChainedSequenceSubstitution(chain, genericChainedSequence, glyph_array, index);
-    }
-    case ExtensionSubstitutionLookupType: {
-      const ExtensionSubstitutionTable *extensionSubstitutionTable = (ExtensionSubstitutionTable *)genericSubstTable;
-      const GenericSubstTable *_genericSubstTable = (GenericSubstTable *)((uint8_t *)extensionSubstitutionTable + parse_32(extensionSubstitutionTable->extensionOffset));
-      return apply_Substitution(chain, glyph_array, _genericSubstTable, parse_16(extensionSubstitutionTable->extensionLookupType), index);
-    }
-    case ReverseChainingContextSingleLookupType: {
-      const ReverseChainSingleSubstFormat1 *reverseChain = (ReverseChainSingleSubstFormat1 *)genericSubstTable;
-      // Stop at the first one we apply
-      return apply_ReverseChainingContextSingleLookupType(reverseChain, glyph_array, *index);
+  // ReverseChaining needs to be applied in reverse order.
+  // It doesn't change the number of glyphs, so we can just do --.
+  if (lookup->lookupType == ReverseChainingContextSingleLookupType) {
+    for (size_t index = glyph_array->len; index-- > 0;) {
+      size_t reverse_index = index;
+      if (may_start_Lookup(chain, lookup, glyph_array->array[index])) {
+        apply_Lookup_at_index(chain, workspace, lookup, glyph_array, &reverse_index);
+      }
     }
-    default:
-      fprintf(stderr, "UNKNOWN LookupType\n");
-      return false;
+    return;
   }
-}
 
-// Returns the bloom digest that matches with the glyphs that "start" a Substitution table.
-static Bloom get_Substitution_bloom(const GenericSubstTable *genericSubstTable, uint16_t lookupType) {
-  switch (lookupType) {
-    case SingleLookupType: {
-      const SingleSubstFormatGeneric *singleSubstFormatGeneric = (SingleSubstFormatGeneric *)genericSubstTable;
-      const CoverageTable *coverageTable = (CoverageTable *)((uint8_t *)singleSubstFormatGeneric + parse_16(singleSubstFormatGeneric->coverageOffset));
-      return get_Coverage_bloom(coverageTable);
-    }
-    case MultipleLookupType: {
-      const MultipleSubstFormat1 *multipleSubstFormat = (MultipleSubstFormat1 *)genericSubstTable;
-      const CoverageTable *coverageTable = (CoverageTable *)((uint8_t *)multipleSubstFormat + parse_16(multipleSubstFormat->coverageOffset));
-      return get_Coverage_bloom(coverageTable);
-    }
-    case AlternateLookupType:
-      // No need to make it go through, as we don't support it
-      return null_bloom;
-    case LigatureLookupType: {
-      const LigatureSubstitutionTable *ligatureSubstitutionTable = (LigatureSubstitutionTable *)genericSubstTable;
-      const CoverageTable *coverageTable = (CoverageTable *)((uint8_t *)ligatureSubstitutionTable + parse_16(ligatureSubstitutionTable->coverageOffset));
-      return get_Coverage_bloom(coverageTable);
-    }
-    case ContextLookupType: {
-      const GenericSequenceContextFormat *genericSequence = (GenericSequenceContextFormat *)genericSubstTable;
-      return get_SequenceSubstitution_bloom(genericSequence);
-    }
-    case ChainingLookupType: {
-      const GenericChainedSequenceContextFormat *genericChainedSequence = (GenericChainedSequenceContextFormat *)genericSubstTable;
-      return get_ChainedSequenceSubstitution_bloom(genericChainedSequence);
-    }
-    case ExtensionSubstitutionLookupType: {
-      const ExtensionSubstitutionTable *extensionSubstitutionTable = (ExtensionSubstitutionTable *)genericSubstTable;
-      const GenericSubstTable *_genericSubstTable = (GenericSubstTable *)((uint8_t *)extensionSubstitutionTable + parse_32(extensionSubstitutionTable->extensionOffset));
-      return get_Substitution_bloom(_genericSubstTable, parse_16(extensionSubstitutionTable->extensionLookupType));
-    }
-    case ReverseChainingContextSingleLookupType: {
-      const ReverseChainSingleSubstFormat1 *reverseChain = (ReverseChainSingleSubstFormat1 *)genericSubstTable;
-      const CoverageTable *coverageTable = (CoverageTable *)((uint8_t *)reverseChain + parse_16(reverseChain->coverageOffset));
-      return get_Coverage_bloom(coverageTable);
+  // Only visit the glyphs that may start the Lookup, finding them a block at
+  // a time. A Substitution can change any glyph from where it applied on, so
+  // the block starts again after it.
+  const CompiledGlyphSet *filter = NULL;
+  if (lookup->filter != 0) filter = chain_at(chain, lookup->filter, CompiledGlyphSet);
+  size_t index = 0;
+  while (index < glyph_array->len) {
+    size_t block = index;
+    uint64_t candidates = get_candidates(lookup->bloom, filter, &glyph_array->array[block], glyph_array->len - block);
+    index = block + CANDIDATES_BLOCK;
+    while (candidates != 0) {
+      size_t i = block + ctz_64(candidates);
+      candidates &= candidates - 1;
+      if (apply_Lookup_at_index(chain, workspace, lookup, glyph_array, &i)) {
+        index = i + 1;
+        break;
+      }
     }
-    default:
-      fprintf(stderr, "UNKNOWN LookupType\n");
-      return full_bloom;
   }
 }
 
-// Returns the bloom digest that matches with the glyphs that "start" any of the
-// Substitution tables of the Lookup.
-static Bloom get_cached_Lookup_bloom(const Chain *chain, const LookupTable *lookupTable, uint16_t lookupType) {
-  Bloom lookup_bloom = null_bloom;
-  if (!get_from_Bloom_hash(chain->bloom_hash, lookupTable, &lookup_bloom)) {
-    uint16_t subTableCount = parse_16(lookupTable->subTableCount);
-    for (uint16_t i = 0; i < subTableCount; i++) {
-      const GenericSubstTable *genericSubstTable = (GenericSubstTable *)((uint8_t *)lookupTable + parse_16(lookupTable->subtableOffsets[i]));
-      Bloom _bloom = null_bloom;
-      if (!get_from_Bloom_hash(chain->bloom_hash, genericSubstTable, &_bloom)) {
-        _bloom = get_Substitution_bloom(genericSubstTable, lookupType);
-        set_to_Bloom_hash(chain->bloom_hash, genericSubstTable, _bloom);
-      }
-      lookup_bloom = add_bloom_to_bloom(lookup_bloom, _bloom);
-      if (is_full_bloom(lookup_bloom)) break;
+static void apply_Lookups(const Chain *chain, Workspace *workspace, GlyphArray* glyph_array) {
+  // The same chain, reading from the fused Lookups
+  Chain fused_chain = *chain;
+  fused_chain.compiled = chain->fused.data;
+  for (size_t i = 0; i < chain->lookupCount; i++) {
+    if (chain->fusedArray[i] != 0) {
+      apply_Lookup(&fused_chain, workspace, chain_at(&fused_chain, chain->fusedArray[i], CompiledLookup), glyph_array);
     }
-    set_to_Bloom_hash(chain->bloom_hash, lookupTable, lookup_bloom);
+    if (chain->lookupsArray[i] == 0) continue;
+    apply_Lookup(chain, workspace, chain_at(chain, chain->lookupsArray[i], CompiledLookup), glyph_array);
   }
-  return lookup_bloom;
 }
 
-// Returns the bloom digests for all the Substitution tables of the Lookup.
-static Bloom *get_cached_Substitution_blooms_for_Lookup(const Chain *chain, const LookupTable *lookupTable, uint16_t lookupType) {
-  Bloom* sub_blooms = NULL;
-  if (!get_from_uintptr_t_hash(chain->ptr_hash, lookupTable, (uintptr_t*)&sub_blooms)){
-    uint16_t subTableCount = parse_16(lookupTable->subTableCount);
-    sub_blooms = malloc(subTableCount * sizeof(Bloom));
-    if (sub_blooms == NULL) return NULL; // TODO: panic?
-
-    for (uint16_t i = 0; i < subTableCount; i++) {
-      const GenericSubstTable *genericSubstTable = (GenericSubstTable *)((uint8_t *)lookupTable + parse_16(lookupTable->subtableOffsets[i]));
-      Bloom _bloom = null_bloom;
-      if (!get_from_Bloom_hash(chain->bloom_hash, genericSubstTable, &_bloom)) {
-        _bloom = get_Substitution_bloom(genericSubstTable, lookupType);
-        set_to_Bloom_hash(chain->bloom_hash, genericSubstTable, _bloom);
-      }
-      sub_blooms[i] = _bloom;
-    }
-    set_to_uintptr_t_hash(chain->ptr_hash, lookupTable, (uintptr_t)sub_blooms);
+#define is_touched(chain, id) ((chain)->touched != NULL && ((chain)->touched[(id) / 64] >> ((id) % 64)) & 1)
+
+size_t find_safe_break(const Chain *chain, const uint16_t *glyphs, size_t from, size_t len) {
+  if (from == 0) from = 1;
+  if (from >= len) return len;
+  // Lookups that only look at one glyph at a time can be split anywhere
+  if (chain->reach.length <= 1) return from;
+  // No match can include a glyph that isn't touched, so nothing crosses it
+  for (size_t i = from; i < len; i++) {
+    if (!is_touched(chain, glyphs[i - 1]) || !is_touched(chain, glyphs[i])) return i;
   }
-  return sub_blooms;
+  return len;
 }
 
-static void apply_Lookup_at_index(const Chain *chain, const LookupTable *lookupTable, const Bloom* blooms, GlyphArray* glyph_array, size_t *index) {
-  uint16_t lookupType = parse_16(lookupTable->lookupType);
-  uint16_t glyphID = glyph_array->array[*index];
-  Bloom glyphID_bloom = get_glyphID_bloom(glyphID);
+size_t find_segment_end(const Chain *chain, const uint16_t *glyphs, size_t start, size_t len, size_t *touched_end) {
+  size_t i = start;
+  while (i < len && is_touched(chain, glyphs[i])) i++;
+  if (touched_end != NULL) *touched_end = i;
+  while (i < len && !is_touched(chain, glyphs[i])) i++;
+  return i;
+}
 
-  // Obtain the bloom digests of the Substitution tables of the Lookup.
-  // We get NULL here when we come from apply_SequenceRule.
-  if (blooms == NULL) {
-    blooms = get_cached_Substitution_blooms_for_Lookup(chain, lookupTable, lookupType);
+// Most segments are words, which fit on the stack.
+#define CACHE_KEY_STORAGE 256
+
+// Applies the chain to the glyphs in [start, end), which no match can cross,
+// using the cached result if there's one.
+// Returns how many glyphs they became.
+static size_t apply_cached_Segment(const Chain *chain, ResultCache *cache, Workspace *workspace, GlyphArray *glyph_array, size_t start, size_t end) {
+  size_t len = end - start;
+  uint16_t storage[CACHE_KEY_STORAGE];
+  GlyphArray segment;
+  GlyphArray_init_with_storage(&segment, storage, CACHE_KEY_STORAGE);
+  // Without memory for a copy, the segment is left as it is
+  if (len == 0 || !GlyphArray_append(&segment, &glyph_array->array[start], len)) return len;
+  segment.modified = false;
+
+  // The input stays in glyph_array until the result is put back
+  const uint16_t *input = &glyph_array->array[start];
+  bool cacheable = ResultCache_fits(cache, len);
+  uint64_t hash = cacheable ? hash_glyphs(input, len) : 0;
+  if (!cacheable || !ResultCache_get(cache, hash, &segment)) {
+    apply_Lookups(chain, workspace, &segment);
+    if (cacheable) ResultCache_put(cache, hash, input, len, &segment);
   }
 
-  // Stop at the first Substitution that's successfully applied.
-  uint16_t subTableCount = parse_16(lookupTable->subTableCount);
-  for (uint16_t i = 0; i < subTableCount; i++) {
-    const GenericSubstTable *genericSubstTable = (GenericSubstTable *)((uint8_t *)lookupTable + parse_16(lookupTable->subtableOffsets[i]));
-    if (blooms != NULL) {
-      // If the glyph doesn't match the bloom digest for the Substitution, skip it.
-      if (!glyphID_bloom_compare_bloom(glyphID_bloom, blooms[i])) {
-        continue;
-      }
-    }
-    if (apply_Substitution(chain, glyph_array, genericSubstTable, lookupType, index)) {
-      break;
-    }
+  size_t result = segment.len;
+  if (segment.modified && !GlyphArray_splice(glyph_array, start, len, segment.array, segment.len)) {
+    result = len;
   }
+  GlyphArray_free_storage(&segment);
+  return result;
 }
 
-static void apply_Lookup(const Chain *chain, const LookupTable *lookupTable, GlyphArray* glyph_array) {
-  size_t index = 0, reverse_index = glyph_array->len - 1, *index_ptr = &index;
-  uint16_t lookupType = parse_16(lookupTable->lookupType);
-  // ReverseChaining needs to be applied in reverse order.
-  if (lookupType == ReverseChainingContextSingleLookupType)
-    index_ptr = &reverse_index;
+size_t find_first_trigger(const Chain *chain, const uint16_t *glyphs, size_t len) {
+  if (chain->triggers == NULL) return len;
+  return GlyphSet_find(chain->triggers, glyphs, len);
+}
 
-  // Get bloom for the whole lookup.
-  Bloom lookup_bloom = get_cached_Lookup_bloom(chain, lookupTable, lookupType);
+void apply_chain(const Chain *chain, Workspace *workspace, GlyphArray* glyph_array) {
+  // Most runs have nothing to change
+  if (find_first_trigger(chain, glyph_array->array, glyph_array->len) == glyph_array->len) return;
 
-  // If no glyph in the input matches any of the Substitutions, skip the Lookup.
-  Bloom ga_bloom = GlyphArray_get_bloom(glyph_array);
-  if (!bloom_compare_bloom(ga_bloom, lookup_bloom)) {
+  // Cached results don't keep the flags or the clusters
+  ResultCache *cache = atomic_load_explicit(&chain->cache, memory_order_acquire);
+  if (cache == NULL || chain->lookupCount == 0 ||
+      glyph_array->flags != NULL || glyph_array->clusters != NULL) {
+    apply_Lookups(chain, workspace, glyph_array);
     return;
   }
 
-  // Extract list of blooms from the hashtable to let apply_Lookup_at_index skip
-  // getting them for each glyph.
-  Bloom* sub_blooms = get_cached_Substitution_blooms_for_Lookup(chain, lookupTable, lookupType);
-
+  // Each segment is cached by itself, so that changing a word of a line only
+  // needs that word to be applied again.
+  size_t index = 0;
   while (index < glyph_array->len) {
-    // If the current glyph doesn't match any of the Substitutions, skip it.
-    if ((glyphID_compare_bloom(glyph_array->array[*index_ptr], lookup_bloom))) {
-      apply_Lookup_at_index(chain, lookupTable, sub_blooms, glyph_array, index_ptr);
-    }
-    index++;
-    // ReverseChaining doesn't change the number of glyphs, so we can just do --.
-    reverse_index--;
+    size_t touched_end;
+    size_t end = find_segment_end(chain, glyph_array->array, index, glyph_array->len, &touched_end);
+    // Glyphs that no Lookup touches stay as they are
+    size_t result = apply_cached_Segment(chain, cache, workspace, glyph_array, index, touched_end);
+    index += result + (end - touched_end);
   }
 }
 
-void apply_chain(const Chain *chain, GlyphArray* glyph_array) {
-  for (size_t i = 0; i < chain->lookupCount; i++) {
-    apply_Lookup(chain, chain->lookupsArray[i], glyph_array);
-  }
+void get_chain_context(const Chain *chain, size_t *backtrack, size_t *lookahead) {
+  if (backtrack != NULL) *backtrack = chain->reach.backtrack;
+  if (lookahead != NULL) *lookahead = chain->reach.lookahead;
 }
 
+struct ChainMemoEntry *get_chain_memo_entry(const Chain *chain) {
+  return chain->memo_entry;
+}
+
+void set_chain_memo_entry(Chain *chain, struct ChainMemoEntry *entry) {
+  chain->memo_entry = entry;
+}
+
+bool set_chain_cache(Chain *chain, size_t max_bytes) {
+  if (max_bytes == 0 || atomic_load_explicit(&chain->cache, memory_order_acquire) != NULL) return true;
+  ResultCache *cache = ResultCache_new(max_bytes);
+  if (cache == NULL) return false;
+  ResultCache *none = NULL;
+  // Someone else set it in the meantime
+  if (!atomic_compare_exchange_strong_explicit(&chain->cache, &none, cache, memory_order_acq_rel, memory_order_acquire)) {
+    ResultCache_free(cache);
+  }
+  return true;
+}
@@ -421,11 +421,93 @@ typedef struct {
 
 /** Custom **/
 
+typedef enum {
+  SingleLookupType = 1,
+  MultipleLookupType,
+  AlternateLookupType,
+  LigatureLookupType,
+  ContextLookupType,
+  ChainingLookupType,
+  ExtensionSubstitutionLookupType,
+  ReverseChainingContextSingleLookupType,
+  ReservedLookupType
+} LookupTypes;
+
+typedef enum {
+  SingleSubstitutionFormat_1 = 1,
+  SingleSubstitutionFormat_2
+} SingleSubstitutionFormats;
+
+typedef enum {
+  SequenceContextFormat_1 = 1,
+  SequenceContextFormat_2,
+  SequenceContextFormat_3
+} SequenceContextFormats;
+
+typedef enum {
+  ChainedSequenceContextFormat_1 = 1,
+  ChainedSequenceContextFormat_2,
+  ChainedSequenceContextFormat_3
+} ChainedSequenceContextFormats;
+
+typedef enum {
+  ClassFormat_1 = 1,
+  ClassFormat_2
+} ClassFormats;
+
+typedef enum {
+  ReverseChainSingleSubstFormat_1 = 1,
+} ReverseChainSingleSubstFormat;
+
+
 #include "glypharray.h"
+#include "workspace.h"
 
 typedef struct LBT_Chain Chain;
 
 bool get_required_feature(const uint8_t *GSUB_table, const unsigned char (*script)[4], const unsigned char (*lang)[4], unsigned char (*required_feature)[4]);
-Chain *generate_chain(const uint8_t *GSUB_table, const unsigned char (*script)[4], const unsigned char (*lang)[4], const unsigned char (*features)[4], size_t n_features);
+// The Lookups of a GSUB table, each compiled once for all of its chains, when
+// the first chain that uses it is generated.
+// The chains keep a reference to it, so it's only freed with the last one.
+typedef struct CompiledGSUB CompiledGSUB;
+CompiledGSUB *compile_GSUB(const uint8_t *GSUB_table);
+// Drops the reference from compile_GSUB.
+void free_compiled_GSUB(CompiledGSUB *compiled_GSUB);
+// Whether compiling some Lookups failed, after which it can't be used to
+// generate chains anymore. The ones already generated keep working.
+bool compiled_GSUB_failed(const CompiledGSUB *compiled_GSUB);
+// Compiles the Lookups the chain needs into compiled_GSUB, so chains using the
+// same compiled_GSUB must be generated one at a time.
+Chain *generate_chain(const uint8_t *GSUB_table, CompiledGSUB *compiled_GSUB, const unsigned char (*script)[4], const unsigned char (*lang)[4], const unsigned char (*features)[4], size_t n_features);
 void destroy_chain(Chain *chain);
-void apply_chain(const Chain *chain, GlyphArray* glyph_array);
+// Writes the chain in buffer, in a format that load_chain can use in place,
+// along with the key it was generated from.
+// All the compiled data it reads is written, so it's best generated with a
+// CompiledGSUB of its own.
+// Returns the size it needs, without writing anything if buffer is too small.
+size_t serialize_chain(const Chain *chain, const void *key, size_t key_len, uint8_t *buffer, size_t buffer_size);
+// Returns a chain reading from data, written by serialize_chain with the same
+// key, or NULL if it wasn't. data must outlive the chain.
+Chain *load_chain(const uint8_t *data, size_t len, const void *key, size_t key_len);
+// If glyph_array tracks flags, the glyphs that matches looked at are marked
+// GlyphFlag_UnsafeToBreak. If it tracks clusters, they're kept up to date.
+void apply_chain(const Chain *chain, Workspace *workspace, GlyphArray* glyph_array);
+// Gets how many glyphs before and after a glyph a match including it can look at.
+void get_chain_context(const Chain *chain, size_t *backtrack, size_t *lookahead);
+// Returns the index of the first glyph that some Lookup of the chain can
+// "start" on, len if there's none. No glyph before it can be changed.
+size_t find_first_trigger(const Chain *chain, const uint16_t *glyphs, size_t len);
+// The ChainMemo entry that shares the chain, NULL if it's not shared.
+struct ChainMemoEntry *get_chain_memo_entry(const Chain *chain);
+void set_chain_memo_entry(Chain *chain, struct ChainMemoEntry *entry);
+// Caches the results of apply_chain, using at most max_bytes, unless there's
+// a cache already. It's never changed nor removed after that.
+bool set_chain_cache(Chain *chain, size_t max_bytes);
+// Returns the first index from `from` on where the glyphs can be split, so that
+// applying the chain to each side separately gives the same result as applying
+// it to all of them, or `len` if there's none.
+size_t find_safe_break(const Chain *chain, const uint16_t *glyphs, size_t from, size_t len);
+// Returns the end of the segment that starts at `start`: the glyphs some
+// Lookup can touch, followed by the ones none can. The first part ends at
+// `touched_end`. Segments can be applied separately.
+size_t find_segment_end(const Chain *chain, const uint16_t *glyphs, size_t start, size_t len, size_t *touched_end);
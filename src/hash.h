@@ -1,8 +1,10 @@
 #pragma once
 
-#define HASH_SIZE 3769
-#define HASH_RETRIES 10
-#define HASH(x) ((((x) >> 1)) % hash->size)
+// Open addressing with linear probing. The size is a power of two, and the
+// table doubles before it's half full, so probes always end on an empty entry.
+#define HASH_INITIAL_SIZE 64
+// Fibonacci hashing, to spread aligned addresses
+#define HASH(x) ((size_t)(((uint64_t)(x) * 0x9E3779B97F4A7C15u) >> 32) & (hash->size - 1))
 
 
 #define build_hash_functions(type)                                             \
@@ -19,9 +21,9 @@ static HashTable_##type *new_##type##_hash(void) {                             \
   HashTable_##type *hash = malloc(sizeof(HashTable_##type));                   \
   if (hash == NULL) return NULL;                                               \
   *hash = (HashTable_##type){                                                  \
-    .size = HASH_SIZE,                                                         \
+    .size = HASH_INITIAL_SIZE,                                                 \
     .occupied = 0,                                                             \
-    .entries = calloc(HASH_SIZE, sizeof(HashEntry_##type)),                    \
+    .entries = calloc(HASH_INITIAL_SIZE, sizeof(HashEntry_##type)),            \
   };                                                                           \
   if (hash->entries == NULL) {                                                 \
     free(hash);                                                                \
@@ -32,59 +34,51 @@ static HashTable_##type *new_##type##_hash(void) {                             \
 static inline bool get_from_##type##_hash(HashTable_##type *hash, const void* address, type *value) { \
   size_t index = HASH((uintptr_t)address);                                     \
   HashEntry_##type *entries = hash->entries;                                   \
-  for (size_t retries = 0; entries[index].address != NULL; retries++) {        \
+  while (entries[index].address != NULL) {                                     \
     if (entries[index].address == address) {                                   \
       *value = entries[index].value;                                           \
       return true;                                                             \
     }                                                                          \
-    if (retries >= HASH_RETRIES) return false;                                 \
-    index = (index + 1) % hash->size;                                          \
+    index = (index + 1) & (hash->size - 1);                                    \
   }                                                                            \
   return false;                                                                \
 }                                                                              \
 static bool resize_##type##_hash(HashTable_##type *hash);                      \
-static void set_to_##type##_hash(HashTable_##type *hash, const void* address, type value) { \
+/* Only fails if it's out of memory. */                                        \
+static bool set_to_##type##_hash(HashTable_##type *hash, const void* address, type value) { \
+  if ((hash->occupied + 1) * 2 > hash->size && !resize_##type##_hash(hash)) {  \
+    return false;                                                              \
+  }                                                                            \
   size_t index = HASH((uintptr_t)address);                                     \
   HashEntry_##type *entries = hash->entries;                                   \
-  size_t retries;                                                              \
-  for (retries = 0; entries[index].address != NULL; retries++){                \
-    if (retries >= HASH_RETRIES || hash->occupied > hash->size / 3) {          \
-      bool success = resize_##type##_hash(hash);                               \
-      if (success) {                                                           \
-        set_to_##type##_hash(hash, address, value);                            \
-        return;                                                                \
-      }                                                                        \
+  while (entries[index].address != NULL) {                                     \
+    if (entries[index].address == address) {                                   \
+      entries[index].value = value;                                            \
+      return true;                                                             \
     }                                                                          \
-    if (retries >= HASH_RETRIES) return;                                       \
-    index = (index + 1) % hash->size;                                          \
+    index = (index + 1) & (hash->size - 1);                                    \
   }                                                                            \
   entries[index].address = address;                                            \
   entries[index].value = value;                                                \
   hash->occupied++;                                                            \
-  return;                                                                      \
+  return true;                                                                 \
 }                                                                              \
 static bool resize_##type##_hash(HashTable_##type *hash) {                     \
-  size_t sizes[] = {4969, 7699, 9769, 11969, 14207, 17669, 22699, 29669, 34693, 44201}; \
-  size_t new_size = 0;                                                         \
-  for (size_t i = 0; i < sizeof(sizes)/sizeof(size_t); i++) {                  \
-    if (sizes[i] > hash->size) {                                               \
-      new_size = sizes[i];                                                     \
-      break;                                                                   \
-    }                                                                          \
-  }                                                                            \
-  if (new_size == 0) return false;                                             \
+  size_t new_size = hash->size * 2;                                            \
   HashEntry_##type *new_entries = calloc(new_size, sizeof(HashEntry_##type));  \
   if (new_entries == NULL) return false;                                       \
   HashEntry_##type *old_entries = hash->entries;                               \
   size_t old_size = hash->size;                                                \
   hash->size = new_size;                                                       \
-  hash->occupied = 0;                                                          \
   hash->entries = new_entries;                                                 \
   for (size_t i = 0; i < old_size; i++) {                                      \
     HashEntry_##type entry = old_entries[i];                                   \
-    if (entry.address != NULL) {                                               \
-      set_to_##type##_hash(hash, entry.address, entry.value);                  \
+    if (entry.address == NULL) continue;                                       \
+    size_t index = HASH((uintptr_t)entry.address);                             \
+    while (new_entries[index].address != NULL) {                               \
+      index = (index + 1) & (new_size - 1);                                    \
     }                                                                          \
+    new_entries[index] = entry;                                                \
   }                                                                            \
   free(old_entries);                                                           \
   return true;                                                                 \
@@ -1,32 +1,148 @@
 #include <stdint.h>
+#include <string.h>
 #include <assert.h>
+#include <stdatomic.h>
 
 #include "libatures.h"
 #include "gsub.h"
+#include "workspace.h"
+#include "pool.h"
+#include "shapedrun.h"
+#include "chainmemo.h"
+#include "sfnt.h"
 
 typedef struct LBT_ChainCreator {
-  uint8_t *GSUB_table;
+  const uint8_t *GSUB_table;
+  size_t GSUB_len; // 0 if unknown
+  bool owns_GSUB_table; // Otherwise it's borrowed from the caller
+  ChainMemo *chains;
 } LBT_ChainCreator;
 
-LBT_ChainCreator *LBT_new_from_tables(uint8_t *GSUB_table) {
+static LBT_ChainCreator *new_ChainCreator(const uint8_t *GSUB_table, size_t GSUB_len, bool owns_GSUB_table) {
   LBT_ChainCreator *cc = malloc(sizeof(LBT_ChainCreator));
   if (cc == NULL) {
     return NULL;
   }
   cc->GSUB_table = GSUB_table;
+  cc->GSUB_len = GSUB_len;
+  cc->owns_GSUB_table = owns_GSUB_table;
+  cc->chains = ChainMemo_new(GSUB_table);
+  if (cc->chains == NULL) {
+    free(cc);
+    return NULL;
+  }
   return cc;
 }
 
+LBT_ChainCreator *LBT_new_from_tables(uint8_t *GSUB_table) {
+  return new_ChainCreator(GSUB_table, 0, true);
+}
+
+static const unsigned char GSUB_tag[4] = {'G', 'S', 'U', 'B'};
+
+// Sets GSUB_table to NULL if the face doesn't have one.
+static bool find_GSUB_table(const uint8_t *font_data, size_t len, size_t face_index, const uint8_t **GSUB_table, size_t *GSUB_len) {
+  if (!find_sfnt_table(font_data, len, face_index, &GSUB_tag, GSUB_table, GSUB_len)) {
+    return false;
+  }
+  return *GSUB_table == NULL || *GSUB_len >= sizeof(GsubHeader);
+}
+
+LBT_ChainCreator *LBT_new_from_memory(const uint8_t *font_data, size_t len) {
+  const uint8_t *GSUB_table;
+  size_t GSUB_len;
+  if (!find_GSUB_table(font_data, len, 0, &GSUB_table, &GSUB_len)) {
+    return NULL;
+  }
+  return new_ChainCreator(GSUB_table, GSUB_len, false);
+}
+
+typedef struct LBT_Collection {
+  size_t n_faces;
+  LBT_ChainCreator **faces; // By face index, shared by faces with the same GSUB table
+  size_t n_creators;
+  LBT_ChainCreator **creators; // Each one once
+} LBT_Collection;
+
+LBT_Collection *LBT_new_collection(const uint8_t *font_data, size_t len) {
+  size_t n_faces = count_sfnt_faces(font_data, len);
+  if (n_faces == 0) {
+    return NULL;
+  }
+  LBT_Collection *collection = calloc(1, sizeof(LBT_Collection));
+  if (collection == NULL) {
+    return NULL;
+  }
+  collection->faces = calloc(n_faces, sizeof(LBT_ChainCreator *));
+  collection->creators = calloc(n_faces, sizeof(LBT_ChainCreator *));
+  if (collection->faces == NULL || collection->creators == NULL) {
+    goto fail;
+  }
+
+  for (size_t i = 0; i < n_faces; i++) {
+    const uint8_t *GSUB_table;
+    size_t GSUB_len;
+    if (!find_GSUB_table(font_data, len, i, &GSUB_table, &GSUB_len)) {
+      goto fail;
+    }
+    // Faces often point to the same GSUB table
+    LBT_ChainCreator *cc = NULL;
+    for (size_t j = 0; j < collection->n_creators && cc == NULL; j++) {
+      if (collection->creators[j]->GSUB_table == GSUB_table) {
+        cc = collection->creators[j];
+      }
+    }
+    if (cc == NULL) {
+      cc = new_ChainCreator(GSUB_table, GSUB_len, false);
+      if (cc == NULL) {
+        goto fail;
+      }
+      collection->creators[collection->n_creators++] = cc;
+    }
+    collection->faces[i] = cc;
+  }
+  collection->n_faces = n_faces;
+  return collection;
+
+fail:
+  LBT_destroy_collection(collection);
+  return NULL;
+}
+
+size_t LBT_get_collection_size(const LBT_Collection *collection) {
+  return collection->n_faces;
+}
+
+LBT_ChainCreator *LBT_get_collection_face(const LBT_Collection *collection, size_t face_index) {
+  if (face_index >= collection->n_faces) {
+    return NULL;
+  }
+  return collection->faces[face_index];
+}
+
+void LBT_destroy_collection(LBT_Collection *collection) {
+  if (collection == NULL) {
+    return;
+  }
+  for (size_t i = 0; i < collection->n_creators; i++) {
+    LBT_destroy(collection->creators[i]);
+  }
+  free(collection->creators);
+  free(collection->faces);
+  free(collection);
+}
+
 #if !defined(NO_FREETYPE)
 #include <ft2build.h>
 #include FT_TRUETYPE_TAGS_H
 #include FT_TRUETYPE_TABLES_H
 #include FT_FREETYPE_H
 
-static FT_Error get_table(FT_Face face, FT_ULong tag, uint8_t **table) {
+static FT_Error get_table(FT_Face face, FT_ULong tag, uint8_t **table, size_t *len) {
   FT_Error error;
   FT_ULong table_len = 0;
   *table = NULL;
+  *len = 0;
   // Get size only
   error = FT_Load_Sfnt_Table(face, tag, 0, NULL, &table_len);
   if (error == FT_Err_Table_Missing) {
@@ -37,22 +153,24 @@ static FT_Error get_table(FT_Face face, FT_ULong tag, uint8_t **table) {
   }
 
   *table = (uint8_t *)malloc(table_len);
-  if (table == NULL) {
+  if (*table == NULL) {
     return FT_Err_Out_Of_Memory;
   }
 
   error = FT_Load_Sfnt_Table(face, TTAG_GSUB, 0, *table, &table_len);
+  *len = table_len;
 
   return error;
 }
 
 LBT_ChainCreator *LBT_new(FT_Face face) {
   uint8_t *GSUB_table = NULL;
-  if (get_table(face, TTAG_GSUB, &GSUB_table) != 0) {
+  size_t GSUB_len;
+  if (get_table(face, TTAG_GSUB, &GSUB_table, &GSUB_len) != 0) {
     return NULL;
   }
 
-  LBT_ChainCreator *cc = LBT_new_from_tables(GSUB_table);
+  LBT_ChainCreator *cc = new_ChainCreator(GSUB_table, GSUB_len, true);
   if (cc == NULL) {
     free(GSUB_table);
     return NULL;
@@ -63,30 +181,388 @@ LBT_ChainCreator *LBT_new(FT_Face face) {
 #endif
 
 void LBT_destroy(LBT_ChainCreator* cc) {
-  if (cc->GSUB_table != NULL) {
-    free(cc->GSUB_table);
+  ChainMemo_free(cc->chains);
+  if (cc->owns_GSUB_table && cc->GSUB_table != NULL) {
+    free((uint8_t *)cc->GSUB_table);
   }
   free(cc);
 }
 
 LBT_Chain *LBT_generate_chain(const LBT_ChainCreator *cc, LBT_tag *script, LBT_tag *lang, LBT_tag *features, size_t n_features) {
-  return generate_chain(cc->GSUB_table, script, lang, features, n_features);
+  return ChainMemo_get(cc->chains, script, lang, features, n_features);
 }
 
 void LBT_destroy_chain(LBT_Chain *chain) {
-  destroy_chain(chain);
+  ChainMemo_release(chain);
+}
+
+// Identifies a chain of a GSUB table, by its content rather than where it is.
+static uint8_t *new_serialized_key(const LBT_ChainCreator *cc, LBT_tag *script, LBT_tag *lang, LBT_tag *features, size_t n_features, size_t *key_len) {
+  if (cc->GSUB_table != NULL && cc->GSUB_len == 0) {
+    return NULL;
+  }
+  size_t chain_key_len;
+  uint8_t *chain_key = new_chain_key(script, lang, features, n_features, &chain_key_len);
+  if (chain_key == NULL) {
+    return NULL;
+  }
+  uint64_t GSUB_id[2] = { sfnt_checksum(cc->GSUB_table, cc->GSUB_len), cc->GSUB_len };
+  *key_len = sizeof(GSUB_id) + chain_key_len;
+  uint8_t *key = malloc(*key_len);
+  if (key != NULL) {
+    memcpy(key, GSUB_id, sizeof(GSUB_id));
+    memcpy(key + sizeof(GSUB_id), chain_key, chain_key_len);
+  }
+  free(chain_key);
+  return key;
+}
+
+size_t LBT_serialize_chain(const LBT_ChainCreator *cc, LBT_tag *script, LBT_tag *lang, LBT_tag *features, size_t n_features, uint8_t *buffer, size_t size) {
+  size_t key_len;
+  uint8_t *key = new_serialized_key(cc, script, lang, features, n_features, &key_len);
+  if (key == NULL) {
+    return 0;
+  }
+  size_t result = ChainMemo_serialize(cc->chains, script, lang, features, n_features, key, key_len, buffer, size);
+  free(key);
+  return result;
+}
+
+LBT_Chain *LBT_load_chain(const LBT_ChainCreator *cc, LBT_tag *script, LBT_tag *lang, LBT_tag *features, size_t n_features, const uint8_t *data, size_t len) {
+  size_t key_len;
+  uint8_t *key = new_serialized_key(cc, script, lang, features, n_features, &key_len);
+  if (key == NULL) {
+    return NULL;
+  }
+  LBT_Chain *chain = load_chain(data, len, key, key_len);
+  free(key);
+  return chain;
+}
+
+bool LBT_set_chain_cache(LBT_Chain *chain, size_t max_bytes) {
+  return set_chain_cache(chain, max_bytes);
+}
+
+size_t LBT_find_segments(const LBT_Chain *chain, const LBT_Glyph* glyph_array, size_t n_input_glyphs, size_t *segment_ends, size_t max_segments) {
+  size_t n_segments = 0;
+  for (size_t start = 0; start < n_input_glyphs; n_segments++) {
+    start = find_segment_end(chain, glyph_array, start, n_input_glyphs, NULL);
+    if (n_segments < max_segments) segment_ends[n_segments] = start;
+  }
+  return n_segments;
 }
 
 LBT_Glyph* LBT_apply_chain(const LBT_Chain *chain, const LBT_Glyph* glyph_array, size_t n_input_glyphs, size_t *n_output_glyphs) {
   GlyphArray *ga = GlyphArray_new_from_data(glyph_array, n_input_glyphs);
 
-  apply_chain(chain, ga);
+  apply_chain(chain, NULL, ga);
+
+  LBT_Glyph* out = ga->array;
+  ga->array = NULL;
+
+  if (n_output_glyphs != NULL) *n_output_glyphs = ga->len;
+
+  GlyphArray_free(ga);
+  return out;
+}
+
+LBT_Glyph* LBT_apply_chain_with_flags(const LBT_Chain *chain, const LBT_Glyph* glyph_array, size_t n_input_glyphs, size_t *n_output_glyphs, uint8_t **flags) {
+  GlyphArray *ga = GlyphArray_new_from_data(glyph_array, n_input_glyphs);
+  if (ga == NULL || !GlyphArray_track_flags(ga)) {
+    GlyphArray_free(ga);
+    return NULL;
+  }
+
+  apply_chain(chain, NULL, ga);
 
   LBT_Glyph* out = ga->array;
+  *flags = ga->flags;
   ga->array = NULL;
+  ga->flags = NULL;
 
   if (n_output_glyphs != NULL) *n_output_glyphs = ga->len;
 
   GlyphArray_free(ga);
   return out;
 }
+
+LBT_Glyph* LBT_apply_chain_with_clusters(const LBT_Chain *chain, const LBT_Glyph* glyph_array, size_t n_input_glyphs, size_t *n_output_glyphs, uint32_t **clusters) {
+  GlyphArray *ga = GlyphArray_new_from_data(glyph_array, n_input_glyphs);
+  if (ga == NULL || !GlyphArray_track_clusters(ga)) {
+    GlyphArray_free(ga);
+    return NULL;
+  }
+
+  apply_chain(chain, NULL, ga);
+
+  LBT_Glyph* out = ga->array;
+  *clusters = ga->clusters;
+  ga->array = NULL;
+  ga->clusters = NULL;
+
+  if (n_output_glyphs != NULL) *n_output_glyphs = ga->len;
+
+  GlyphArray_free(ga);
+  return out;
+}
+
+size_t LBT_find_first_affected_glyph(const LBT_Chain *chain, const LBT_Glyph* glyph_array, size_t n_input_glyphs) {
+  return find_first_trigger(chain, glyph_array, n_input_glyphs);
+}
+
+void LBT_get_chain_context(const LBT_Chain *chain, size_t *backtrack, size_t *lookahead) {
+  get_chain_context(chain, backtrack, lookahead);
+}
+
+size_t LBT_apply_chain_to_buffer(const LBT_Chain *chain, const LBT_Glyph* glyph_array, size_t n_input_glyphs, LBT_Glyph *output, size_t capacity) {
+  GlyphArray ga;
+  if (n_input_glyphs <= capacity) {
+    // Work directly in the output, and only move out if it gets too big
+    GlyphArray_init_with_storage(&ga, output, capacity);
+    if (n_input_glyphs > 0) memmove(output, glyph_array, n_input_glyphs * sizeof(LBT_Glyph));
+    ga.len = n_input_glyphs;
+    ga.bloom_valid = false;
+  } else {
+    GlyphArray_init(&ga);
+    if (!GlyphArray_append(&ga, glyph_array, n_input_glyphs)) return 0;
+  }
+
+  apply_chain(chain, NULL, &ga);
+
+  size_t len = ga.len;
+  size_t fitting = len < capacity ? len : capacity;
+  if (ga.array != output && fitting > 0) {
+    memcpy(output, ga.array, fitting * sizeof(LBT_Glyph));
+  }
+  GlyphArray_free_storage(&ga);
+  return len;
+}
+
+bool LBT_apply_chain_if_changed(const LBT_Chain *chain, const LBT_Glyph* glyph_array, size_t n_input_glyphs, LBT_Glyph **output, size_t *n_output_glyphs) {
+  GlyphArray ga;
+  GlyphArray_init_read_only(&ga, glyph_array, n_input_glyphs);
+
+  apply_chain(chain, NULL, &ga);
+
+  if (n_output_glyphs != NULL) *n_output_glyphs = ga.len;
+  if (!ga.modified) {
+    *output = NULL;
+    return false;
+  }
+  // Modifying the glyphs made a copy we own, unless only some were removed
+  if (ga.copy_on_write && !GlyphArray_make_writable(&ga)) {
+    *output = NULL;
+    return true;
+  }
+  *output = ga.array;
+  return true;
+}
+
+LBT_Workspace *LBT_new_workspace(void) {
+  return Workspace_new();
+}
+
+void LBT_destroy_workspace(LBT_Workspace *workspace) {
+  Workspace_free(workspace);
+}
+
+const LBT_Glyph* LBT_apply_chain_with_workspace(const LBT_Chain *chain, LBT_Workspace *workspace, const LBT_Glyph* glyph_array, size_t n_input_glyphs, size_t *n_output_glyphs) {
+  GlyphArray *ga = &workspace->glyphs;
+  GlyphArray_clear(ga);
+  if (!GlyphArray_append(ga, glyph_array, n_input_glyphs)) return NULL;
+
+  apply_chain(chain, workspace, ga);
+
+  if (n_output_glyphs != NULL) *n_output_glyphs = ga->len;
+  return ga->array;
+}
+
+LBT_Pool *LBT_new_pool(size_t n_threads) {
+  return Pool_new(n_threads);
+}
+
+size_t LBT_get_pool_threads(const LBT_Pool *pool) {
+  return Pool_get_workers(pool);
+}
+
+void LBT_destroy_pool(LBT_Pool *pool) {
+  Pool_free(pool);
+}
+
+// Runs are handed out to the threads in chunks of about this many glyphs
+#define BATCH_CHUNK_GLYPHS 4096
+
+typedef struct {
+  size_t worker; // Whose arena has the result
+  size_t start; // Where the result starts in the arena
+} BatchResult;
+
+typedef struct {
+  const Chain *chain;
+  Pool *pool;
+  const LBT_Run *runs;
+  size_t *chunks; // First run of each chunk, and the end of the last one
+  BatchResult *results;
+  size_t *lengths;
+  atomic_bool failed;
+  // Used when there's no pool
+  Workspace *workspace;
+  GlyphArray arena;
+} Batch;
+
+static Workspace *Batch_get_workspace(Batch *batch, size_t worker) {
+  return batch->pool != NULL ? Pool_get_workspace(batch->pool, worker) : batch->workspace;
+}
+
+static GlyphArray *Batch_get_arena(Batch *batch, size_t worker) {
+  return batch->pool != NULL ? Pool_get_arena(batch->pool, worker) : &batch->arena;
+}
+
+static void apply_batch_chunk(void *data, size_t worker, size_t chunk) {
+  Batch *batch = data;
+  Workspace *workspace = Batch_get_workspace(batch, worker);
+  GlyphArray *arena = Batch_get_arena(batch, worker);
+  GlyphArray *ga = &workspace->glyphs;
+
+  for (size_t i = batch->chunks[chunk]; i < batch->chunks[chunk + 1]; i++) {
+    GlyphArray_clear(ga);
+    if (!GlyphArray_append(ga, batch->runs[i].glyphs, batch->runs[i].len)) goto fail;
+
+    apply_chain(batch->chain, workspace, ga);
+
+    batch->results[i].worker = worker;
+    batch->results[i].start = arena->len;
+    batch->lengths[i] = ga->len;
+    if (!GlyphArray_append(arena, ga->array, ga->len)) goto fail;
+  }
+  return;
+
+fail:
+  atomic_store(&batch->failed, true);
+}
+
+LBT_Glyph *LBT_apply_chain_batch(const LBT_Chain *chain, LBT_Pool *pool, const LBT_Run *runs, size_t n_runs, size_t *offsets) {
+  LBT_Glyph *out = NULL;
+  bool acquired = false;
+  Batch batch = {
+    .chain = chain,
+    .pool = pool,
+    .runs = runs,
+    .lengths = offsets + 1,
+  };
+  atomic_init(&batch.failed, false);
+  GlyphArray_init(&batch.arena);
+
+  size_t n_workers = pool != NULL ? Pool_get_workers(pool) : 1;
+  size_t total = 0;
+  for (size_t i = 0; i < n_runs; i++) {
+    total += runs[i].len;
+  }
+
+  // Small batches are split further, so that every thread gets some chunks
+  // and there's still something to steal.
+  size_t chunk_glyphs = total / (n_workers * 4);
+  if (chunk_glyphs > BATCH_CHUNK_GLYPHS) chunk_glyphs = BATCH_CHUNK_GLYPHS;
+  if (chunk_glyphs == 0) chunk_glyphs = 1;
+
+  batch.chunks = malloc((n_runs + 1) * sizeof(size_t));
+  batch.results = malloc(n_runs * sizeof(BatchResult) + 1);
+  if (batch.chunks == NULL || batch.results == NULL) goto end;
+
+  size_t n_chunks = 0;
+  size_t chunk_len = 0;
+  batch.chunks[0] = 0;
+  for (size_t i = 0; i < n_runs; i++) {
+    chunk_len += runs[i].len;
+    if (chunk_len >= chunk_glyphs || i == n_runs - 1) {
+      batch.chunks[++n_chunks] = i + 1;
+      chunk_len = 0;
+    }
+  }
+
+  if (pool != NULL) {
+    Pool_acquire(pool);
+    acquired = true;
+    for (size_t i = 0; i < n_workers; i++) {
+      GlyphArray_clear(Pool_get_arena(pool, i));
+    }
+    Pool_run(pool, apply_batch_chunk, &batch, n_chunks);
+  } else {
+    batch.workspace = Workspace_new();
+    if (batch.workspace == NULL) goto end;
+    for (size_t i = 0; i < n_chunks; i++) {
+      apply_batch_chunk(&batch, 0, i);
+    }
+  }
+  if (atomic_load(&batch.failed)) goto end;
+
+  // Turn the lengths into offsets
+  offsets[0] = 0;
+  for (size_t i = 0; i < n_runs; i++) {
+    offsets[i + 1] += offsets[i];
+  }
+
+  out = malloc(offsets[n_runs] * sizeof(LBT_Glyph) + 1);
+  if (out == NULL) goto end;
+  for (size_t i = 0; i < n_runs; i++) {
+    size_t len = offsets[i + 1] - offsets[i];
+    if (len == 0) continue;
+    const GlyphArray *arena = Batch_get_arena(&batch, batch.results[i].worker);
+    memcpy(out + offsets[i], arena->array + batch.results[i].start, len * sizeof(LBT_Glyph));
+  }
+
+end:
+  if (acquired) Pool_release(pool);
+  Workspace_free(batch.workspace);
+  GlyphArray_free_storage(&batch.arena);
+  free(batch.chunks);
+  free(batch.results);
+  return out;
+}
+
+// Runs are only split in parts of at least this many glyphs
+#define PARALLEL_SPLIT_GLYPHS 16384
+
+LBT_Glyph *LBT_apply_chain_parallel(const LBT_Chain *chain, LBT_Pool *pool, const LBT_Glyph* glyph_array, size_t n_input_glyphs, size_t *n_output_glyphs) {
+  if (pool == NULL || Pool_get_workers(pool) == 1 || n_input_glyphs < 2 * PARALLEL_SPLIT_GLYPHS) {
+    return LBT_apply_chain(chain, glyph_array, n_input_glyphs, n_output_glyphs);
+  }
+
+  size_t max_runs = n_input_glyphs / PARALLEL_SPLIT_GLYPHS + 1;
+  LBT_Run *runs = malloc(max_runs * sizeof(LBT_Run));
+  size_t *offsets = malloc((max_runs + 1) * sizeof(size_t));
+  LBT_Glyph *out = NULL;
+  if (runs == NULL || offsets == NULL) goto end;
+
+  size_t n_runs = 0;
+  for (size_t start = 0; start < n_input_glyphs;) {
+    size_t end = find_safe_break(chain, glyph_array, start + PARALLEL_SPLIT_GLYPHS, n_input_glyphs);
+    runs[n_runs++] = (LBT_Run){ .glyphs = glyph_array + start, .len = end - start };
+    start = end;
+  }
+
+  out = LBT_apply_chain_batch(chain, pool, runs, n_runs, offsets);
+  if (out != NULL && n_output_glyphs != NULL) *n_output_glyphs = offsets[n_runs];
+
+end:
+  free(runs);
+  free(offsets);
+  return out;
+}
+
+LBT_ShapedRun *LBT_new_shaped_run(const LBT_Chain *chain, const LBT_Glyph* glyph_array, size_t n_input_glyphs) {
+  return ShapedRun_new(chain, glyph_array, n_input_glyphs);
+}
+
+bool LBT_edit_shaped_run(LBT_ShapedRun *run, size_t from, size_t to, const LBT_Glyph* glyph_array, size_t n_input_glyphs) {
+  return ShapedRun_edit(run, from, to, glyph_array, n_input_glyphs);
+}
+
+const LBT_Glyph *LBT_get_shaped_run_output(const LBT_ShapedRun *run, size_t *n_output_glyphs) {
+  if (n_output_glyphs != NULL) *n_output_glyphs = run->output.len;
+  return run->output.array;
+}
+
+void LBT_destroy_shaped_run(LBT_ShapedRun *run) {
+  ShapedRun_free(run);
+}
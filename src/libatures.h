@@ -13,12 +13,33 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include <stdbool.h>
 
 typedef struct LBT_ChainCreator LBT_ChainCreator;
 typedef struct LBT_Chain LBT_Chain;
+typedef struct LBT_Workspace LBT_Workspace;
+typedef struct LBT_Pool LBT_Pool;
+typedef struct LBT_ShapedRun LBT_ShapedRun;
+typedef struct LBT_Collection LBT_Collection;
 typedef uint16_t LBT_Glyph;
 typedef const unsigned char (LBT_tag)[4];
 
+/**
+ * \brief A run of glyphs to "ligate" with ::LBT_apply_chain_batch.
+ */
+typedef struct LBT_Run {
+  const LBT_Glyph *glyphs;
+  size_t len;
+} LBT_Run;
+
+/**
+ * \brief Flag of the glyphs returned by ::LBT_apply_chain_with_flags.
+ *
+ * Set if breaking the run just before the glyph, and applying the chain to
+ * each side separately, could give different glyphs.
+ */
+#define LBT_GLYPH_UNSAFE_TO_BREAK 0x01
+
 #if !defined(NO_FREETYPE)
 #include <ft2build.h>
 #include FT_FREETYPE_H
@@ -43,6 +64,73 @@ LBT_ChainCreator LIBATURES_PUBLIC *LBT_new(FT_Face face);
  */
 LBT_ChainCreator LIBATURES_PUBLIC *LBT_new_from_tables(uint8_t *GSUB_table);
 
+/**
+ * \brief Create an LBT_ChainCreator from the data of a font file, without copying it.
+ *
+ * Only the table directory is read, to find the GSUB table, so this doesn't
+ * need FreeType. `font_data` can be a memory mapped font file.
+ *
+ * `font_data` is borrowed, and must stay valid and unchanged until
+ * ::LBT_destroy.
+ *
+ * Returns `NULL` if `font_data` isn't an sfnt (TrueType or OpenType) font.
+ * For collections, the first face is used.
+ *
+ * \see ::LBT_new
+ * \see ::LBT_new_collection
+ *
+ * \param[in] font_data
+ * \param[in] len The size of `font_data`, in bytes
+ */
+LBT_ChainCreator LIBATURES_PUBLIC *LBT_new_from_memory(const uint8_t *font_data, size_t len);
+
+/**
+ * \brief Create an LBT_ChainCreator for each face of a font collection.
+ *
+ * Works like ::LBT_new_from_memory, for TrueType and OpenType collections
+ * (`.ttc` and `.otc`). A single font counts as a collection of one face.
+ *
+ * Faces that point to the same GSUB table share the same LBT_ChainCreator,
+ * along with its chains.
+ *
+ * `font_data` is borrowed, and must stay valid and unchanged until
+ * ::LBT_destroy_collection.
+ *
+ * Returns `NULL` if any face isn't a valid sfnt font.
+ *
+ * \param[in] font_data
+ * \param[in] len The size of `font_data`, in bytes
+ */
+LBT_Collection LIBATURES_PUBLIC *LBT_new_collection(const uint8_t *font_data, size_t len);
+
+/**
+ * \brief Get the number of faces in a collection.
+ *
+ * \param[in] collection
+ */
+size_t LIBATURES_PUBLIC LBT_get_collection_size(const LBT_Collection *collection);
+
+/**
+ * \brief Get the LBT_ChainCreator of a face in a collection.
+ *
+ * It belongs to the collection: don't pass it to ::LBT_destroy.
+ *
+ * Returns `NULL` if `face_index` is out of range.
+ *
+ * \param[in] collection
+ * \param[in] face_index
+ */
+LBT_ChainCreator LIBATURES_PUBLIC *LBT_get_collection_face(const LBT_Collection *collection, size_t face_index);
+
+/**
+ * \brief Destroy an LBT_Collection, and the LBT_ChainCreator of its faces.
+ *
+ * Call this only after every LBT_Chain generated from its faces is destroyed.
+ *
+ * \param[in,out] collection
+ */
+void LIBATURES_PUBLIC LBT_destroy_collection(LBT_Collection *collection);
+
 
 /**
  * \brief Destroy an LBT_ChainCreator
@@ -65,7 +153,14 @@ void LIBATURES_PUBLIC LBT_destroy(LBT_ChainCreator* cc);
  *
  * To use the required feature, if any, use the feature tag \c{' ', 'R', 'Q', 'D'}\c.
  *
- * Needs to be destroyed by ::LBT_destroy_chain.
+ * Can be called from multiple threads with the same `cc`.
+ *
+ * Chains are shared: asking again for the same script, language and set of
+ * features, in any order, returns the same chain, until every caller destroys
+ * it. If several threads ask for it at the same time, it's generated only
+ * once.
+ *
+ * Needs to be destroyed by ::LBT_destroy_chain, once for each call.
  *
  * \param[in] cc
  * \param[in] script Set to `NULL` to use the default script
@@ -79,11 +174,166 @@ LBT_Chain LIBATURES_PUBLIC *LBT_generate_chain(const LBT_ChainCreator *cc,
                                                LBT_tag *features,
                                                size_t n_features);
 
+/**
+ * \brief Save a chain in a format that ::LBT_load_chain can use in place.
+ *
+ * Generates the chain like ::LBT_generate_chain, and writes everything needed
+ * to apply it to `buffer`, along with the GSUB table checksum and the
+ * arguments, so that it's only loaded for the same font and features.
+ * Only the lookups of the chain are written, compiled again for it, rather
+ * than all the ones shared by the chains of `cc`. The result of a call with a
+ * buffer too small is kept until the call that writes it.
+ * The format depends on the version of `libatures` and on the machine.
+ *
+ * Nothing is written if `buffer` is `NULL` or `size` is too small, so call
+ * this again with a big enough buffer.
+ *
+ * Only works with an LBT_ChainCreator that knows the size of its GSUB table,
+ * so not one from ::LBT_new_from_tables.
+ *
+ * \param[in] cc
+ * \param[in] script Set to `NULL` to use the default script
+ * \param[in] lang Set to `NULL` to use the default language
+ * \param[in] features
+ * \param[in] n_features
+ * \param[out] buffer Where to write the chain, can be `NULL`
+ * \param[in] size Size of `buffer`, in bytes
+ * \return The size of the saved chain, or 0 if it couldn't be generated.
+ */
+size_t LIBATURES_PUBLIC LBT_serialize_chain(const LBT_ChainCreator *cc,
+                                            LBT_tag *script,
+                                            LBT_tag *lang,
+                                            LBT_tag *features,
+                                            size_t n_features,
+                                            uint8_t *buffer,
+                                            size_t size);
+
+/**
+ * \brief Load a chain saved by ::LBT_serialize_chain.
+ *
+ * The chain reads straight from `data`, without parsing or copying it, so
+ * `data` can be a read-only memory mapped file shared by several processes.
+ * It must be aligned to 8 bytes, and stay valid and unchanged until the chain
+ * is destroyed.
+ *
+ * Returns `NULL` if `data` wasn't saved for the same GSUB table, script,
+ * language and set of features, or by another version of `libatures`: in that
+ * case use ::LBT_generate_chain instead.
+ * Only the layout of `data` is checked, so it must come from a trusted source.
+ *
+ * The chain isn't shared with the ones from ::LBT_generate_chain, and must be
+ * destroyed by ::LBT_destroy_chain.
+ *
+ * \param[in] cc
+ * \param[in] script Set to `NULL` to use the default script
+ * \param[in] lang Set to `NULL` to use the default language
+ * \param[in] features
+ * \param[in] n_features
+ * \param[in] data
+ * \param[in] len Size of `data`, in bytes
+ */
+LBT_Chain LIBATURES_PUBLIC *LBT_load_chain(const LBT_ChainCreator *cc,
+                                           LBT_tag *script,
+                                           LBT_tag *lang,
+                                           LBT_tag *features,
+                                           size_t n_features,
+                                           const uint8_t *data,
+                                           size_t len);
+
+/**
+ * \brief Cache the results of applying chain.
+ *
+ * Once enabled, applying the chain to a segment (see ::LBT_find_segments) it
+ * was already applied to copies the previous result instead of running the
+ * lookups again.
+ * The least recently used results are dropped to stay within `max_bytes`,
+ * and segments that would take too much of it aren't cached.
+ *
+ * A chain gets a cache at most once, and keeps it until it's destroyed, so
+ * this can be called at any time, from any thread, even while the chain is
+ * being applied.
+ * As chains are shared (see ::LBT_generate_chain), the cache is shared by
+ * everyone that got the same chain, and if it already has one, this does
+ * nothing.
+ *
+ * \param[in,out] chain
+ * \param[in] max_bytes Memory the cache can use. 0 does nothing.
+ * \return `false` if the cache couldn't be allocated.
+ */
+bool LIBATURES_PUBLIC LBT_set_chain_cache(LBT_Chain *chain, size_t max_bytes);
+
+/**
+ * \brief Split a glyph run into segments that chain can be applied to
+ * separately.
+ *
+ * Segments end after glyphs that no lookup of the chain can match, like spaces
+ * usually are, so applying the chain to each segment and joining the results
+ * gives the same glyphs as applying it to the whole run.
+ * Chains with a cache (see ::LBT_set_chain_cache) already cache each segment
+ * by itself.
+ *
+ * If there are more than `max_segments` segments, only the ends of the first
+ * `max_segments` are written.
+ *
+ * \param[in] chain
+ * \param[in] glyph_array Array of glyphs to split.
+ * \param[in] n_input_glyphs Number of glyphs in `glyph_array`.
+ * \param[out] segment_ends Where each segment ends, the last one at
+ *             `n_input_glyphs`.
+ * \param[in] max_segments Number of elements that fit in `segment_ends`.
+ * \return Number of segments.
+ */
+size_t LIBATURES_PUBLIC LBT_find_segments(const LBT_Chain *chain,
+                                          const LBT_Glyph* glyph_array,
+                                          size_t n_input_glyphs,
+                                          size_t *segment_ends,
+                                          size_t max_segments);
+
+/**
+ * \brief Find the first glyph that chain could change.
+ *
+ * Only the glyphs that some lookup of the chain starts matching from can be
+ * changed, and this scans for them without applying anything, using SIMD
+ * instructions where available.
+ *
+ * If no glyph can be changed, applying the chain gives back the same glyphs,
+ * so the run can be skipped. Otherwise the glyphs before the returned one stay
+ * the same.
+ *
+ * \param[in] chain
+ * \param[in] glyph_array Array of glyphs to check.
+ * \param[in] n_input_glyphs Number of glyphs in `glyph_array`.
+ * \return Index of the first glyph that could be changed, or `n_input_glyphs`
+ *         if none can.
+ */
+size_t LIBATURES_PUBLIC LBT_find_first_affected_glyph(const LBT_Chain *chain,
+                                                      const LBT_Glyph* glyph_array,
+                                                      size_t n_input_glyphs);
+
+/**
+ * \brief Get how much context the lookups of chain can look at.
+ *
+ * This is the most context a single match looks at, around the glyph it
+ * starts from. It doesn't bound what an edit can change: a substitution can
+ * let others match further on, so to find what needs to be applied again
+ * after an edit, use ::LBT_find_segments (or ::LBT_edit_shaped_run).
+ *
+ * \param[in] chain
+ * \param[out] backtrack Most glyphs a lookup looks at before the one it
+ *             starts matching from. Can be `NULL`.
+ * \param[out] lookahead Most glyphs a lookup looks at after the one it starts
+ *             matching from. Can be `NULL`.
+ */
+void LIBATURES_PUBLIC LBT_get_chain_context(const LBT_Chain *chain,
+                                            size_t *backtrack,
+                                            size_t *lookahead);
+
 /**
  * \brief Apply chain to an `LBT_Glyph` array.
  *
- * This function is not thread-safe. Create multiple chains to execute them in
- * parallel.
+ * Chains are never modified after ::LBT_generate_chain returns, other than
+ * getting a cache once (see ::LBT_set_chain_cache), so the same chain can be
+ * applied from any number of threads at the same time.
  *
  * \param[in] chain
  * \param[in] glyph_array Array of glyphs to "ligate".
@@ -96,9 +346,304 @@ LBT_Glyph LIBATURES_PUBLIC *LBT_apply_chain(const LBT_Chain *chain,
                                             size_t n_input_glyphs,
                                             size_t *n_output_glyphs);
 
+/**
+ * \brief Apply chain to an `LBT_Glyph` array, also returning flags for each
+ * "ligated" glyph.
+ *
+ * The flags of each glyph are a combination of:
+ * - ::LBT_GLYPH_UNSAFE_TO_BREAK: a contextual or ligature lookup matched
+ *   across the glyph and the one before it, so the run can't be split there
+ *   without applying the chain again around it.
+ *
+ * The first glyph never has ::LBT_GLYPH_UNSAFE_TO_BREAK set.
+ *
+ * Tracking the flags bypasses the cache set by ::LBT_set_chain_cache.
+ *
+ * \param[in] chain
+ * \param[in] glyph_array Array of glyphs to "ligate".
+ * \param[in] n_input_glyphs Number of glyphs in `glyph_array`.
+ * \param[out] n_output_glyphs Number of glyphs returned.
+ * \param[out] flags Set to an array with the flags of each returned glyph,
+ *             which needs to be freed too.
+ * \return Array of "ligated" glyphs, or `NULL` if memory couldn't be
+ *         allocated.
+ */
+LBT_Glyph LIBATURES_PUBLIC *LBT_apply_chain_with_flags(const LBT_Chain *chain,
+                                                       const LBT_Glyph* glyph_array,
+                                                       size_t n_input_glyphs,
+                                                       size_t *n_output_glyphs,
+                                                       uint8_t **flags);
+
+/**
+ * \brief Apply chain to an `LBT_Glyph` array, also returning the cluster of
+ * each "ligated" glyph.
+ *
+ * The cluster of a glyph is the index in `glyph_array` of the first input
+ * glyph it comes from: a ligature gets the cluster of its first component,
+ * and all the glyphs a glyph is replaced with get its cluster.
+ * Clusters never decrease, so the input glyphs from one cluster to the next
+ * are the ones "ligated" into the glyphs between them.
+ *
+ * Tracking the clusters bypasses the cache set by ::LBT_set_chain_cache.
+ *
+ * \param[in] chain
+ * \param[in] glyph_array Array of glyphs to "ligate".
+ * \param[in] n_input_glyphs Number of glyphs in `glyph_array`.
+ * \param[out] n_output_glyphs Number of glyphs returned.
+ * \param[out] clusters Set to an array with the cluster of each returned
+ *             glyph, which needs to be freed too.
+ * \return Array of "ligated" glyphs, or `NULL` if memory couldn't be
+ *         allocated.
+ */
+LBT_Glyph LIBATURES_PUBLIC *LBT_apply_chain_with_clusters(const LBT_Chain *chain,
+                                                          const LBT_Glyph* glyph_array,
+                                                          size_t n_input_glyphs,
+                                                          size_t *n_output_glyphs,
+                                                          uint32_t **clusters);
+
+/**
+ * \brief Apply chain to an `LBT_Glyph` array, writing the result to `output`.
+ *
+ * Unlike ::LBT_apply_chain, this doesn't allocate anything as long as the
+ * result fits in `output`.
+ *
+ * If the returned size is bigger than `capacity`, only the first `capacity`
+ * glyphs were written, so call this again with a big enough buffer.
+ *
+ * `output` can be the same as `glyph_array` to apply the chain in place, in
+ * which case the input is lost even if the result doesn't fit.
+ * Otherwise the two must not overlap.
+ *
+ * Like ::LBT_apply_chain, this can be called from multiple threads with the
+ * same chain.
+ *
+ * \param[in] chain
+ * \param[in] glyph_array Array of glyphs to "ligate".
+ * \param[in] n_input_glyphs Number of glyphs in `glyph_array`.
+ * \param[out] output Where to write the "ligated" glyphs.
+ * \param[in] capacity Number of glyphs that fit in `output`.
+ * \return Number of "ligated" glyphs, or 0 if a bigger buffer couldn't be
+ *         allocated.
+ */
+size_t LIBATURES_PUBLIC LBT_apply_chain_to_buffer(const LBT_Chain *chain,
+                                                  const LBT_Glyph* glyph_array,
+                                                  size_t n_input_glyphs,
+                                                  LBT_Glyph *output,
+                                                  size_t capacity);
+
+/**
+ * \brief Apply chain to an `LBT_Glyph` array, without copying it if nothing
+ * changes.
+ *
+ * Most glyph runs aren't affected by the chain. In that case `*output` is set
+ * to `NULL`, and nothing is allocated: `glyph_array` is already the result.
+ * Changes may be reported conservatively: a run can come out as changed even
+ * if the result has the same glyphs, for instance when substitutions are later
+ * undone by other ones.
+ * Otherwise `*output` is set to a new array, like the one returned by
+ * ::LBT_apply_chain, or to `NULL` if it couldn't be allocated.
+ *
+ * Like ::LBT_apply_chain, this can be called from multiple threads with the
+ * same chain.
+ *
+ * \param[in] chain
+ * \param[in] glyph_array Array of glyphs to "ligate".
+ * \param[in] n_input_glyphs Number of glyphs in `glyph_array`.
+ * \param[out] output Array of "ligated" glyphs, or `NULL` if nothing changed.
+ * \param[out] n_output_glyphs Number of "ligated" glyphs.
+ * \return `true` if the glyphs were changed.
+ */
+bool LIBATURES_PUBLIC LBT_apply_chain_if_changed(const LBT_Chain *chain,
+                                                 const LBT_Glyph* glyph_array,
+                                                 size_t n_input_glyphs,
+                                                 LBT_Glyph **output,
+                                                 size_t *n_output_glyphs);
+
+/**
+ * \brief Create an LBT_Workspace.
+ *
+ * A workspace keeps the memory needed to apply chains between calls to
+ * ::LBT_apply_chain_with_workspace, so that once it has grown enough they
+ * don't need to allocate anything.
+ *
+ * It can be used with any chain, but only by one thread at a time.
+ *
+ * Needs to be destroyed by ::LBT_destroy_workspace.
+ */
+LBT_Workspace LIBATURES_PUBLIC *LBT_new_workspace(void);
+
+/**
+ * \brief Destroy an LBT_Workspace.
+ *
+ * This invalidates the arrays returned by ::LBT_apply_chain_with_workspace.
+ *
+ * \param[in,out] workspace
+ */
+void LIBATURES_PUBLIC LBT_destroy_workspace(LBT_Workspace *workspace);
+
+/**
+ * \brief Apply chain to an `LBT_Glyph` array, using the memory of `workspace`.
+ *
+ * The returned array belongs to `workspace`, and is only valid until it's used
+ * again or destroyed.
+ *
+ * \param[in] chain
+ * \param[in,out] workspace
+ * \param[in] glyph_array Array of glyphs to "ligate".
+ * \param[in] n_input_glyphs Number of glyphs in `glyph_array`.
+ * \param[out] n_output_glyphs Number of glyphs returned.
+ * \return Array of "ligated" glyphs, or `NULL` if memory couldn't be
+ *         allocated.
+ */
+const LBT_Glyph LIBATURES_PUBLIC *LBT_apply_chain_with_workspace(const LBT_Chain *chain,
+                                                                 LBT_Workspace *workspace,
+                                                                 const LBT_Glyph* glyph_array,
+                                                                 size_t n_input_glyphs,
+                                                                 size_t *n_output_glyphs);
+
+/**
+ * \brief Create an LBT_Pool of threads to apply chains with.
+ *
+ * The thread calling ::LBT_apply_chain_batch also does its part of the work,
+ * so `n_threads - 1` threads are started.
+ *
+ * Needs to be destroyed by ::LBT_destroy_pool.
+ *
+ * \param[in] n_threads Number of threads to use, or 0 to use one per CPU.
+ */
+LBT_Pool LIBATURES_PUBLIC *LBT_new_pool(size_t n_threads);
+
+/**
+ * \brief Get the number of threads used by an LBT_Pool.
+ *
+ * \param[in] pool
+ * \return Number of threads, including the calling one.
+ */
+size_t LIBATURES_PUBLIC LBT_get_pool_threads(const LBT_Pool *pool);
+
+/**
+ * \brief Destroy an LBT_Pool, stopping its threads.
+ *
+ * \param[in,out] pool
+ */
+void LIBATURES_PUBLIC LBT_destroy_pool(LBT_Pool *pool);
+
+/**
+ * \brief Apply chain to many `LBT_Glyph` arrays at once.
+ *
+ * All the results are written one after the other to the returned array,
+ * with the one of `runs[i]` going from `offsets[i]` to `offsets[i + 1]`.
+ *
+ * With a `pool`, the runs are split between its threads, which take work from
+ * each other when they finish early.
+ * A pool can be used with any chain, and while it can be shared between
+ * threads, it only applies one batch at a time.
+ * Without one, the runs are done by the calling thread.
+ *
+ * \param[in] chain
+ * \param[in,out] pool Threads to use, or `NULL`.
+ * \param[in] runs Arrays of glyphs to "ligate".
+ * \param[in] n_runs Number of elements in `runs`.
+ * \param[out] offsets Where each result starts, `n_runs + 1` elements.
+ * \return Array of all the "ligated" glyphs, or `NULL` if memory couldn't be
+ *         allocated.
+ */
+LBT_Glyph LIBATURES_PUBLIC *LBT_apply_chain_batch(const LBT_Chain *chain,
+                                                  LBT_Pool *pool,
+                                                  const LBT_Run *runs,
+                                                  size_t n_runs,
+                                                  size_t *offsets);
+
+/**
+ * \brief Apply chain to a long `LBT_Glyph` array, using all the threads of
+ * `pool`.
+ *
+ * The glyphs are split where no lookup of the chain can see across, and the
+ * parts are applied like with ::LBT_apply_chain_batch. The result is the same
+ * as the one of ::LBT_apply_chain.
+ *
+ * Only worth it for very long runs, shorter ones are applied directly.
+ *
+ * \param[in] chain
+ * \param[in,out] pool Threads to use, or `NULL`.
+ * \param[in] glyph_array Array of glyphs to "ligate".
+ * \param[in] n_input_glyphs Number of glyphs in `glyph_array`.
+ * \param[out] n_output_glyphs Number of glyphs returned.
+ * \return Array of "ligated" glyphs, or `NULL` if memory couldn't be
+ *         allocated.
+ */
+LBT_Glyph LIBATURES_PUBLIC *LBT_apply_chain_parallel(const LBT_Chain *chain,
+                                                     LBT_Pool *pool,
+                                                     const LBT_Glyph* glyph_array,
+                                                     size_t n_input_glyphs,
+                                                     size_t *n_output_glyphs);
+
+/**
+ * \brief Create an LBT_ShapedRun, applying chain to an `LBT_Glyph` array.
+ *
+ * A shaped run keeps its input and its "ligated" glyphs, so that after an edit
+ * with ::LBT_edit_shaped_run only the part of the run around it needs to be
+ * applied again.
+ *
+ * The chain must outlive the shaped run.
+ * Needs to be destroyed by ::LBT_destroy_shaped_run.
+ *
+ * \param[in] chain
+ * \param[in] glyph_array Array of glyphs to "ligate".
+ * \param[in] n_input_glyphs Number of glyphs in `glyph_array`.
+ * \return The shaped run, or `NULL` if memory couldn't be allocated.
+ */
+LBT_ShapedRun LIBATURES_PUBLIC *LBT_new_shaped_run(const LBT_Chain *chain,
+                                                   const LBT_Glyph* glyph_array,
+                                                   size_t n_input_glyphs);
+
+/**
+ * \brief Replace some input glyphs of an LBT_ShapedRun.
+ *
+ * The input glyphs from `from` to `to` are replaced with `glyph_array`, and the
+ * chain is applied again only to the segments (see ::LBT_find_segments) that
+ * the edit touches.
+ *
+ * If this fails the shaped run can only be destroyed.
+ *
+ * \param[in,out] run
+ * \param[in] from First input glyph to replace.
+ * \param[in] to End of the input glyphs to replace, `from` to insert.
+ * \param[in] glyph_array Glyphs to put in their place.
+ * \param[in] n_input_glyphs Number of glyphs in `glyph_array`.
+ * \return `false` if the range isn't valid, or memory couldn't be allocated.
+ */
+bool LIBATURES_PUBLIC LBT_edit_shaped_run(LBT_ShapedRun *run,
+                                          size_t from,
+                                          size_t to,
+                                          const LBT_Glyph* glyph_array,
+                                          size_t n_input_glyphs);
+
+/**
+ * \brief Get the "ligated" glyphs of an LBT_ShapedRun.
+ *
+ * The returned array belongs to `run`, and is only valid until it's edited or
+ * destroyed.
+ *
+ * \param[in] run
+ * \param[out] n_output_glyphs Number of glyphs returned.
+ * \return Array of "ligated" glyphs.
+ */
+const LBT_Glyph LIBATURES_PUBLIC *LBT_get_shaped_run_output(const LBT_ShapedRun *run,
+                                                            size_t *n_output_glyphs);
+
+/**
+ * \brief Destroy an LBT_ShapedRun.
+ *
+ * \param[in,out] run
+ */
+void LIBATURES_PUBLIC LBT_destroy_shaped_run(LBT_ShapedRun *run);
+
 /**
  * \brief Destroy a Chain.
  *
+ * If the chain is shared (see ::LBT_generate_chain), this only releases this
+ * reference to it.
  * This will not free the relative FreeType tables.
  * The generated `GlyphArray`s are still usable.
  *
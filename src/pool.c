@@ -0,0 +1,258 @@
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "pool.h"
+
+typedef struct {
+  // Tasks still in the range of the worker.
+  // The first one is in the low 32 bits, the end in the high ones, so that
+  // the worker and the thieves can update them together.
+  _Atomic uint64_t range;
+  // Keep each range in its own cache line
+  char _padding[64 - sizeof(uint64_t)];
+} WorkerQueue;
+
+typedef struct {
+  Pool *pool;
+  size_t worker;
+} WorkerArgs;
+
+typedef struct LBT_Pool {
+  size_t n_workers; // Including the calling thread
+  size_t n_threads; // Threads actually started
+  pthread_t *threads;
+  WorkerArgs *args;
+  WorkerQueue *queues;
+  Workspace **workspaces;
+  GlyphArray *arenas;
+
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  pthread_cond_t done;
+  uint64_t generation; // Incremented for each job
+  size_t active; // Threads still working on the current job
+  bool shutdown;
+
+  // Current job
+  PoolTask task;
+  void *data;
+
+  pthread_mutex_t run_lock; // Held by the thread using the pool
+} Pool;
+
+#define range_first(range) ((uint32_t)(range))
+#define range_end(range) ((uint32_t)((range) >> 32))
+#define make_range(first, end) (((uint64_t)(end) << 32) | (uint32_t)(first))
+
+static size_t get_cpu_count(void) {
+#if defined(_WIN32)
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return info.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (size_t)n : 1;
+#else
+  return 1;
+#endif
+}
+
+static bool take_first(WorkerQueue *queue, size_t *task) {
+  uint64_t range = atomic_load(&queue->range);
+  while (range_first(range) < range_end(range)) {
+    uint64_t taken = make_range(range_first(range) + 1, range_end(range));
+    if (atomic_compare_exchange_weak(&queue->range, &range, taken)) {
+      *task = range_first(range);
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool take_last(WorkerQueue *queue, size_t *task) {
+  uint64_t range = atomic_load(&queue->range);
+  while (range_first(range) < range_end(range)) {
+    uint64_t taken = make_range(range_first(range), range_end(range) - 1);
+    if (atomic_compare_exchange_weak(&queue->range, &range, taken)) {
+      *task = range_end(range) - 1;
+      return true;
+    }
+  }
+  return false;
+}
+
+static void work(Pool *pool, size_t worker) {
+  size_t task;
+  for (;;) {
+    if (take_first(&pool->queues[worker], &task)) {
+      pool->task(pool->data, worker, task);
+      continue;
+    }
+    // No tasks are added while a job runs, so if all the ranges are empty,
+    // there's nothing left to do.
+    bool stolen = false;
+    for (size_t i = 1; i < pool->n_workers && !stolen; i++) {
+      stolen = take_last(&pool->queues[(worker + i) % pool->n_workers], &task);
+    }
+    if (!stolen) return;
+    pool->task(pool->data, worker, task);
+  }
+}
+
+static void *worker_main(void *arg) {
+  const WorkerArgs *args = arg;
+  Pool *pool = args->pool;
+  uint64_t seen = 0;
+
+  pthread_mutex_lock(&pool->lock);
+  for (;;) {
+    while (!pool->shutdown && pool->generation == seen) {
+      pthread_cond_wait(&pool->wake, &pool->lock);
+    }
+    if (pool->shutdown) break;
+    seen = pool->generation;
+    pthread_mutex_unlock(&pool->lock);
+
+    work(pool, args->worker);
+
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->active == 0) {
+      pthread_cond_signal(&pool->done);
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return NULL;
+}
+
+Pool *Pool_new(size_t n_workers) {
+  if (n_workers == 0) n_workers = get_cpu_count();
+
+  Pool *pool = calloc(1, sizeof(Pool));
+  if (pool == NULL) return NULL;
+  pool->n_workers = n_workers;
+  pool->threads = calloc(n_workers, sizeof(pthread_t));
+  pool->args = calloc(n_workers, sizeof(WorkerArgs));
+  pool->queues = calloc(n_workers, sizeof(WorkerQueue));
+  pool->workspaces = calloc(n_workers, sizeof(Workspace *));
+  pool->arenas = calloc(n_workers, sizeof(GlyphArray));
+  if (pool->threads == NULL || pool->args == NULL || pool->queues == NULL ||
+      pool->workspaces == NULL || pool->arenas == NULL) {
+    goto fail;
+  }
+  for (size_t i = 0; i < n_workers; i++) {
+    pool->workspaces[i] = Workspace_new();
+    if (pool->workspaces[i] == NULL) goto fail;
+    GlyphArray_init(&pool->arenas[i]);
+  }
+
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->wake, NULL);
+  pthread_cond_init(&pool->done, NULL);
+  pthread_mutex_init(&pool->run_lock, NULL);
+
+  // Worker 0 is the thread calling Pool_run
+  for (size_t i = 1; i < n_workers; i++) {
+    pool->args[i].pool = pool;
+    pool->args[i].worker = i;
+    if (pthread_create(&pool->threads[i], NULL, worker_main, &pool->args[i]) != 0) {
+      Pool_free(pool);
+      return NULL;
+    }
+    pool->n_threads++;
+  }
+  return pool;
+
+fail:
+  if (pool->workspaces != NULL) {
+    for (size_t i = 0; i < n_workers; i++) {
+      Workspace_free(pool->workspaces[i]);
+    }
+  }
+  free(pool->threads);
+  free(pool->args);
+  free(pool->queues);
+  free(pool->workspaces);
+  free(pool->arenas);
+  free(pool);
+  return NULL;
+}
+
+void Pool_free(Pool *pool) {
+  if (pool == NULL) return;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->shutdown = true;
+  pthread_cond_broadcast(&pool->wake);
+  pthread_mutex_unlock(&pool->lock);
+  for (size_t i = 1; i <= pool->n_threads; i++) {
+    pthread_join(pool->threads[i], NULL);
+  }
+
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->wake);
+  pthread_cond_destroy(&pool->done);
+  pthread_mutex_destroy(&pool->run_lock);
+
+  for (size_t i = 0; i < pool->n_workers; i++) {
+    Workspace_free(pool->workspaces[i]);
+    GlyphArray_free_storage(&pool->arenas[i]);
+  }
+  free(pool->threads);
+  free(pool->args);
+  free(pool->queues);
+  free(pool->workspaces);
+  free(pool->arenas);
+  free(pool);
+}
+
+size_t Pool_get_workers(const Pool *pool) {
+  return pool->n_workers;
+}
+
+Workspace *Pool_get_workspace(Pool *pool, size_t worker) {
+  return pool->workspaces[worker];
+}
+
+GlyphArray *Pool_get_arena(Pool *pool, size_t worker) {
+  return &pool->arenas[worker];
+}
+
+void Pool_acquire(Pool *pool) {
+  pthread_mutex_lock(&pool->run_lock);
+}
+
+void Pool_release(Pool *pool) {
+  pthread_mutex_unlock(&pool->run_lock);
+}
+
+void Pool_run(Pool *pool, PoolTask task, void *data, size_t n_tasks) {
+  // Split the tasks evenly, the rest is balanced by stealing
+  size_t n_workers = pool->n_workers;
+  for (size_t i = 0; i < n_workers; i++) {
+    size_t first = n_tasks * i / n_workers;
+    size_t end = n_tasks * (i + 1) / n_workers;
+    atomic_store(&pool->queues[i].range, make_range(first, end));
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  pool->task = task;
+  pool->data = data;
+  pool->active = pool->n_threads;
+  pool->generation++;
+  pthread_cond_broadcast(&pool->wake);
+  pthread_mutex_unlock(&pool->lock);
+
+  work(pool, 0);
+
+  pthread_mutex_lock(&pool->lock);
+  while (pool->active > 0) {
+    pthread_cond_wait(&pool->done, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "workspace.h"
+
+// Called for each task by the worker that took it.
+typedef void (*PoolTask)(void *data, size_t worker, size_t task);
+
+// A set of threads that split tasks between them.
+// Tasks are handed out in contiguous ranges, one per worker, and workers that
+// run out of tasks steal them from the end of the other ranges.
+// The thread calling Pool_run is worker 0, so it also runs tasks.
+// Pool_run, and the workspaces and arenas, can only be used between
+// Pool_acquire and Pool_release, as only one thread can use the pool at a time.
+typedef struct LBT_Pool Pool;
+
+Pool *Pool_new(size_t n_workers);
+void Pool_free(Pool *pool);
+size_t Pool_get_workers(const Pool *pool);
+Workspace *Pool_get_workspace(Pool *pool, size_t worker);
+GlyphArray *Pool_get_arena(Pool *pool, size_t worker);
+void Pool_acquire(Pool *pool);
+void Pool_release(Pool *pool);
+void Pool_run(Pool *pool, PoolTask task, void *data, size_t n_tasks);
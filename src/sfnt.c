@@ -0,0 +1,83 @@
+#include <string.h>
+
+#include "sfnt.h"
+#include "bswap.h"
+
+#define SFNT_VERSION_TRUETYPE 0x00010000
+#define SFNT_VERSION_CFF 0x4F54544F // 'OTTO'
+#define SFNT_VERSION_APPLE 0x74727565 // 'true'
+
+static const unsigned char ttcf_tag[4] = {'t', 't', 'c', 'f'};
+
+static bool is_collection(const uint8_t *data, size_t len) {
+  return len >= sizeof(TTCHeader) && memcmp(((const TTCHeader *)data)->ttcTag, ttcf_tag, 4) == 0;
+}
+
+// Returns the number of faces in a collection, 0 if it's malformed.
+static size_t count_collection_faces(const uint8_t *data, size_t len) {
+  const TTCHeader *header = (const TTCHeader *)data;
+  uint32_t numFonts = parse_32(header->numFonts);
+  if ((len - sizeof(TTCHeader)) / sizeof(uint32_t) < numFonts) return 0;
+  return numFonts;
+}
+
+// Returns the table directory of a face, if it's there and it fits in the data.
+static const TableDirectory *get_TableDirectory(const uint8_t *data, size_t len, size_t face_index) {
+  if (data == NULL) return NULL;
+  size_t offset = 0;
+  if (is_collection(data, len)) {
+    if (face_index >= count_collection_faces(data, len)) return NULL;
+    offset = parse_32(((const TTCHeader *)data)->tableDirectoryOffsets[face_index]);
+  } else if (face_index != 0) {
+    return NULL;
+  }
+  if (offset > len || len - offset < sizeof(TableDirectory)) return NULL;
+
+  const TableDirectory *directory = (const TableDirectory *)(data + offset);
+  uint32_t sfntVersion = parse_32(directory->sfntVersion);
+  if (sfntVersion != SFNT_VERSION_TRUETYPE && sfntVersion != SFNT_VERSION_CFF && sfntVersion != SFNT_VERSION_APPLE) {
+    return NULL;
+  }
+  if ((len - offset - sizeof(TableDirectory)) / sizeof(TableRecord) < parse_16(directory->numTables)) return NULL;
+  return directory;
+}
+
+size_t count_sfnt_faces(const uint8_t *data, size_t len) {
+  if (data != NULL && is_collection(data, len)) return count_collection_faces(data, len);
+  return get_TableDirectory(data, len, 0) != NULL ? 1 : 0;
+}
+
+bool find_sfnt_table(const uint8_t *data, size_t len, size_t face_index, const unsigned char (*tag)[4], const uint8_t **table, size_t *table_len) {
+  *table = NULL;
+  *table_len = 0;
+  const TableDirectory *directory = get_TableDirectory(data, len, face_index);
+  if (directory == NULL) return false;
+
+  uint16_t numTables = parse_16(directory->numTables);
+  for (uint16_t i = 0; i < numTables; i++) {
+    const TableRecord *record = &directory->tableRecords[i];
+    if (memcmp(record->tableTag, *tag, 4) != 0) continue;
+    // Offsets are from the start of the file, even in collections
+    uint32_t offset = parse_32(record->offset);
+    uint32_t length = parse_32(record->length);
+    if (offset > len || length > len - offset) return false;
+    *table = data + offset;
+    *table_len = length;
+    return true;
+  }
+  return true;
+}
+
+uint32_t sfnt_checksum(const uint8_t *table, size_t len) {
+  uint32_t sum = 0;
+  size_t i = 0;
+  for (; i + 4 <= len; i += 4) {
+    sum += (uint32_t)table[i] << 24 | (uint32_t)table[i + 1] << 16 | (uint32_t)table[i + 2] << 8 | table[i + 3];
+  }
+  // The table is padded with zeros to a multiple of 4 bytes
+  uint32_t last = 0;
+  for (size_t shift = 24; i < len; i++, shift -= 8) {
+    last |= (uint32_t)table[i] << shift;
+  }
+  return sum + last;
+}
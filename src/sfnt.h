@@ -0,0 +1,45 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#pragma pack(push, 1)
+
+/** Table Directory **/
+typedef struct {
+  uint8_t tableTag[4];
+  uint32_t checksum;
+  uint32_t offset; // From the start of the font file
+  uint32_t length;
+} TableRecord;
+
+typedef struct {
+  uint32_t sfntVersion; // 0x00010000, 'OTTO' or 'true'
+  uint16_t numTables;
+  uint16_t searchRange;
+  uint16_t entrySelector;
+  uint16_t rangeShift;
+  TableRecord tableRecords[];
+} TableDirectory;
+
+/** Collection Header **/
+typedef struct {
+  uint8_t ttcTag[4]; // 'ttcf'
+  uint16_t majorVersion;
+  uint16_t minorVersion;
+  uint32_t numFonts;
+  uint32_t tableDirectoryOffsets[];
+} TTCHeader;
+
+#pragma pack(pop)
+
+// Returns how many faces the font data has: numFonts for a collection, 1 for
+// a single font, 0 if it isn't a valid sfnt font.
+size_t count_sfnt_faces(const uint8_t *data, size_t len);
+// Finds the table with the specified tag in a face of the font data, without
+// copying it. face_index must be 0 for a single font.
+// Returns false if the face isn't a valid sfnt font, or the table doesn't fit
+// in the data. If the table is missing, returns true and sets table to NULL.
+bool find_sfnt_table(const uint8_t *data, size_t len, size_t face_index, const unsigned char (*tag)[4], const uint8_t **table, size_t *table_len);
+// The checksum of a table, as in its TableRecord.
+uint32_t sfnt_checksum(const uint8_t *table, size_t len);
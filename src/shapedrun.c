@@ -0,0 +1,104 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "shapedrun.h"
+
+ShapedRun *ShapedRun_new(const Chain *chain, const uint16_t *glyphs, size_t len) {
+  ShapedRun *run = calloc(1, sizeof(ShapedRun));
+  if (run == NULL) return NULL;
+  run->chain = chain;
+  GlyphArray_init(&run->input);
+  GlyphArray_init(&run->output);
+  run->workspace = Workspace_new();
+  if (run->workspace == NULL) goto fail;
+  // Applying the whole run is just an edit of an empty one
+  if (!ShapedRun_edit(run, 0, 0, glyphs, len)) goto fail;
+  return run;
+
+fail:
+  ShapedRun_free(run);
+  return NULL;
+}
+
+void ShapedRun_free(ShapedRun *run) {
+  if (run == NULL) return;
+  GlyphArray_free_storage(&run->input);
+  GlyphArray_free_storage(&run->output);
+  Workspace_free(run->workspace);
+  free(run->segments);
+  free(run);
+}
+
+// Replaces count segments from index with the ones in new_segments.
+static bool ShapedRun_replace_segments(ShapedRun *run, size_t index, size_t count, const ShapedSegment *new_segments, size_t new_count) {
+  size_t segment_count = run->segment_count - count + new_count;
+  if (segment_count > run->segments_allocated) {
+    size_t allocated = run->segments_allocated * 2 > segment_count ? run->segments_allocated * 2 : segment_count;
+    ShapedSegment *segments = realloc(run->segments, allocated * sizeof(ShapedSegment));
+    if (segments == NULL) return false;
+    run->segments = segments;
+    run->segments_allocated = allocated;
+  }
+  // segments can still be NULL, which memmove and memcpy don't allow
+  size_t after = run->segment_count - index - count;
+  if (after > 0 && new_count != count) {
+    memmove(&run->segments[index + new_count], &run->segments[index + count], after * sizeof(ShapedSegment));
+  }
+  if (new_count > 0) memcpy(&run->segments[index], new_segments, new_count * sizeof(ShapedSegment));
+  run->segment_count = segment_count;
+  return true;
+}
+
+// Replaces the input glyphs in [from, to) with glyphs.
+// The segments touching the edit are applied again, from the one before it,
+// which the new glyphs could join, to the one after it.
+bool ShapedRun_edit(ShapedRun *run, size_t from, size_t to, const uint16_t *glyphs, size_t len) {
+  if (from > to || to > run->input.len) return false;
+
+  // Find the segments from the one with glyph from - 1 to the one with glyph to
+  size_t first = 0, input_start = 0, output_start = 0;
+  while (first < run->segment_count && input_start + run->segments[first].input_len < from) {
+    input_start += run->segments[first].input_len;
+    output_start += run->segments[first].output_len;
+    first++;
+  }
+  size_t last = first, input_end = input_start, output_end = output_start;
+  while (last < run->segment_count && input_end <= to) {
+    input_end += run->segments[last].input_len;
+    output_end += run->segments[last].output_len;
+    last++;
+  }
+
+  GlyphArray window;
+  GlyphArray_init(&window);
+  ShapedSegment *new_segments = NULL;
+  size_t new_count = 0;
+  bool result = false;
+
+  // The input stays the same outside of the segments, so they still end
+  // after glyphs that no Lookup touches.
+  if (!GlyphArray_splice(&run->input, from, to - from, glyphs, len)) goto end;
+  input_end = input_end - (to - from) + len;
+
+  // Each segment has at least a glyph
+  new_segments = malloc((input_end - input_start + 1) * sizeof(ShapedSegment));
+  if (new_segments == NULL) goto end;
+  GlyphArray *ga = &run->workspace->glyphs;
+  for (size_t start = input_start; start < input_end;) {
+    size_t end = find_segment_end(run->chain, run->input.array, start, input_end, NULL);
+    GlyphArray_clear(ga);
+    if (!GlyphArray_append(ga, &run->input.array[start], end - start)) goto end;
+    apply_chain(run->chain, run->workspace, ga);
+    if (!GlyphArray_append(&window, ga->array, ga->len)) goto end;
+    new_segments[new_count++] = (ShapedSegment){ .input_len = end - start, .output_len = ga->len };
+    start = end;
+  }
+
+  if (!GlyphArray_splice(&run->output, output_start, output_end - output_start, window.array, window.len)) goto end;
+  result = ShapedRun_replace_segments(run, first, last - first, new_segments, new_count);
+
+end:
+  GlyphArray_free_storage(&window);
+  free(new_segments);
+  return result;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "glypharray.h"
+#include "gsub.h"
+#include "workspace.h"
+
+// How much of the input and the output a segment takes.
+typedef struct {
+  size_t input_len;
+  size_t output_len;
+} ShapedSegment;
+
+// The input and output of applying a chain, kept by segment (see
+// find_segment_end), so that after an edit only the segments around it need
+// to be applied again.
+typedef struct LBT_ShapedRun {
+  const Chain *chain;
+  GlyphArray input;
+  GlyphArray output;
+  ShapedSegment *segments;
+  size_t segment_count;
+  size_t segments_allocated;
+  Workspace *workspace;
+} ShapedRun;
+
+ShapedRun *ShapedRun_new(const Chain *chain, const uint16_t *glyphs, size_t len);
+void ShapedRun_free(ShapedRun *run);
+bool ShapedRun_edit(ShapedRun *run, size_t from, size_t to, const uint16_t *glyphs, size_t len);
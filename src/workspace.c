@@ -0,0 +1,24 @@
+#include <stdlib.h>
+
+#include "workspace.h"
+
+Workspace *Workspace_new(void) {
+  Workspace *workspace = malloc(sizeof(Workspace));
+  if (workspace == NULL) return NULL;
+  // Storage is allocated the first time it's needed
+  GlyphArray_init(&workspace->glyphs);
+  for (size_t i = 0; i < WORKSPACE_NESTED_DEPTH; i++) {
+    GlyphArray_init(&workspace->nested[i]);
+  }
+  workspace->depth = 0;
+  return workspace;
+}
+
+void Workspace_free(Workspace *workspace) {
+  if (workspace == NULL) return;
+  GlyphArray_free_storage(&workspace->glyphs);
+  for (size_t i = 0; i < WORKSPACE_NESTED_DEPTH; i++) {
+    GlyphArray_free_storage(&workspace->nested[i]);
+  }
+  free(workspace);
+}
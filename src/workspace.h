@@ -0,0 +1,23 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "glypharray.h"
+
+// Nested rules deeper than this use temporary arrays instead.
+#define WORKSPACE_NESTED_DEPTH 16
+
+// Memory reused between applications of chains, so that they don't need to
+// allocate once it has grown enough.
+// A Workspace can only be used by one thread at a time.
+typedef struct LBT_Workspace {
+  // The glyphs the chain is applied to
+  GlyphArray glyphs;
+  // Inputs of the contextual rules being applied, by nesting depth
+  GlyphArray nested[WORKSPACE_NESTED_DEPTH];
+  size_t depth;
+} Workspace;
+
+Workspace *Workspace_new(void);
+void Workspace_free(Workspace *workspace);
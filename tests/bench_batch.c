@@ -0,0 +1,111 @@
+#include <libatures.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "test_common.h"
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+// Measures how LBT_apply_chain_batch scales from 1 thread to the number of
+// CPUs, or to the number of threads passed as the first argument.
+
+#define N_RUNS 20000
+#define N_REPETITIONS 5
+
+static const char *lines[] = {
+  "if (a != b && c <= d || e >= f) {",
+  "  return x->y == z ? 1/2 : 3/4;",
+  "}",
+  "<!-- www --> ::= |> <| ... ;;",
+  "let f = |x| x >>= g <$> h <*> i;",
+  "// The quick brown fox jumps over the lazy dog",
+  "0xFF 0b1010 1_000_000 == 1e6",
+  "#[derive(Debug)] fn main() -> () {}",
+};
+#define N_LINES (sizeof(lines) / sizeof(lines[0]))
+
+static LBT_tag features[] = { LBT_make_tag("calt"), LBT_make_tag("frac"), LBT_make_tag("zero"), LBT_make_tag("ss01") };
+#define N_FEATURES (sizeof(features) / sizeof(features[0]))
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Best time out of N_REPETITIONS
+static double time_batch(const LBT_Chain *chain, LBT_Pool *pool, const LBT_Run *runs, size_t *offsets) {
+  double best = -1;
+  for (int i = 0; i < N_REPETITIONS; i++) {
+    double start = now();
+    LBT_Glyph *out = LBT_apply_chain_batch(chain, pool, runs, N_RUNS, offsets);
+    double elapsed = now() - start;
+    if (out == NULL) {
+      fprintf(stderr, "error: batch failed\n");
+      exit(EXIT_FAILURE);
+    }
+    free(out);
+    if (best < 0 || elapsed < best) best = elapsed;
+  }
+  return best;
+}
+
+int main(int argc, char **argv) {
+  FT_Library lib;
+  FT_Face face;
+  init_freetype(&lib);
+  load_font(lib, "tests/JetBrainsMono-Regular.ttf", &face);
+
+  LBT_ChainCreator *cc = LBT_new(face);
+  LBT_Chain *chain = LBT_generate_chain(cc, NULL, NULL, features, N_FEATURES);
+
+  LBT_Glyph *inputs[N_LINES];
+  for (size_t i = 0; i < N_LINES; i++) {
+    inputs[i] = utf8_to_GlyphID(face, lines[i], strlen(lines[i]));
+  }
+
+  LBT_Run *runs = malloc(N_RUNS * sizeof(LBT_Run));
+  size_t *offsets = malloc((N_RUNS + 1) * sizeof(size_t));
+  size_t n_glyphs = 0;
+  for (size_t i = 0; i < N_RUNS; i++) {
+    runs[i].glyphs = inputs[i % N_LINES];
+    runs[i].len = strlen(lines[i % N_LINES]);
+    n_glyphs += runs[i].len;
+  }
+
+  size_t max_threads = 0;
+  if (argc > 1) {
+    max_threads = strtoul(argv[1], NULL, 10);
+  }
+  if (max_threads == 0) {
+    // A pool with 0 threads uses one per CPU
+    LBT_Pool *pool = LBT_new_pool(0);
+    max_threads = LBT_get_pool_threads(pool);
+    LBT_destroy_pool(pool);
+  }
+
+  printf("%zu runs, %zu glyphs\n", (size_t)N_RUNS, n_glyphs);
+  double single = time_batch(chain, NULL, runs, offsets);
+  printf("no pool:    %8.2f ms\n", single * 1e3);
+  for (size_t n = 1; n <= max_threads; n++) {
+    LBT_Pool *pool = LBT_new_pool(n);
+    double elapsed = time_batch(chain, pool, runs, offsets);
+    LBT_destroy_pool(pool);
+    printf("%3zu threads: %8.2f ms, %5.2fx, %6.1f Mglyphs/s\n",
+           n, elapsed * 1e3, single / elapsed, n_glyphs / elapsed / 1e6);
+  }
+
+  free(runs);
+  free(offsets);
+  for (size_t i = 0; i < N_LINES; i++) {
+    free(inputs[i]);
+  }
+  LBT_destroy_chain(chain);
+  LBT_destroy(cc);
+  destroy_font(face);
+  destroy_freetype(lib);
+  return 0;
+}
@@ -1,5 +1,7 @@
 #include <libatures.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "tap.h"
 #include "test_common.h"
@@ -83,6 +85,232 @@ static bool test_generate_chain_bad_feature(void) {
   return true;
 }
 
+static bool test_generate_chain_shared(void) {
+  LBT_tag features[] = { LBT_make_tag("calt"), LBT_make_tag("zero") };
+  LBT_tag reordered[] = { LBT_make_tag("zero"), LBT_make_tag("calt"), LBT_make_tag("zero") };
+  LBT_Chain *c1 = LBT_generate_chain(cc, NULL, NULL, features, 2);
+  LBT_Chain *c2 = LBT_generate_chain(cc, NULL, NULL, reordered, 3);
+  LBT_Chain *c3 = LBT_generate_chain(cc, NULL, NULL, features, 1);
+  bool result = c1 != NULL && c1 == c2 && c3 != NULL && c3 != c1;
+  LBT_destroy_chain(c1);
+  LBT_destroy_chain(c2);
+  LBT_destroy_chain(c3);
+  return result;
+}
+
+static bool test_generate_chain_outlives_creator(void) {
+  LBT_tag feature = LBT_make_tag("calt");
+  LBT_Glyph input[] = { FT_Get_Char_Index(face, '='), FT_Get_Char_Index(face, '='), FT_Get_Char_Index(face, '>') };
+  LBT_ChainCreator *other = LBT_new(face);
+  LBT_Chain *c1 = LBT_generate_chain(other, NULL, NULL, &feature, 1);
+  LBT_Chain *c2 = LBT_generate_chain(cc, NULL, NULL, &feature, 1);
+  LBT_destroy(other);
+  bool result = false;
+  if (c1 == NULL || c2 == NULL) goto end;
+  size_t n1, n2;
+  LBT_Glyph *g1 = LBT_apply_chain(c1, input, 3, &n1);
+  LBT_Glyph *g2 = LBT_apply_chain(c2, input, 3, &n2);
+  result = g1 != NULL && g2 != NULL && n1 == n2 && memcmp(g1, g2, n1 * sizeof(LBT_Glyph)) == 0 &&
+           memcmp(g1, input, sizeof(input)) != 0;
+  free(g1);
+  free(g2);
+end:
+  LBT_destroy_chain(c1);
+  LBT_destroy_chain(c2);
+  return result;
+}
+
+// Lookups are compiled as chains need them, and the ones generated before
+// still work while the compiled Lookups grow.
+static bool test_generate_chain_compiled_later(void) {
+  LBT_tag feature = LBT_make_tag("frac");
+  LBT_tag later = LBT_make_tag("calt");
+  LBT_Glyph input[] = { FT_Get_Char_Index(face, '1'), FT_Get_Char_Index(face, '/'), FT_Get_Char_Index(face, '2') };
+  LBT_ChainCreator *other = LBT_new(face);
+  LBT_Chain *c1 = LBT_generate_chain(other, NULL, NULL, &feature, 1);
+  size_t n1 = 0, n2 = 0;
+  LBT_Glyph *g1 = c1 != NULL ? LBT_apply_chain(c1, input, 3, &n1) : NULL;
+  // calt has many more Lookups
+  LBT_Chain *c2 = LBT_generate_chain(other, NULL, NULL, &later, 1);
+  LBT_Glyph *g2 = c1 != NULL ? LBT_apply_chain(c1, input, 3, &n2) : NULL;
+  bool result = c2 != NULL && g1 != NULL && g2 != NULL && n1 == n2 &&
+                memcmp(g1, g2, n1 * sizeof(LBT_Glyph)) == 0 && memcmp(g1, input, sizeof(input)) != 0;
+  free(g1);
+  free(g2);
+  LBT_destroy_chain(c1);
+  LBT_destroy_chain(c2);
+  LBT_destroy(other);
+  return result;
+}
+
+static uint8_t *read_file(const char *filename, size_t *len) {
+  FILE *f = fopen(filename, "rb");
+  if (f == NULL) return NULL;
+  uint8_t *data = NULL;
+  if (fseek(f, 0, SEEK_END) != 0) goto end;
+  long size = ftell(f);
+  if (size < 0 || fseek(f, 0, SEEK_SET) != 0) goto end;
+  data = malloc(size);
+  if (data != NULL && fread(data, 1, size, f) != (size_t)size) {
+    free(data);
+    data = NULL;
+  }
+  *len = size;
+end:
+  fclose(f);
+  return data;
+}
+
+static bool test_generate_chain_from_memory(void) {
+  LBT_tag feature = LBT_make_tag("calt");
+  LBT_Glyph input[] = { FT_Get_Char_Index(face, '='), FT_Get_Char_Index(face, '='), FT_Get_Char_Index(face, '>') };
+  size_t len;
+  uint8_t *data = read_file("tests/JetBrainsMono-Regular.ttf", &len);
+  if (data == NULL) return false;
+  bool result = false;
+  LBT_ChainCreator *other = LBT_new_from_memory(data, len);
+  LBT_Chain *c1 = other != NULL ? LBT_generate_chain(other, NULL, NULL, &feature, 1) : NULL;
+  LBT_Chain *c2 = LBT_generate_chain(cc, NULL, NULL, &feature, 1);
+  if (c1 == NULL || c2 == NULL) goto end;
+  size_t n1, n2;
+  LBT_Glyph *g1 = LBT_apply_chain(c1, input, 3, &n1);
+  LBT_Glyph *g2 = LBT_apply_chain(c2, input, 3, &n2);
+  result = g1 != NULL && g2 != NULL && n1 == n2 && memcmp(g1, g2, n1 * sizeof(LBT_Glyph)) == 0;
+  free(g1);
+  free(g2);
+end:
+  LBT_destroy_chain(c1);
+  LBT_destroy_chain(c2);
+  if (other != NULL) LBT_destroy(other);
+  free(data);
+  return result;
+}
+
+static bool test_generate_chain_from_bad_memory(void) {
+  size_t len;
+  uint8_t *data = read_file("tests/JetBrainsMono-Regular.ttf", &len);
+  if (data == NULL) return false;
+  // Cut in the middle of the table directory
+  LBT_ChainCreator *truncated = LBT_new_from_memory(data, 20);
+  data[0] = 'X';
+  LBT_ChainCreator *not_sfnt = LBT_new_from_memory(data, len);
+  bool result = truncated == NULL && not_sfnt == NULL;
+  if (truncated != NULL) LBT_destroy(truncated);
+  if (not_sfnt != NULL) LBT_destroy(not_sfnt);
+  free(data);
+  return result;
+}
+
+static void write_32(uint8_t *p, uint32_t value) {
+  p[0] = value >> 24;
+  p[1] = value >> 16;
+  p[2] = value >> 8;
+  p[3] = value;
+}
+
+// Builds a collection of three faces from a font: the first two point to the
+// same tables, and the third doesn't have a GSUB table.
+static uint8_t *make_collection(const uint8_t *font, size_t font_len, size_t *len) {
+  size_t n_tables = (font[4] << 8) | font[5];
+  size_t directory_len = 12 + 16 * n_tables;
+  size_t header_len = 12 + 3 * 4;
+  *len = header_len + font_len + 2 * directory_len;
+  uint8_t *data = malloc(*len);
+  if (data == NULL) return NULL;
+  memcpy(data, "ttcf\x00\x01\x00\x00", 8);
+  write_32(data + 8, 3);
+  memcpy(data + header_len, font, font_len);
+  for (size_t i = 0; i < n_tables; i++) {
+    uint8_t *offset = data + header_len + 12 + 16 * i + 8;
+    write_32(offset, ((uint32_t)offset[0] << 24 | offset[1] << 16 | offset[2] << 8 | offset[3]) + header_len);
+  }
+  for (size_t face = 0; face < 3; face++) {
+    size_t directory_offset = face == 0 ? header_len : header_len + font_len + (face - 1) * directory_len;
+    write_32(data + 12 + 4 * face, directory_offset);
+    if (face > 0) memcpy(data + directory_offset, data + header_len, directory_len);
+  }
+  uint8_t *directory = data + header_len + font_len + directory_len;
+  for (size_t i = 0; i < n_tables; i++) {
+    if (memcmp(directory + 12 + 16 * i, "GSUB", 4) == 0) memcpy(directory + 12 + 16 * i, "XXXX", 4);
+  }
+  return data;
+}
+
+static bool test_generate_chain_from_collection(void) {
+  LBT_tag feature = LBT_make_tag("calt");
+  LBT_Glyph input[] = { FT_Get_Char_Index(face, '='), FT_Get_Char_Index(face, '='), FT_Get_Char_Index(face, '>') };
+  size_t font_len, len;
+  uint8_t *font = read_file("tests/JetBrainsMono-Regular.ttf", &font_len);
+  if (font == NULL) return false;
+  uint8_t *data = make_collection(font, font_len, &len);
+  free(font);
+  if (data == NULL) return false;
+
+  bool result = false;
+  LBT_Chain *c1 = NULL, *c2 = NULL;
+  LBT_Collection *collection = LBT_new_collection(data, len);
+  if (collection == NULL || LBT_get_collection_size(collection) != 3) goto end;
+  LBT_ChainCreator *face0 = LBT_get_collection_face(collection, 0);
+  LBT_ChainCreator *face2 = LBT_get_collection_face(collection, 2);
+  if (face0 != LBT_get_collection_face(collection, 1) || face2 == face0 ||
+      LBT_get_collection_face(collection, 3) != NULL) goto end;
+
+  c1 = LBT_generate_chain(face0, NULL, NULL, &feature, 1);
+  c2 = LBT_generate_chain(face2, NULL, NULL, &feature, 1);
+  if (c1 == NULL || c2 == NULL) goto end;
+  size_t n1, n2;
+  LBT_Glyph *g1 = LBT_apply_chain(c1, input, 3, &n1);
+  LBT_Glyph *g2 = LBT_apply_chain(c2, input, 3, &n2);
+  // Without a GSUB table nothing changes
+  result = g1 != NULL && g2 != NULL && memcmp(g1, input, sizeof(input)) != 0 &&
+           n2 == 3 && memcmp(g2, input, sizeof(input)) == 0;
+  free(g1);
+  free(g2);
+end:
+  LBT_destroy_chain(c1);
+  LBT_destroy_chain(c2);
+  LBT_destroy_collection(collection);
+  free(data);
+  return result;
+}
+
+static bool test_serialized_chain(void) {
+  LBT_tag features[] = { LBT_make_tag("calt"), LBT_make_tag("zero") };
+  LBT_Glyph input[] = { FT_Get_Char_Index(face, '='), FT_Get_Char_Index(face, '='), FT_Get_Char_Index(face, '>'),
+                        FT_Get_Char_Index(face, '0'), FT_Get_Char_Index(face, '-'), FT_Get_Char_Index(face, '>') };
+  size_t n_input = sizeof(input) / sizeof(LBT_Glyph);
+  bool result = false;
+  size_t size = LBT_serialize_chain(cc, NULL, NULL, features, 2, NULL, 0);
+  uint8_t *data = malloc(size);
+  LBT_Chain *c1 = NULL, *c2 = NULL, *other = NULL;
+  if (size == 0 || data == NULL) goto end;
+  if (LBT_serialize_chain(cc, NULL, NULL, features, 2, data, size) != size) goto end;
+
+  c1 = LBT_load_chain(cc, NULL, NULL, features, 2, data, size);
+  c2 = LBT_generate_chain(cc, NULL, NULL, features, 2);
+  // Saved for other features
+  other = LBT_load_chain(cc, NULL, NULL, features, 1, data, size);
+  if (c1 == NULL || c2 == NULL || other != NULL) goto end;
+  size_t n1, n2;
+  LBT_Glyph *g1 = LBT_apply_chain(c1, input, n_input, &n1);
+  LBT_Glyph *g2 = LBT_apply_chain(c2, input, n_input, &n2);
+  result = g1 != NULL && g2 != NULL && n1 == n2 && memcmp(g1, g2, n1 * sizeof(LBT_Glyph)) == 0 &&
+           memcmp(g1, input, sizeof(input)) != 0;
+  free(g1);
+  free(g2);
+  // Truncated
+  if (LBT_load_chain(cc, NULL, NULL, features, 2, data, size - 1) != NULL) result = false;
+  // Only the Lookups of zero are saved, not the ones of calt compiled for c2
+  size_t zero_size = LBT_serialize_chain(cc, NULL, NULL, &features[1], 1, NULL, 0);
+  if (zero_size == 0 || zero_size * 2 > size) result = false;
+end:
+  LBT_destroy_chain(c1);
+  LBT_destroy_chain(c2);
+  LBT_destroy_chain(other);
+  free(data);
+  return result;
+}
+
 static tap_test tests[] = {
   { "Chain with default arguments", test_generate_chain, TAP_RUN },
   { "Chain with `latn` script", test_generate_chain_good_script, TAP_RUN },
@@ -92,6 +320,13 @@ static tap_test tests[] = {
   { "Chain with (bad) `AAAA` lang", test_generate_chain_bad_lang, TAP_RUN },
   { "Chain with `ccmp` feature", test_generate_chain_ccmp_feature, TAP_RUN },
   { "Chain with (bad, acceptable) `AAAA` feature", test_generate_chain_bad_feature, TAP_RUN },
+  { "Chain with the same features is shared", test_generate_chain_shared, TAP_RUN },
+  { "Chain outlives its ChainCreator", test_generate_chain_outlives_creator, TAP_RUN },
+  { "Chain compiled before others", test_generate_chain_compiled_later, TAP_RUN },
+  { "Chain from font data in memory", test_generate_chain_from_memory, TAP_RUN },
+  { "ChainCreator from (bad) font data", test_generate_chain_from_bad_memory, TAP_RUN },
+  { "Chain from a font collection", test_generate_chain_from_collection, TAP_RUN },
+  { "Serialized chain", test_serialized_chain, TAP_RUN },
 };
 
 int main(void) {
@@ -1,5 +1,7 @@
 #include <libatures.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "tap.h"
 #include "test_common.h"
@@ -78,12 +80,34 @@ make_test(contrasting_features7,
   "f",
   EXPECTED(453)
 )
+make_test(many_features,
+  NO_SCRIPT(), NO_LANG(),
+  FEATS("zero", "ss01", "ss02", "cv09", "cv17", "ss20"),
+  "f0",
+  EXPECTED(452, 734)
+)
 make_test(unrelated_features,
   NO_SCRIPT(), NO_LANG(),
   FEATS("locl"),
   "==1/2",
   EXPECTED(1049, 1049, 725, 829, 726)
 )
+// Fused Lookups map a range of glyphs, some of them to themselves
+static bool test_features_without_effect(void) {
+  LBT_tag features[] = { LBT_make_tag("calt"), LBT_make_tag("frac") };
+  const char *text = "#a";
+  LBT_Chain *c = LBT_generate_chain(cc, NULL, NULL, features, 2);
+  LBT_Glyph *original = utf8_to_GlyphID(face, text, strlen(text));
+  LBT_Glyph *out = NULL;
+  size_t out_len = 0;
+  bool result = c != NULL && original != NULL &&
+                !LBT_apply_chain_if_changed(c, original, strlen(text), &out, &out_len) &&
+                out == NULL && out_len == strlen(text);
+  free(out);
+  free(original);
+  LBT_destroy_chain(c);
+  return result;
+}
 
 static tap_test tests[] = {
   { "No features",           test_no_features,           TAP_RUN },
@@ -96,7 +120,9 @@ static tap_test tests[] = {
   { "Contrasting features5", test_contrasting_features5, TAP_RUN },
   { "Contrasting features6", test_contrasting_features6, TAP_RUN },
   { "Contrasting features7", test_contrasting_features7, TAP_RUN },
+  { "Many features",         test_many_features,         TAP_RUN },
   { "Unrelated features",    test_unrelated_features,    TAP_RUN },
+  { "Features without effect", test_features_without_effect, TAP_RUN },
 };
 
 int main(void) {
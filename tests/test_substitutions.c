@@ -1,5 +1,7 @@
 #include <libatures.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "tap.h"
 #include "test_common.h"
@@ -57,6 +59,275 @@ make_test(multiple_substitutions2,
   EXPECTED(1742, 881, 1742, 1742, 1591, 1742, 1742, 1742, 1610, 1742, 1742, 1611, 1742, 1742, 1591, 1742, 1742, 1589, 1742, 1742, 1615, 1742, 1613)
 )
 
+static LBT_tag calt[] = { LBT_make_tag("calt") };
+
+static bool test_unsafe_to_break(void) {
+  const char *text = "a == b";
+  const uint8_t expected_flags[] = { 0, 0, 0, LBT_GLYPH_UNSAFE_TO_BREAK, 0, 0 };
+  LBT_Chain *c = LBT_generate_chain(cc, NULL, NULL, calt, 1);
+  LBT_Glyph *original = utf8_to_GlyphID(face, text, strlen(text));
+  size_t out_len = 0;
+  uint8_t *flags = NULL;
+  LBT_Glyph *ligated = c != NULL && original != NULL ? LBT_apply_chain_with_flags(c, original, strlen(text), &out_len, &flags) : NULL;
+  // Only the two glyphs of the ligature are matched together
+  bool result = ligated != NULL && out_len == sizeof(expected_flags) &&
+                memcmp(flags, expected_flags, sizeof(expected_flags)) == 0;
+  free(ligated);
+  free(flags);
+  free(original);
+  LBT_destroy_chain(c);
+  return result;
+}
+
+static bool test_unsafe_to_break_ligature(void) {
+  const char *text = "<!-- a";
+  const uint8_t expected_flags[] = { 0, LBT_GLYPH_UNSAFE_TO_BREAK, LBT_GLYPH_UNSAFE_TO_BREAK, LBT_GLYPH_UNSAFE_TO_BREAK, 0, 0 };
+  LBT_Chain *c = LBT_generate_chain(cc, NULL, NULL, calt, 1);
+  LBT_Glyph *original = utf8_to_GlyphID(face, text, strlen(text));
+  size_t out_len = 0;
+  uint8_t *flags = NULL;
+  LBT_Glyph *ligated = c != NULL && original != NULL ? LBT_apply_chain_with_flags(c, original, strlen(text), &out_len, &flags) : NULL;
+  // The run can't be broken anywhere inside the four glyph ligature
+  bool result = ligated != NULL && out_len == sizeof(expected_flags) &&
+                memcmp(flags, expected_flags, sizeof(expected_flags)) == 0;
+  free(ligated);
+  free(flags);
+  free(original);
+  LBT_destroy_chain(c);
+  return result;
+}
+
+static bool test_clusters(void) {
+  const char *text = "a == b";
+  const uint32_t expected_clusters[] = { 0, 1, 2, 3, 4, 5 };
+  LBT_Chain *c = LBT_generate_chain(cc, NULL, NULL, calt, 1);
+  LBT_Glyph *original = utf8_to_GlyphID(face, text, strlen(text));
+  size_t out_len = 0;
+  uint32_t *clusters = NULL;
+  LBT_Glyph *ligated = c != NULL && original != NULL ? LBT_apply_chain_with_clusters(c, original, strlen(text), &out_len, &clusters) : NULL;
+  // The ligature is drawn over a spacer, so each glyph keeps its own cluster
+  bool result = ligated != NULL && out_len == sizeof(expected_clusters) / sizeof(expected_clusters[0]) &&
+                memcmp(clusters, expected_clusters, sizeof(expected_clusters)) == 0;
+  free(ligated);
+  free(clusters);
+  free(original);
+  LBT_destroy_chain(c);
+  return result;
+}
+
+static bool test_chain_context(void) {
+  LBT_Chain *c = LBT_generate_chain(cc, NULL, NULL, calt, 1);
+  LBT_Chain *empty = LBT_generate_chain(cc, NULL, NULL, NULL, 0);
+  size_t backtrack = 0, lookahead = 0, empty_backtrack = 1, empty_lookahead = 1;
+  if (c != NULL) LBT_get_chain_context(c, &backtrack, &lookahead);
+  if (empty != NULL) LBT_get_chain_context(empty, &empty_backtrack, &empty_lookahead);
+  bool result = backtrack > 0 && lookahead > 0 && empty_backtrack == 0 && empty_lookahead == 0;
+  LBT_destroy_chain(c);
+  LBT_destroy_chain(empty);
+  return result;
+}
+
+static bool test_first_affected_glyph(void) {
+  // Long enough to be scanned several glyphs at a time
+  const char *text = "abcdefghijklmnop == q";
+  size_t len = strlen(text);
+  LBT_Chain *c = LBT_generate_chain(cc, NULL, NULL, calt, 1);
+  LBT_Chain *empty = LBT_generate_chain(cc, NULL, NULL, NULL, 0);
+  LBT_Glyph *original = utf8_to_GlyphID(face, text, len);
+  size_t out_len = 0;
+  LBT_Glyph *ligated = c != NULL && original != NULL ? LBT_apply_chain(c, original, len, &out_len) : NULL;
+  bool result = false;
+  if (ligated == NULL || empty == NULL) goto end;
+  size_t changed = 0;
+  while (changed < len && changed < out_len && ligated[changed] == original[changed]) changed++;
+  size_t affected = LBT_find_first_affected_glyph(c, original, len);
+  // The letters can't start anything, so the scan gets past them
+  result = changed < len && affected > 0 && affected <= changed &&
+           LBT_find_first_affected_glyph(empty, original, len) == len;
+end:
+  free(ligated);
+  free(original);
+  LBT_destroy_chain(c);
+  LBT_destroy_chain(empty);
+  return result;
+}
+
+static bool test_long_run(void) {
+  // Candidates are found a block of glyphs at a time, and the matches at
+  // 63 and 64 cross from one to the next.
+  const char *piece = "== ";
+  size_t piece_len = strlen(piece), n_pieces = 40;
+  char text[128];
+  for (size_t i = 0; i < n_pieces; i++) memcpy(text + i * piece_len, piece, piece_len);
+  size_t len = n_pieces * piece_len;
+  LBT_Chain *c = LBT_generate_chain(cc, NULL, NULL, calt, 1);
+  LBT_Glyph *piece_glyphs = utf8_to_GlyphID(face, piece, piece_len);
+  LBT_Glyph *glyphs = utf8_to_GlyphID(face, text, len);
+  size_t piece_out_len = 0, out_len = 0;
+  LBT_Glyph *piece_out = c != NULL && piece_glyphs != NULL ? LBT_apply_chain(c, piece_glyphs, piece_len, &piece_out_len) : NULL;
+  LBT_Glyph *out = c != NULL && glyphs != NULL ? LBT_apply_chain(c, glyphs, len, &out_len) : NULL;
+  bool result = false;
+  if (piece_out == NULL || out == NULL || out_len != n_pieces * piece_out_len) goto end;
+  result = true;
+  for (size_t i = 0; i < n_pieces; i++) {
+    result &= memcmp(out + i * piece_out_len, piece_out, piece_out_len * sizeof(LBT_Glyph)) == 0;
+  }
+  // Something changed, or this would prove nothing
+  result &= piece_out_len != piece_len || memcmp(piece_out, piece_glyphs, piece_len * sizeof(LBT_Glyph)) != 0;
+end:
+  free(out);
+  free(piece_out);
+  free(glyphs);
+  free(piece_glyphs);
+  LBT_destroy_chain(c);
+  return result;
+}
+
+static bool test_apply_to_buffer(void) {
+  const char *text = "a == b";
+  size_t len = strlen(text);
+  LBT_Chain *c = LBT_generate_chain(cc, NULL, NULL, calt, 1);
+  LBT_Glyph *original = utf8_to_GlyphID(face, text, len);
+  size_t n_expected = 0;
+  LBT_Glyph *expected = c != NULL && original != NULL ? LBT_apply_chain(c, original, len, &n_expected) : NULL;
+  LBT_Glyph buffer[16];
+  bool result = false;
+  if (expected == NULL || n_expected > sizeof(buffer) / sizeof(buffer[0])) goto end;
+
+  if (LBT_apply_chain_to_buffer(c, original, len, buffer, n_expected) != n_expected ||
+      memcmp(buffer, expected, n_expected * sizeof(LBT_Glyph)) != 0) goto end;
+  // Too small, it only says how big it needs to be
+  if (LBT_apply_chain_to_buffer(c, original, len, buffer, n_expected - 1) != n_expected) goto end;
+  // In place
+  memcpy(buffer, original, len * sizeof(LBT_Glyph));
+  result = LBT_apply_chain_to_buffer(c, buffer, len, buffer, sizeof(buffer) / sizeof(buffer[0])) == n_expected &&
+           memcmp(buffer, expected, n_expected * sizeof(LBT_Glyph)) == 0;
+end:
+  free(expected);
+  free(original);
+  LBT_destroy_chain(c);
+  return result;
+}
+
+static bool test_apply_if_changed(void) {
+  const char *unchanged_text = "hello world", *changed_text = "a == b";
+  LBT_Chain *c = LBT_generate_chain(cc, NULL, NULL, calt, 1);
+  LBT_Glyph *unchanged = utf8_to_GlyphID(face, unchanged_text, strlen(unchanged_text));
+  LBT_Glyph *changed = utf8_to_GlyphID(face, changed_text, strlen(changed_text));
+  LBT_Glyph *out = NULL, *expected = NULL;
+  size_t out_len = 0, n_expected = 0;
+  bool result = false;
+  if (c == NULL || unchanged == NULL || changed == NULL) goto end;
+
+  // Nothing is allocated, the input is already the result
+  out = unchanged; // Must be overwritten
+  if (LBT_apply_chain_if_changed(c, unchanged, strlen(unchanged_text), &out, &out_len) ||
+      out != NULL || out_len != strlen(unchanged_text)) goto end;
+
+  expected = LBT_apply_chain(c, changed, strlen(changed_text), &n_expected);
+  result = expected != NULL &&
+           LBT_apply_chain_if_changed(c, changed, strlen(changed_text), &out, &out_len) &&
+           out != NULL && out_len == n_expected && memcmp(out, expected, n_expected * sizeof(LBT_Glyph)) == 0;
+end:
+  free(out);
+  free(expected);
+  free(unchanged);
+  free(changed);
+  LBT_destroy_chain(c);
+  return result;
+}
+
+static bool test_apply_with_workspace(void) {
+  const char *texts[] = { "-><-><==><=><-><--<<-<>", "a == b" };
+  LBT_Chain *c = LBT_generate_chain(cc, NULL, NULL, calt, 1);
+  LBT_Workspace *workspace = LBT_new_workspace();
+  bool result = c != NULL && workspace != NULL;
+  // The second text reuses what the first one made the workspace grow to
+  for (size_t t = 0; t < 2 && result; t++) {
+    size_t len = strlen(texts[t]), n_expected = 0, out_len = 0;
+    LBT_Glyph *original = utf8_to_GlyphID(face, texts[t], len);
+    LBT_Glyph *expected = original != NULL ? LBT_apply_chain(c, original, len, &n_expected) : NULL;
+    const LBT_Glyph *out = expected != NULL ? LBT_apply_chain_with_workspace(c, workspace, original, len, &out_len) : NULL;
+    result = out != NULL && out_len == n_expected && memcmp(out, expected, n_expected * sizeof(LBT_Glyph)) == 0;
+    free(expected);
+    free(original);
+  }
+  LBT_destroy_workspace(workspace);
+  LBT_destroy_chain(c);
+  return result;
+}
+
+static bool test_segments(void) {
+  const char *text = "== abcdefghijklmnop ==";
+  size_t len = strlen(text);
+  LBT_Chain *c = LBT_generate_chain(cc, NULL, NULL, calt, 1);
+  LBT_Glyph *original = utf8_to_GlyphID(face, text, len);
+  size_t n_expected = 0, ends[4];
+  LBT_Glyph *expected = c != NULL && original != NULL ? LBT_apply_chain(c, original, len, &n_expected) : NULL;
+  LBT_Glyph joined[32];
+  size_t capacity = sizeof(joined) / sizeof(joined[0]);
+  bool result = false;
+  if (expected == NULL) goto end;
+
+  // The letters keep the two ligatures apart
+  size_t n_segments = LBT_find_segments(c, original, len, ends, 4);
+  if (n_segments < 2 || n_segments > 4 || ends[n_segments - 1] != len) goto end;
+  size_t start = 0, n_joined = 0;
+  for (size_t i = 0; i < n_segments; i++) {
+    size_t out_len = LBT_apply_chain_to_buffer(c, original + start, ends[i] - start, joined + n_joined, capacity - n_joined);
+    if (out_len == 0 || n_joined + out_len > capacity) goto end;
+    n_joined += out_len;
+    start = ends[i];
+  }
+  result = n_joined == n_expected && memcmp(joined, expected, n_expected * sizeof(LBT_Glyph)) == 0;
+end:
+  free(expected);
+  free(original);
+  LBT_destroy_chain(c);
+  return result;
+}
+
+static bool test_shaped_run(void) {
+  const char *text = "== abcdefghijklmnop ==";
+  size_t len = strlen(text);
+  size_t size = LBT_serialize_chain(cc, NULL, NULL, calt, 1, NULL, 0);
+  uint8_t *data = malloc(size);
+  LBT_Glyph *original = utf8_to_GlyphID(face, text, len);
+  LBT_Chain *c = NULL;
+  LBT_ShapedRun *run = NULL;
+  LBT_Glyph *expected = NULL;
+  size_t n_expected = 0, out_len = 0;
+  bool result = false;
+  if (size == 0 || data == NULL || original == NULL ||
+      LBT_serialize_chain(cc, NULL, NULL, calt, 1, data, size) != size) goto end;
+  c = LBT_load_chain(cc, NULL, NULL, calt, 1, data, size);
+  expected = c != NULL ? LBT_apply_chain(c, original, len, &n_expected) : NULL;
+  run = c != NULL ? LBT_new_shaped_run(c, NULL, 0) : NULL;
+  if (expected == NULL || run == NULL) goto end;
+
+  // Typed one glyph at a time
+  for (size_t i = 0; i < len; i++) {
+    if (!LBT_edit_shaped_run(run, i, i, &original[i], 1)) goto end;
+  }
+  const LBT_Glyph *out = LBT_get_shaped_run_output(run, &out_len);
+  if (out_len != n_expected || memcmp(out, expected, n_expected * sizeof(LBT_Glyph)) != 0) goto end;
+
+  // The loaded chain reads its data in place, and without it changes nothing.
+  // The first ligature is only kept if the edit doesn't apply the chain to it again.
+  memset(data, 0, size);
+  if (!LBT_edit_shaped_run(run, len - 2, len, &original[len - 2], 2)) goto end;
+  out = LBT_get_shaped_run_output(run, &out_len);
+  result = out_len == len && memcmp(out, expected, 2 * sizeof(LBT_Glyph)) == 0 &&
+           memcmp(out + 2, original + 2, (len - 2) * sizeof(LBT_Glyph)) == 0;
+end:
+  LBT_destroy_shaped_run(run);
+  LBT_destroy_chain(c);
+  free(expected);
+  free(original);
+  free(data);
+  return result;
+}
+
 static tap_test tests[] = {
   { "No substitutions",        test_no_substitutions,        TAP_RUN },
   { "Simple substitution1",    test_simple_substitution1,    TAP_RUN },
@@ -64,6 +335,17 @@ static tap_test tests[] = {
   { "Simple substitution3",    test_simple_substitution3,    TAP_RUN },
   { "Multiple substitutions1", test_multiple_substitutions1, TAP_RUN },
   { "Multiple substitutions2", test_multiple_substitutions2, TAP_RUN },
+  { "Unsafe to break",         test_unsafe_to_break,         TAP_RUN },
+  { "Unsafe to break ligature", test_unsafe_to_break_ligature, TAP_RUN },
+  { "Clusters",                test_clusters,                TAP_RUN },
+  { "Chain context",           test_chain_context,           TAP_RUN },
+  { "First affected glyph",    test_first_affected_glyph,    TAP_RUN },
+  { "Long run",                test_long_run,                TAP_RUN },
+  { "Apply to buffer",         test_apply_to_buffer,         TAP_RUN },
+  { "Apply if changed",        test_apply_if_changed,        TAP_RUN },
+  { "Apply with workspace",    test_apply_with_workspace,    TAP_RUN },
+  { "Segments",                test_segments,                TAP_RUN },
+  { "Shaped run",              test_shaped_run,              TAP_RUN },
 };
 
 int main(void) {
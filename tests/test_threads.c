@@ -0,0 +1,352 @@
+#include <libatures.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "tap.h"
+#include "test_common.h"
+#include "cache.h"
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#define N_THREADS 8
+#define N_ITERATIONS 200
+
+static FT_Library lib;
+static FT_Face face;
+static LBT_ChainCreator *cc;
+
+static const char *texts[] = {
+  "==",
+  "->",
+  "==1/2",
+  "hello world",
+  "a != b && c <= d || e >= f",
+  "www <!-- --> ::= |> <| ... ;;",
+};
+#define N_TEXTS (sizeof(texts) / sizeof(texts[0]))
+
+static LBT_tag features[] = { LBT_make_tag("calt"), LBT_make_tag("frac"), LBT_make_tag("zero"), LBT_make_tag("ss01") };
+#define N_FEATURES (sizeof(features) / sizeof(features[0]))
+
+// FreeType faces aren't thread-safe, so the glyphs are prepared beforehand.
+static LBT_Glyph *inputs[N_TEXTS];
+static LBT_Glyph *expected[N_TEXTS];
+static size_t n_expected[N_TEXTS];
+
+static void setup(FT_Face face, LBT_ChainCreator **cc) {
+  *cc = LBT_new(face);
+}
+
+static void teardown(LBT_ChainCreator **cc) {
+  LBT_destroy(*cc);
+  *cc = NULL;
+}
+
+static bool apply_and_compare(const LBT_Chain *chain) {
+  for (size_t t = 0; t < N_TEXTS; t++) {
+    size_t out_len = 0;
+    LBT_Glyph *out = LBT_apply_chain(chain, inputs[t], strlen(texts[t]), &out_len);
+    bool same = out != NULL && out_len == n_expected[t] &&
+                memcmp(out, expected[t], out_len * sizeof(LBT_Glyph)) == 0;
+    free(out);
+    if (!same) return false;
+  }
+  return true;
+}
+
+static void *apply_worker(void *arg) {
+  const LBT_Chain *chain = arg;
+  for (int i = 0; i < N_ITERATIONS; i++) {
+    if (!apply_and_compare(chain)) return (void *)0;
+  }
+  return (void *)1;
+}
+
+static void *workspace_worker(void *arg) {
+  const LBT_Chain *chain = arg;
+  LBT_Workspace *workspace = LBT_new_workspace();
+  if (workspace == NULL) return (void *)0;
+  void *result = (void *)1;
+  for (int i = 0; i < N_ITERATIONS && result != NULL; i++) {
+    for (size_t t = 0; t < N_TEXTS; t++) {
+      size_t out_len = 0;
+      const LBT_Glyph *out = LBT_apply_chain_with_workspace(chain, workspace, inputs[t], strlen(texts[t]), &out_len);
+      if (out == NULL || out_len != n_expected[t] ||
+          memcmp(out, expected[t], out_len * sizeof(LBT_Glyph)) != 0) {
+        result = (void *)0;
+        break;
+      }
+    }
+  }
+  LBT_destroy_workspace(workspace);
+  return result;
+}
+
+static void *generate_worker(void *arg) {
+  (void)arg;
+  for (int i = 0; i < N_ITERATIONS / 10; i++) {
+    LBT_Chain *chain = LBT_generate_chain(cc, NULL, NULL, features, N_FEATURES);
+    if (chain == NULL) return (void *)0;
+    bool same = apply_and_compare(chain);
+    LBT_destroy_chain(chain);
+    if (!same) return (void *)0;
+  }
+  return (void *)1;
+}
+
+// Every holder of the shared chain asks for a cache, while others apply it.
+static void *cache_worker(void *arg) {
+  (void)arg;
+  for (int i = 0; i < N_ITERATIONS / 10; i++) {
+    LBT_Chain *chain = LBT_generate_chain(cc, NULL, NULL, features, N_FEATURES);
+    if (chain == NULL) return (void *)0;
+    bool same = apply_and_compare(chain) && LBT_set_chain_cache(chain, 64 * 1024) && apply_and_compare(chain);
+    LBT_destroy_chain(chain);
+    if (!same) return (void *)0;
+  }
+  return (void *)1;
+}
+
+static void *shared_generate_worker(void *arg) {
+  LBT_Chain *shared = arg;
+  for (int i = 0; i < N_ITERATIONS; i++) {
+    LBT_Chain *chain = LBT_generate_chain(cc, NULL, NULL, features, N_FEATURES);
+    bool same = chain == shared || (shared == NULL && chain != NULL);
+    LBT_destroy_chain(chain);
+    if (!same) return (void *)0;
+  }
+  return (void *)1;
+}
+
+static const uint16_t cached_input[] = { 1049, 1049, 1049 };
+static const uint16_t cached_output[] = { 7 };
+
+// Looks up the result put in the cache, and one that isn't there.
+static void *cache_hit_worker(void *arg) {
+  ResultCache *cache = arg;
+  uint64_t hash = hash_glyphs(cached_input, 3);
+  GlyphArray glyphs;
+  GlyphArray_init(&glyphs);
+  void *result = (void *)1;
+  for (int i = 0; i < N_ITERATIONS && result != NULL; i++) {
+    GlyphArray_clear(&glyphs);
+    if (!GlyphArray_append(&glyphs, cached_input, 3) || !ResultCache_get(cache, hash, &glyphs) ||
+        glyphs.len != 1 || glyphs.array[0] != cached_output[0]) {
+      result = (void *)0;
+    }
+    // Same hash, but other glyphs
+    GlyphArray_clear(&glyphs);
+    if (!GlyphArray_append(&glyphs, cached_input, 2) || ResultCache_get(cache, hash, &glyphs)) {
+      result = (void *)0;
+    }
+  }
+  GlyphArray_free_storage(&glyphs);
+  return result;
+}
+
+static bool run_threads(void *(*worker)(void *), void *arg) {
+  pthread_t threads[N_THREADS];
+  size_t started = 0;
+  bool result = true;
+  for (; started < N_THREADS; started++) {
+    if (pthread_create(&threads[started], NULL, worker, arg) != 0) {
+      result = false;
+      break;
+    }
+  }
+  for (size_t i = 0; i < started; i++) {
+    void *thread_result;
+    pthread_join(threads[i], &thread_result);
+    if (thread_result == NULL) result = false;
+  }
+  return result;
+}
+
+static bool test_shared_chain(void) {
+  LBT_Chain *chain = LBT_generate_chain(cc, NULL, NULL, features, N_FEATURES);
+  if (chain == NULL) return false;
+  bool result = run_threads(apply_worker, chain);
+  LBT_destroy_chain(chain);
+  return result;
+}
+
+static bool test_shared_chain_with_workspaces(void) {
+  LBT_Chain *chain = LBT_generate_chain(cc, NULL, NULL, features, N_FEATURES);
+  if (chain == NULL) return false;
+  bool result = run_threads(workspace_worker, chain);
+  LBT_destroy_chain(chain);
+  return result;
+}
+
+static bool test_shared_cache(void) {
+  LBT_Chain *chain = LBT_generate_chain(cc, NULL, NULL, features, N_FEATURES);
+  if (chain == NULL) return false;
+  bool result = LBT_set_chain_cache(chain, 64 * 1024) && run_threads(apply_worker, chain);
+  LBT_destroy_chain(chain);
+  return result;
+}
+
+static bool test_cache_hit(void) {
+  ResultCache *cache = ResultCache_new(64 * 1024);
+  if (cache == NULL) return false;
+  // Not what any chain would make of the input, so it can only come from the cache
+  GlyphArray result;
+  GlyphArray_init(&result);
+  bool ok = GlyphArray_append(&result, cached_output, 1);
+  result.modified = true;
+  if (ok) ResultCache_put(cache, hash_glyphs(cached_input, 3), cached_input, 3, &result);
+  ok = ok && run_threads(cache_hit_worker, cache);
+  GlyphArray_free_storage(&result);
+  ResultCache_free(cache);
+  return ok;
+}
+
+static bool test_cache_while_applying(void) {
+  return run_threads(cache_worker, NULL);
+}
+
+static bool test_shared_chain_creator(void) {
+  return run_threads(generate_worker, NULL);
+}
+
+static bool test_concurrent_generation(void) {
+  // Without a chain held, it's generated and destroyed over and over
+  if (!run_threads(shared_generate_worker, NULL)) return false;
+  LBT_Chain *chain = LBT_generate_chain(cc, NULL, NULL, features, N_FEATURES);
+  if (chain == NULL) return false;
+  bool result = run_threads(shared_generate_worker, chain);
+  LBT_destroy_chain(chain);
+  return result;
+}
+
+#define N_BATCH_RUNS 1000
+
+static bool apply_batch_and_compare(const LBT_Chain *chain, LBT_Pool *pool) {
+  LBT_Run runs[N_BATCH_RUNS];
+  size_t offsets[N_BATCH_RUNS + 1];
+  for (size_t i = 0; i < N_BATCH_RUNS; i++) {
+    runs[i].glyphs = inputs[i % N_TEXTS];
+    runs[i].len = strlen(texts[i % N_TEXTS]);
+  }
+
+  LBT_Glyph *out = LBT_apply_chain_batch(chain, pool, runs, N_BATCH_RUNS, offsets);
+  if (out == NULL) return false;
+  bool result = offsets[0] == 0;
+  for (size_t i = 0; i < N_BATCH_RUNS && result; i++) {
+    size_t t = i % N_TEXTS;
+    result = offsets[i + 1] - offsets[i] == n_expected[t] &&
+             memcmp(out + offsets[i], expected[t], n_expected[t] * sizeof(LBT_Glyph)) == 0;
+  }
+  free(out);
+  return result;
+}
+
+static void *batch_worker(void *arg) {
+  LBT_Pool *pool = arg;
+  LBT_Chain *chain = LBT_generate_chain(cc, NULL, NULL, features, N_FEATURES);
+  if (chain == NULL) return (void *)0;
+  void *result = (void *)1;
+  for (int i = 0; i < N_ITERATIONS / 10 && result != NULL; i++) {
+    if (!apply_batch_and_compare(chain, pool)) result = (void *)0;
+  }
+  LBT_destroy_chain(chain);
+  return result;
+}
+
+static bool test_batch(void) {
+  LBT_Chain *chain = LBT_generate_chain(cc, NULL, NULL, features, N_FEATURES);
+  if (chain == NULL) return false;
+  bool result = apply_batch_and_compare(chain, NULL);
+  LBT_destroy_chain(chain);
+  return result;
+}
+
+static bool test_batch_with_pool(void) {
+  LBT_Chain *chain = LBT_generate_chain(cc, NULL, NULL, features, N_FEATURES);
+  LBT_Pool *pool = LBT_new_pool(N_THREADS);
+  bool result = chain != NULL && pool != NULL;
+  for (int i = 0; i < N_ITERATIONS / 10 && result; i++) {
+    result = apply_batch_and_compare(chain, pool);
+  }
+  LBT_destroy_pool(pool);
+  LBT_destroy_chain(chain);
+  return result;
+}
+
+static bool test_shared_pool(void) {
+  LBT_Pool *pool = LBT_new_pool(0);
+  if (pool == NULL) return false;
+  bool result = run_threads(batch_worker, pool);
+  LBT_destroy_pool(pool);
+  return result;
+}
+
+#define LONG_RUN_GLYPHS 100000
+
+static bool test_long_run(void) {
+  LBT_Chain *chain = LBT_generate_chain(cc, NULL, NULL, features, N_FEATURES);
+  LBT_Pool *pool = LBT_new_pool(N_THREADS);
+  LBT_Glyph *input = malloc(LONG_RUN_GLYPHS * sizeof(LBT_Glyph));
+  bool result = chain != NULL && pool != NULL && input != NULL;
+  if (result) {
+    // All the texts one after the other, over and over
+    size_t len = 0;
+    for (size_t t = 0; len < LONG_RUN_GLYPHS; t = (t + 1) % N_TEXTS) {
+      for (size_t i = 0; i < strlen(texts[t]) && len < LONG_RUN_GLYPHS; i++) {
+        input[len++] = inputs[t][i];
+      }
+    }
+    size_t n_sequential, n_parallel = 0;
+    LBT_Glyph *sequential = LBT_apply_chain(chain, input, LONG_RUN_GLYPHS, &n_sequential);
+    LBT_Glyph *parallel = LBT_apply_chain_parallel(chain, pool, input, LONG_RUN_GLYPHS, &n_parallel);
+    result = sequential != NULL && parallel != NULL && n_sequential == n_parallel &&
+             memcmp(sequential, parallel, n_sequential * sizeof(LBT_Glyph)) == 0;
+    free(sequential);
+    free(parallel);
+  }
+  free(input);
+  LBT_destroy_pool(pool);
+  LBT_destroy_chain(chain);
+  return result;
+}
+
+static tap_test tests[] = {
+  { "Shared chain",                 test_shared_chain,                 TAP_RUN },
+  { "Shared chain with workspaces", test_shared_chain_with_workspaces, TAP_RUN },
+  { "Shared chain creator",         test_shared_chain_creator,         TAP_RUN },
+  { "Concurrent generation",        test_concurrent_generation,        TAP_RUN },
+  { "Shared cache",                 test_shared_cache,                 TAP_RUN },
+  { "Cache hit",                    test_cache_hit,                    TAP_RUN },
+  { "Cache set while applying",     test_cache_while_applying,         TAP_RUN },
+  { "Batch",                        test_batch,                        TAP_RUN },
+  { "Batch with pool",              test_batch_with_pool,              TAP_RUN },
+  { "Shared pool",                  test_shared_pool,                  TAP_RUN },
+  { "Long run in parallel",         test_long_run,                     TAP_RUN },
+};
+
+int main(void) {
+  init_freetype(&lib);
+  load_font(lib, "tests/JetBrainsMono-Regular.ttf", &face);
+
+  setup(face, &cc);
+
+  // Reference output, from a single thread
+  LBT_Chain *chain = LBT_generate_chain(cc, NULL, NULL, features, N_FEATURES);
+  for (size_t t = 0; t < N_TEXTS; t++) {
+    inputs[t] = utf8_to_GlyphID(face, texts[t], strlen(texts[t]));
+    expected[t] = LBT_apply_chain(chain, inputs[t], strlen(texts[t]), &n_expected[t]);
+  }
+  LBT_destroy_chain(chain);
+
+  tap_run_tests(tests);
+
+  for (size_t t = 0; t < N_TEXTS; t++) {
+    free(inputs[t]);
+    free(expected[t]);
+  }
+  teardown(&cc);
+  return 0;
+}